@@ -0,0 +1,105 @@
+// malloc vs the slab allocator on an insert-heavy load: objects sized like
+// entries (small keys and values) and zset nodes, allocated in bulk, then
+// freed in random order and allocated again. Each allocator runs in its
+// own process so that the RSS growth is its own.
+// usage: bench_alloc [nobjs]   (default: 10000000)
+#include "byoredis/common/slab.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+#include <algorithm>
+#include <random>
+
+static double now_sec() {
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return (double)tv.tv_sec + (double)tv.tv_nsec * 1e-9;
+}
+
+static size_t rss_bytes() {
+  long pages = 0, rss = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (!f || fscanf(f, "%ld %ld", &pages, &rss) != 2) {
+    rss = 0;
+  }
+  if (f) {
+    fclose(f);
+  }
+  return (size_t)rss * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+struct Malloc {
+  static char const *name() { return "malloc"; }
+  static void *alloc(size_t size) { return malloc(size); }
+  static void release(void *p, size_t) { free(p); }
+};
+
+struct Slab {
+  static char const *name() { return "slab"; }
+  static void *alloc(size_t size) { return slab_alloc(size); }
+  static void release(void *p, size_t size) { slab_free(p, size); }
+};
+
+template <class A>
+static void run(std::vector<uint32_t> const &sizes, std::vector<size_t> const &order) {
+  size_t n = sizes.size();
+  std::vector<void *> ptrs(n);
+  size_t rss0 = rss_bytes();
+  double t0 = now_sec();
+  for (size_t i = 0; i < n; i++) {
+    ptrs[i] = A::alloc(sizes[i]);
+    *(char *)ptrs[i] = 1;  // touch like an initialization would
+  }
+  double alloc_ns = (now_sec() - t0) * 1e9 / (double)n;
+  size_t rss = rss_bytes() - rss0;
+  // free half in random order, then refill
+  size_t half = n / 2;
+  t0 = now_sec();
+  for (size_t i = 0; i < half; i++) {
+    A::release(ptrs[order[i]], sizes[order[i]]);
+  }
+  double free_ns = (now_sec() - t0) * 1e9 / (double)half;
+  t0 = now_sec();
+  for (size_t i = 0; i < half; i++) {
+    ptrs[order[i]] = A::alloc(sizes[order[i]]);
+  }
+  double realloc_ns = (now_sec() - t0) * 1e9 / (double)half;
+  printf("  %-8s %8.1f %8.1f %8.1f %10.1f\n", A::name(), alloc_ns, free_ns, realloc_ns,
+         (double)rss / (double)n);
+  fflush(stdout);
+}
+
+template <class A>
+static void run_forked(std::vector<uint32_t> const &sizes, std::vector<size_t> const &order) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    run<A>(sizes, order);
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 10 * 1000 * 1000;
+  std::mt19937_64 rng(n);
+  std::vector<uint32_t> sizes(n);
+  for (uint32_t &size : sizes) {
+    // an Entry header is 42 bytes and a ZNode 88, plus 8-24 bytes of key
+    // and 1-16 bytes of value
+    size = (rng() % 2 ? 42 + 1 + 8 + rng() % 17 + 1 + rng() % 16 : 88 + 8 + rng() % 17);
+  }
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; i++) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), rng);
+  printf("%zu objects  alloc     free     refill   RSS B/obj  (ns/op)\n", n);
+  fflush(stdout);  // not inherited by the children
+  run_forked<Malloc>(sizes, order);
+  run_forked<Slab>(sizes, order);
+  return 0;
+}
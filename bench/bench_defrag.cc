@@ -0,0 +1,100 @@
+// Active defragmentation of the slab: objects sized like entries and zset
+// nodes are allocated, 90% of them freed in random order, then the
+// survivors are moved out of the sparse spans pass after pass, as the
+// server does. Reports the RSS and the slab reserved bytes after each pass.
+// usage: bench_defrag [nobjs]   (default: 10000000)
+#include "byoredis/common/slab.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <random>
+
+static double now_sec() {
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return (double)tv.tv_sec + (double)tv.tv_nsec * 1e-9;
+}
+
+static size_t rss_bytes() {
+  long pages = 0, rss = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (!f || fscanf(f, "%ld %ld", &pages, &rss) != 2) {
+    rss = 0;
+  }
+  if (f) {
+    fclose(f);
+  }
+  return (size_t)rss * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+struct Obj {
+  void *ptr;
+  uint32_t size;
+};
+
+static uint64_t reserved_bytes() {
+  SlabClassStats stats[k_slab_classes];
+  slab_stats(stats);
+  uint64_t total = 0;
+  for (SlabClassStats const &s : stats) {
+    total += s.reserved;
+  }
+  return total;
+}
+
+static void report(char const *phase, size_t live, double secs, size_t moved) {
+  printf("  %-10s %10.1f %10.1f %10.1f %8.1f %10zu\n", phase, (double)rss_bytes() / 1e6,
+         (double)reserved_bytes() / 1e6, (double)live / 1e6, secs * 1e3, moved);
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 10 * 1000 * 1000;
+  std::mt19937_64 rng(n);
+  std::vector<Obj> objs(n);
+  for (Obj &o : objs) {
+    // see bench_alloc
+    o.size = (uint32_t)(rng() % 2 ? 42 + 1 + 8 + rng() % 17 + 1 + rng() % 16 : 88 + 8 + rng() % 17);
+    o.ptr = slab_alloc(o.size);
+    *(char *)o.ptr = 1;
+  }
+  printf("%zu objects  RSS MB  reserved MB   live MB      ms    moved\n", n);
+  size_t live = 0;
+  for (Obj const &o : objs) {
+    live += slab_size(o.size);
+  }
+  report("loaded", live, 0, 0);
+  // keep 10%
+  std::vector<Obj> kept;
+  live = 0;
+  for (Obj const &o : objs) {
+    if (rng() % 10 == 0) {
+      kept.push_back(o);
+      live += slab_size(o.size);
+    } else {
+      slab_free(o.ptr, o.size);
+    }
+  }
+  objs.clear();
+  objs.shrink_to_fit();
+  report("freed", live, 0, 0);
+  for (int pass = 1; pass <= 12; pass++) {
+    size_t moved = 0;
+    double t0 = now_sec();
+    for (Obj &o : kept) {
+      if (void *p = slab_defrag_move(o.ptr, o.size)) {
+        slab_defrag_free(o.ptr, o.size);
+        o.ptr = p;
+        moved++;
+      }
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "pass %d", pass);
+    report(name, live, now_sec() - t0, moved);
+    if (moved == 0) {
+      break;
+    }
+  }
+  return 0;
+}
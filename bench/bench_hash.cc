@@ -0,0 +1,34 @@
+// str_hash throughput by key length
+// usage: bench_hash
+#include "byoredis/common/hash.hh"
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+
+static double now_sec() {
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return (double)tv.tv_sec + (double)tv.tv_nsec * 1e-9;
+}
+
+int main() {
+  hash_seed_init();
+  std::vector<uint8_t> buf(1 << 16);
+  for (size_t i = 0; i < buf.size(); i++) {
+    buf[i] = (uint8_t)(i * 131);
+  }
+  printf("   len    ns/hash   bytes/ns\n");
+  for (size_t len : {8, 16, 32, 64, 100, 256, 1024, 65536}) {
+    size_t n = (size_t)(256 << 20) / (len + 16);
+    uint64_t sink = 0;
+    double t0 = now_sec();
+    for (size_t i = 0; i < n; i++) {
+      // chain the results so the calls can't overlap completely
+      size_t off = sink & 7;
+      sink += str_hash(buf.data() + off, len);
+    }
+    double ns = (now_sec() - t0) * 1e9 / (double)n;
+    printf("%6zu   %8.2f   %8.2f   (%llx)\n", len, ns, (double)len / ns, (unsigned long long)(sink & 0xF));
+  }
+  return 0;
+}
@@ -0,0 +1,141 @@
+// HMap vs SMap lookups, hit and miss, with the nodes in random memory order.
+// "batch" is hits in batches of k_batch keys with the prefetch passes first,
+// like a multi-key command.
+// usage: bench_hashtable [nkeys...]   (default: 1000000)
+#include "byoredis/ds/hashtable.hh"
+#include "byoredis/ds/swisstable.hh"
+#include "byoredis/ds/intrusive.hh"  // for container_of
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#include <random>
+
+struct Data {
+  HNode node;
+  uint64_t key = 0;
+};
+
+static uint64_t mix64(uint64_t x) {
+  x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ull;
+  x ^= x >> 27; x *= 0x94D049BB133111EBull;
+  x ^= x >> 31;
+  return x;
+}
+
+static bool data_eq(HNode *lhs, HNode *rhs) {
+  return container_of(lhs, Data, node)->key == container_of(rhs, Data, node)->key;
+}
+
+static double now_sec() {
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return (double)tv.tv_sec + (double)tv.tv_nsec * 1e-9;
+}
+
+template <class Map, class Lookup>
+static double bench_lookup(Map *map, Lookup lookup, std::vector<uint64_t> const &keys, bool hit) {
+  size_t found = 0;
+  double t0 = now_sec();
+  for (uint64_t key : keys) {
+    Data probe;
+    probe.key = hit ? key : ~key;
+    probe.node.hcode = mix64(probe.key);
+    found += lookup(map, &probe.node, &data_eq) != NULL;
+  }
+  double dt = now_sec() - t0;
+  if (found != (hit ? keys.size() : 0)) {
+    fprintf(stderr, "bad lookup result\n");
+    exit(1);
+  }
+  return dt * 1e9 / (double)keys.size();
+}
+
+size_t const k_batch = 16;
+
+template <class Map, class Lookup, class Prefetch>
+static double bench_batch(Map *map, Lookup lookup, Prefetch prefetch, Prefetch prefetch_chain,
+                          std::vector<uint64_t> const &keys) {
+  size_t found = 0;
+  double t0 = now_sec();
+  Data probes[k_batch];
+  for (size_t b = 0; b < keys.size(); b += k_batch) {
+    size_t n = std::min(k_batch, keys.size() - b);
+    for (size_t i = 0; i < n; i++) {
+      probes[i].key = keys[b + i];
+      probes[i].node.hcode = mix64(probes[i].key);
+      prefetch(map, probes[i].node.hcode);
+    }
+    for (size_t i = 0; i < n; i++) {
+      prefetch_chain(map, probes[i].node.hcode);
+    }
+    for (size_t i = 0; i < n; i++) {
+      found += lookup(map, &probes[i].node, &data_eq) != NULL;
+    }
+  }
+  double dt = now_sec() - t0;
+  if (found != keys.size()) {
+    fprintf(stderr, "bad lookup result\n");
+    exit(1);
+  }
+  return dt * 1e9 / (double)keys.size();
+}
+
+static void run(size_t n) {
+  std::mt19937_64 rng(n);
+  std::vector<uint64_t> keys(n);
+  for (uint64_t &k : keys) {
+    k = rng() | 1;  // ~k is never a key
+  }
+  // the nodes are allocated in a different order than they are looked up
+  std::vector<Data> nodes(n);
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; i++) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), rng);
+  for (size_t i = 0; i < n; i++) {
+    Data &d = nodes[order[i]];
+    d.key = keys[i];
+    d.node.hcode = mix64(d.key);
+  }
+  size_t nprobe = std::min(n, (size_t)10 * 1000 * 1000);
+  std::vector<uint64_t> probes(keys.begin(), keys.begin() + nprobe);
+  std::shuffle(probes.begin(), probes.end(), rng);
+
+  HMap hmap;
+  SMap smap;
+  double t0 = now_sec();
+  for (Data &d : nodes) {
+    hm_insert(&hmap, &d.node);
+  }
+  double hm_ins = (now_sec() - t0) * 1e9 / (double)n;
+  t0 = now_sec();
+  for (Data &d : nodes) {
+    sm_insert(&smap, &d.node);
+  }
+  double sm_ins = (now_sec() - t0) * 1e9 / (double)n;
+
+  printf("%10zu keys   insert   hit      miss     batch  (ns/op)\n", n);
+  printf("  HMap            %6.1f   %6.1f   %6.1f   %6.1f\n", hm_ins,
+         bench_lookup(&hmap, &hm_lookup, probes, true),
+         bench_lookup(&hmap, &hm_lookup, probes, false),
+         bench_batch(&hmap, &hm_lookup, &hm_prefetch, &hm_prefetch_chain, probes));
+  printf("  SMap            %6.1f   %6.1f   %6.1f   %6.1f\n", sm_ins,
+         bench_lookup(&smap, &sm_lookup, probes, true),
+         bench_lookup(&smap, &sm_lookup, probes, false),
+         bench_batch(&smap, &sm_lookup, &sm_prefetch, &sm_prefetch_chain, probes));
+  hm_clear(&hmap);
+  sm_clear(&smap);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    run(1000 * 1000);
+  }
+  for (int i = 1; i < argc; i++) {
+    run((size_t)strtoull(argv[i], NULL, 10));
+  }
+  return 0;
+}
@@ -0,0 +1,198 @@
+// TTL timers: the binary heap vs the timing wheel, with most keys having a
+// TTL of 1 s to 1 h. The keys are touched in random order:
+//   set      a TTL on every key that has one (EXPIRE on new keys)
+//   update   a new TTL on half of them
+//   cancel   removes 10% of the TTLs (PERSIST, DEL)
+//   expire   pops every timer while the clock moves in 10 ms steps
+// The wheel timers are allocated out of line as in the server, a key
+// without a TTL only has the pointer. Also reports the bytes per key.
+// usage: bench_ttl [nkeys [ttl_percent]]   (default: 20000000 90)
+#include "byoredis/ds/heap.hh"
+#include "byoredis/ds/timerwheel.hh"
+#include "byoredis/ds/intrusive.hh"  // for container_of
+#include "byoredis/common/slab.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#include <random>
+
+static double now_sec() {
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return (double)tv.tv_sec + (double)tv.tv_nsec * 1e-9;
+}
+
+uint64_t const k_start_ms = 1000 * 1000 * 1000;
+uint64_t const k_step_ms  = 10;
+
+struct Workload {
+  std::vector<uint32_t> order;    // the keys with a TTL, in random order
+  std::vector<uint64_t> expire;   // for the set phase
+  std::vector<uint32_t> updated;  // random keys
+  std::vector<uint64_t> expire2;
+  std::vector<uint32_t> cancel;
+};
+
+struct HeapKey {
+  size_t heap_idx = -1;
+};
+
+struct WheelKey;
+
+// see EntryTimer
+struct WheelTimer {
+  TWNode tw;
+  WheelKey *key;
+};
+
+struct WheelKey {
+  WheelTimer *ttl = NULL;
+};
+
+struct Result {
+  double set = 0, update = 0, cancel = 0, expire = 0;  // ns/op
+  double bytes = 0;  // per key, after the set phase
+};
+
+static double per_op(double t0, size_t n) {
+  return (now_sec() - t0) * 1e9 / (double)(n ? n : 1);
+}
+
+static Result run_heap(Workload const &w, size_t n) {
+  Result r;
+  std::vector<HeapKey> keys(n);
+  std::vector<HeapItem> heap;
+  double t0 = now_sec();
+  for (size_t i = 0; i < w.order.size(); i++) {
+    HeapKey &k = keys[w.order[i]];
+    heap_upsert(heap, k.heap_idx, HeapItem{w.expire[i], &k.heap_idx});
+  }
+  r.set = per_op(t0, w.order.size());
+  r.bytes = (double)(sizeof(HeapKey) * n + sizeof(HeapItem) * heap.size()) / (double)n;
+  t0 = now_sec();
+  for (size_t i = 0; i < w.updated.size(); i++) {
+    HeapKey &k = keys[w.updated[i]];
+    heap_upsert(heap, k.heap_idx, HeapItem{w.expire2[i], &k.heap_idx});
+  }
+  r.update = per_op(t0, w.updated.size());
+  t0 = now_sec();
+  for (uint32_t i : w.cancel) {
+    HeapKey &k = keys[i];
+    if (k.heap_idx != (size_t)-1) {
+      heap_delete(heap, k.heap_idx);
+      k.heap_idx = -1;
+    }
+  }
+  r.cancel = per_op(t0, w.cancel.size());
+  size_t total = heap.size(), popped = 0;
+  t0 = now_sec();
+  for (uint64_t now = k_start_ms; !heap.empty(); now += k_step_ms) {
+    while (!heap.empty() && heap[0].val <= now) {
+      HeapKey *k = container_of(heap[0].ref, HeapKey, heap_idx);
+      heap_delete(heap, 0);
+      k->heap_idx = -1;
+      popped++;
+    }
+  }
+  r.expire = per_op(t0, total);
+  if (popped != total) {
+    fprintf(stderr, "bad heap result\n");
+    exit(1);
+  }
+  return r;
+}
+
+// add or reschedule, as entry_set_ttl()
+static void wheel_set(TimerWheel *tw, WheelKey *k, uint64_t expire_at) {
+  if (!k->ttl) {
+    k->ttl = (WheelTimer *)slab_alloc(sizeof(WheelTimer));
+    k->ttl->tw.link.prev = k->ttl->tw.link.next = NULL;
+    k->ttl->key = k;
+  }
+  tw_add(tw, &k->ttl->tw, expire_at);
+}
+
+static void wheel_del(TimerWheel *tw, WheelKey *k) {
+  if (k->ttl) {
+    tw_del(tw, &k->ttl->tw);
+    slab_free(k->ttl, sizeof(WheelTimer));
+    k->ttl = NULL;
+  }
+}
+
+static Result run_wheel(Workload const &w, size_t n) {
+  Result r;
+  std::vector<WheelKey> keys(n);
+  TimerWheel *tw = new TimerWheel();
+  tw_init(tw, k_start_ms);
+  double t0 = now_sec();
+  for (size_t i = 0; i < w.order.size(); i++) {
+    wheel_set(tw, &keys[w.order[i]], w.expire[i]);
+  }
+  r.set = per_op(t0, w.order.size());
+  r.bytes = (double)(sizeof(WheelKey) * n + slab_size(sizeof(WheelTimer)) * tw_size(tw)) / (double)n;
+  t0 = now_sec();
+  for (size_t i = 0; i < w.updated.size(); i++) {
+    wheel_set(tw, &keys[w.updated[i]], w.expire2[i]);
+  }
+  r.update = per_op(t0, w.updated.size());
+  t0 = now_sec();
+  for (uint32_t i : w.cancel) {
+    wheel_del(tw, &keys[i]);
+  }
+  r.cancel = per_op(t0, w.cancel.size());
+  size_t total = tw_size(tw), popped = 0;
+  t0 = now_sec();
+  for (uint64_t now = k_start_ms; tw_size(tw); now += k_step_ms) {
+    while (TWNode *node = tw_pop(tw, now)) {
+      wheel_del(tw, container_of(node, WheelTimer, tw)->key);
+      popped++;
+    }
+  }
+  r.expire = per_op(t0, total);
+  if (popped != total) {
+    fprintf(stderr, "bad wheel result\n");
+    exit(1);
+  }
+  delete tw;
+  return r;
+}
+
+static void run(size_t n, size_t pct) {
+  std::mt19937_64 rng(n);
+  std::uniform_int_distribution<uint64_t> ttl(1000, 3600 * 1000);
+  Workload w;
+  for (uint32_t i = 0; i < n; i++) {
+    if (rng() % 100 < pct) {
+      w.order.push_back(i);
+    }
+  }
+  std::shuffle(w.order.begin(), w.order.end(), rng);
+  for (size_t i = 0; i < w.order.size(); i++) {
+    w.expire.push_back(k_start_ms + ttl(rng));
+  }
+  for (size_t i = 0; i < w.order.size() / 2; i++) {
+    w.updated.push_back(w.order[rng() % w.order.size()]);
+    w.expire2.push_back(k_start_ms + ttl(rng));
+  }
+  for (size_t i = 0; i < w.order.size() / 10; i++) {
+    w.cancel.push_back(w.order[rng() % w.order.size()]);
+  }
+
+  printf("%10zu keys, %zu%% with TTL   set      update   cancel   expire  (ns/op)   bytes/key\n", n, pct);
+  Result h = run_heap(w, n);
+  printf("  heap                        %6.1f   %6.1f   %6.1f   %6.1f            %6.1f\n",
+         h.set, h.update, h.cancel, h.expire, h.bytes);
+  Result t = run_wheel(w, n);
+  printf("  wheel                       %6.1f   %6.1f   %6.1f   %6.1f            %6.1f\n",
+         t.set, t.update, t.cancel, t.expire, t.bytes);
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 20 * 1000 * 1000;
+  size_t pct = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 90;
+  run(n, std::min(pct, (size_t)100));
+  return 0;
+}
@@ -0,0 +1,160 @@
+// AVL tree vs B+tree as the ordered zset index: insert, rank of a member,
+// seek by rank (offset), and a range scan of 100 items from a random rank.
+// usage: bench_zset_index [nitems...]   (default: 10000 100000 1000000)
+#include "byoredis/ds/avl.hh"
+#include "byoredis/ds/btree.hh"
+#include "byoredis/ds/intrusive.hh"  // for container_of
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#include <random>
+
+// ordered by (score, id), like the (score, name) of a zset
+struct Data {
+  AVLNode tree;
+  double score = 0;
+  uint64_t id = 0;
+};
+
+static bool data_less(Data const *lhs, Data const *rhs) {
+  if (lhs->score != rhs->score) {
+    return lhs->score < rhs->score;
+  }
+  return lhs->id < rhs->id;
+}
+
+static bool bt_less(void const *item, void const *key) {
+  return ((Data const *)item)->id < ((Data const *)key)->id;
+}
+
+static double now_sec() {
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return (double)tv.tv_sec + (double)tv.tv_nsec * 1e-9;
+}
+
+static void avl_insert(AVLNode **root, Data *data) {
+  AVLNode *parent = NULL;
+  AVLNode **from = root;
+  while (*from) {
+    parent = *from;
+    from = data_less(data, container_of(parent, Data, tree)) ? &parent->left : &parent->right;
+  }
+  *from = &data->tree;
+  data->tree.parent = parent;
+  *root = avl_fix(&data->tree);
+}
+
+static void check(bool ok) {
+  if (!ok) {
+    fprintf(stderr, "bad result\n");
+    exit(1);
+  }
+}
+
+size_t const k_scan_len = 100;
+
+static void run(size_t n) {
+  std::mt19937_64 rng(n);
+  // few distinct scores so that ties are common
+  std::vector<Data> nodes(n);
+  for (size_t i = 0; i < n; i++) {
+    avl_init(&nodes[i].tree);
+    nodes[i].score = (double)(rng() % (n / 4 + 1));
+    nodes[i].id = i;
+  }
+  std::vector<Data *> order(n);
+  for (size_t i = 0; i < n; i++) {
+    order[i] = &nodes[i];
+  }
+  std::shuffle(order.begin(), order.end(), rng);
+  size_t nprobe = std::min(n, (size_t)1000 * 1000);
+  std::vector<int64_t> ranks(nprobe);
+  for (int64_t &r : ranks) {
+    r = (int64_t)(rng() % n);
+  }
+
+  // insert
+  AVLNode *root = NULL;
+  BTree bt;
+  double t0 = now_sec();
+  for (Data *d : order) {
+    avl_insert(&root, d);
+  }
+  double avl_ins = (now_sec() - t0) * 1e9 / (double)n;
+  t0 = now_sec();
+  for (Data *d : order) {
+    bt_insert(&bt, d->score, d, d, &bt_less);
+  }
+  double bt_ins = (now_sec() - t0) * 1e9 / (double)n;
+
+  // rank of a member
+  int64_t sum = 0;
+  t0 = now_sec();
+  for (size_t i = 0; i < nprobe; i++) {
+    sum += avl_rank(&order[i]->tree);
+  }
+  double avl_rnk = (now_sec() - t0) * 1e9 / (double)nprobe;
+  t0 = now_sec();
+  for (size_t i = 0; i < nprobe; i++) {
+    int64_t rank = 0;
+    bt_seekge(&bt, order[i]->score, order[i], &bt_less, &rank);
+    sum -= rank;
+  }
+  double bt_rnk = (now_sec() - t0) * 1e9 / (double)nprobe;
+  check(sum == 0);
+
+  // offset
+  t0 = now_sec();
+  for (int64_t r : ranks) {
+    sum += (int64_t)container_of(avl_offset(root, r - avl_rank(root)), Data, tree)->id;
+  }
+  double avl_off = (now_sec() - t0) * 1e9 / (double)nprobe;
+  t0 = now_sec();
+  for (int64_t r : ranks) {
+    sum -= (int64_t)((Data *)bt_item(bt_at(&bt, r)))->id;
+  }
+  double bt_off = (now_sec() - t0) * 1e9 / (double)nprobe;
+  check(sum == 0);
+
+  // range scan
+  size_t nscan = nprobe / 10;
+  t0 = now_sec();
+  for (size_t i = 0; i < nscan; i++) {
+    AVLNode *node = avl_offset(root, ranks[i] - avl_rank(root));
+    for (size_t k = 0; node && k < k_scan_len; k++) {
+      sum += (int64_t)container_of(node, Data, tree)->id;
+      node = avl_successor(node);
+    }
+  }
+  double avl_scan = (now_sec() - t0) * 1e9 / (double)nscan;
+  t0 = now_sec();
+  for (size_t i = 0; i < nscan; i++) {
+    BPos pos = bt_at(&bt, ranks[i]);
+    for (size_t k = 0; bt_valid(pos) && k < k_scan_len; k++) {
+      sum -= (int64_t)((Data *)bt_item(pos))->id;
+      bt_next(pos);
+    }
+  }
+  double bt_scan = (now_sec() - t0) * 1e9 / (double)nscan;
+  check(sum == 0);
+
+  printf("%10zu items  insert   rank     offset   scan%zu  (ns/op)\n", n, k_scan_len);
+  printf("  AVL            %6.1f   %6.1f   %6.1f   %7.1f\n", avl_ins, avl_rnk, avl_off, avl_scan);
+  printf("  B+tree         %6.1f   %6.1f   %6.1f   %7.1f\n", bt_ins, bt_rnk, bt_off, bt_scan);
+  bt_clear(&bt, NULL);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    run(10 * 1000);
+    run(100 * 1000);
+    run(1000 * 1000);
+  }
+  for (int i = 1; i < argc; i++) {
+    run((size_t)strtoull(argv[i], NULL, 10));
+  }
+  return 0;
+}
@@ -0,0 +1,69 @@
+// Loading an empty zset: one zset_insert() per member vs zset_insert_bulk()
+// with unsorted and sorted input.
+// usage: bench_zset_load [nmembers...]   (default: 1000000)
+#include "byoredis/ds/zset.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+
+static double now_sec() {
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return (double)tv.tv_sec + (double)tv.tv_nsec * 1e-9;
+}
+
+static double load(std::vector<ZMember> const &members, bool bulk) {
+  ZSet zset;
+  double t0 = now_sec();
+  if (bulk) {
+    zset_insert_bulk(&zset, members.data(), members.size());
+  } else {
+    for (ZMember const &m : members) {
+      zset_insert(&zset, m.name, m.len, m.score);
+    }
+  }
+  double dt = now_sec() - t0;
+  if (zset_len(&zset) != members.size()) {
+    fprintf(stderr, "bad zset size\n");
+    exit(1);
+  }
+  zset_clear(&zset);
+  return dt;
+}
+
+static void run(size_t n) {
+  std::mt19937_64 rng(n);
+  std::vector<std::string> names(n);
+  std::vector<ZMember> members(n);
+  for (size_t i = 0; i < n; i++) {
+    names[i] = "member:" + std::to_string(i);
+    members[i].name = names[i].data();
+    members[i].len = names[i].size();
+    members[i].score = (double)(rng() % 1000000);
+  }
+  double one = load(members, false);
+  double unsorted = load(members, true);
+  std::sort(members.begin(), members.end(), [](ZMember const &a, ZMember const &b) {
+    if (a.score != b.score) {
+      return a.score < b.score;
+    }
+    return std::string(a.name, a.len) < std::string(b.name, b.len);
+  });
+  double sorted = load(members, true);
+  printf("%10zu members   insert %7.3fs   bulk %7.3fs   bulk sorted %7.3fs\n",
+         n, one, unsorted, sorted);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    run(1000 * 1000);
+  }
+  for (int i = 1; i < argc; i++) {
+    run((size_t)strtoull(argv[i], NULL, 10));
+  }
+  return 0;
+}
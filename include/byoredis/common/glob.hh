@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string_view>
+
+// Glob-style pattern matching, as in the MATCH option of SCAN:
+//  *       any sequence, including an empty one
+//  ?       any single byte
+//  [abc]   one of the bytes, [^abc] none of them, [a-z] a range
+//  \x      the byte x literally
+bool glob_match(std::string_view pattern, std::string_view str);
+// the length of the literal prefix of the pattern, before the first
+// wildcard or escape
+size_t glob_prefix_len(std::string_view pattern);
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The hash function of every hashtable, a seeded 64-bit hash in the style of
+// wyhash: 16 bytes per 64x64->128-bit multiply, 3 independent lanes for
+// inputs over 48 bytes.
+// The seed is randomized per process so the bucket of a key can't be
+// predicted by clients (hash flooding). It must be set before any key is
+// hashed and stay the same for the lifetime of the process.
+extern uint64_t g_hash_seed;
+
+// pick a random seed, call once at startup before the threads start
+void hash_seed_init();
+
+uint64_t hash_bytes(void const *data, size_t len, uint64_t seed);
+
+inline uint64_t str_hash(uint8_t const *data, size_t len) {
+  return hash_bytes(data, len, g_hash_seed);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Size-class slab allocator for the small hot objects (Entry, ZNode, Conn).
+// The classes are 8-byte apart up to 128 bytes, then 4 per doubling up to
+// k_slab_max_size; larger sizes go to malloc. Objects have no header, the
+// caller passes the size back on free.
+//
+// Memory comes from 2 MB chunks (huge pages where available) cut into
+// 64 KB spans, a span holds objects of one class; the first span of a
+// chunk holds the metadata of the others. Each thread has a cache of free
+// objects per class, moved from and to the spans in batches, so an object
+// can be freed by any thread. A class allocates from its fullest spans
+// first, and an empty span is returned to the OS, then reused by any class.
+size_t const k_slab_max_size = 2048;
+size_t const k_slab_classes  = 32;
+
+void * slab_alloc(size_t size);
+void   slab_free(void *ptr, size_t size);
+// the contents are copied if the size class changes
+void * slab_realloc(void *ptr, size_t old_size, size_t new_size);
+// the bytes reserved for an object of `size`
+size_t slab_size(size_t size);
+
+// Active defragmentation. If the span of the object is less used than the
+// average span of its class, returns a copy in a fuller span, else NULL.
+// The caller repoints the references to the copy, then frees the old
+// object with slab_defrag_free(), which returns it to its span directly
+// instead of the thread cache, so that the span can empty. It returns the
+// bytes given back to the OS by this call, the span if it emptied.
+void * slab_defrag_move(void *ptr, size_t size);
+size_t slab_defrag_free(void *ptr, size_t size);
+
+struct SlabClassStats {
+  size_t   size = 0;       // object size of the class
+  uint64_t live = 0;       // allocated objects
+  uint64_t requested = 0;  // bytes asked for by the live objects
+  uint64_t reserved = 0;   // bytes of the spans of the class
+};
+
+// the sum over all threads, a snapshot; wasted = reserved - requested
+void   slab_stats(SlabClassStats out[k_slab_classes]);
+// bytes mapped for the chunks
+size_t slab_mapped_bytes();
+// bytes of the empty spans returned to the OS so far, by all threads
+uint64_t slab_released_bytes();
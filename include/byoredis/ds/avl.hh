@@ -9,22 +9,42 @@ struct AVLNode {
   AVLNode *right  = NULL;
   uint32_t height = 0;  // Height of the node in the tree
   size_t   size   = 0;  // Size of the subtree rooted at this node
+  double   val    = 0;  // a value of the node, set by the user
+  double   sum    = 0;  // Sum of `val` in the subtree rooted at this node
 };
 
+// `val` is kept
 inline void avl_init(AVLNode *node) {
   node->left = node->right = node->parent = NULL;
   node->height = 1;
   node->size = 1;
+  node->sum = node->val;
 }
 
 // helpers
 
 inline uint32_t avl_height(AVLNode *node) { return node ? node->height : 0; }
 inline uint32_t avl_size(AVLNode *node) { return node ? node->size : 0; }
+inline double   avl_sum(AVLNode *node) { return node ? node->sum : 0; }
 
 // API
 
 AVLNode * avl_fix(AVLNode *node);
 AVLNode * avl_del(AVLNode *node);
 AVLNode * avl_offset(AVLNode *node, int64_t offset);
+AVLNode * avl_successor(AVLNode *node);    // NULL if none
+AVLNode * avl_predecessor(AVLNode *node);  // NULL if none
 int64_t   avl_rank(AVLNode *node);
+// split and join by rank, the arguments and results are roots
+AVLNode * avl_join(AVLNode *left, AVLNode *mid, AVLNode *right);
+AVLNode * avl_concat(AVLNode *left, AVLNode *right);
+void      avl_split(AVLNode *root, int64_t rank, AVLNode **left, AVLNode **right);
+// change `val` of a node in a tree and update the sums up to the root
+void      avl_set_val(AVLNode *node, double val);
+// sum of `val` over the rank range [start, stop) of a tree, O(log N)
+double    avl_range_sum(AVLNode *root, int64_t start, int64_t stop);
+// build a balanced tree from nodes in order, O(N)
+AVLNode * avl_build(AVLNode **nodes, size_t n);
+// fix the neighbors after `old` is copied to `node` (defragmentation),
+// `*root` is updated if it was the root
+void      avl_moved(AVLNode *node, AVLNode const *old, AVLNode **root);
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// An order-statistic B+tree of (score, item) pairs, an alternative to the
+// AVL tree as the ordered index of a zset.
+// Wide nodes keep the scores in contiguous arrays, a search only touches
+// one node per level and only dereferences an item to break a tie between
+// equal scores. Inner nodes count the items under each child for rank and
+// offset queries, and the leaves are linked for sequential range scans.
+// Items are ordered by score, then by the `less` callback, and must be
+// unique under this order.
+
+uint32_t const k_bt_order = 32;  // max items per leaf, max children per inner node
+
+// is `item` < `key` for items of the same score; `key` is caller defined
+typedef bool (*BtLess)(void const *item, void const *key);
+
+struct BNode {
+  uint32_t n = 0;       // number of items or children
+  bool     leaf = true;
+  // for each item or child: the score and the item (the smallest one of the child)
+  double   scores[k_bt_order];
+  void    *items[k_bt_order];
+};
+
+struct BLeaf : BNode {
+  BLeaf *prev = NULL;
+  BLeaf *next = NULL;
+};
+
+struct BInner : BNode {
+  BNode *kids[k_bt_order];
+  size_t counts[k_bt_order];  // number of items under each child
+};
+
+struct BTree {
+  BNode *root = NULL;
+  size_t size = 0;
+};
+
+// a position in the leaves, `leaf` is NULL past the end
+struct BPos {
+  BLeaf   *leaf = NULL;
+  uint32_t idx = 0;
+};
+
+void    bt_insert(BTree *tree, double score, void *item, void const *key, BtLess less);
+// remove `item`, which is stored under (score, key)
+void    bt_delete(BTree *tree, double score, void *item, void const *key, BtLess less);
+// replace `item`, which is stored under (score, key), by `by` of the same
+// order, e.g. a copy of it at a new address. `item` is still compared.
+void    bt_replace(BTree *tree, double score, void *item, void const *key, BtLess less, void *by);
+// the first item >= (score, key), also returns its rank (tree->size if none)
+BPos    bt_seekge(BTree *tree, double score, void const *key, BtLess less, int64_t *rank);
+// the item at a rank, or the end
+BPos    bt_at(BTree *tree, int64_t rank);
+// remove the items at the ranks [start, stop), which must be in the tree.
+// The subtrees inside the range are freed whole, then the nodes along the
+// two edges of the cut are rebalanced: O(k / k_bt_order + log N) nodes,
+// the items are not visited.
+void    bt_remove_range(BTree *tree, int64_t start, int64_t stop);
+// invoke the callback on each item and free the tree
+void    bt_clear(BTree *tree, void (*free_item)(void *item));
+
+inline bool bt_valid(BPos const &pos) { return pos.leaf != NULL; }
+inline void * bt_item(BPos const &pos) { return pos.leaf->items[pos.idx]; }
+inline double bt_score(BPos const &pos) { return pos.leaf->scores[pos.idx]; }
+
+inline void bt_next(BPos &pos) {
+  if (++pos.idx >= pos.leaf->n) {
+    pos.leaf = pos.leaf->next;
+    pos.idx = 0;
+  }
+}
+
+inline void bt_prev(BPos &pos) {
+  if (pos.idx == 0) {
+    pos.leaf = pos.leaf->prev;
+    pos.idx = pos.leaf ? pos.leaf->n - 1 : 0;
+  } else {
+    pos.idx--;
+  }
+}
@@ -33,6 +33,35 @@ HNode * hm_lookup(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *));
 void    hm_insert(HMap *hmap, HNode *node);
 HNode * hm_delete(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *));
 void    hm_clear(HMap *hmap);
+// size an empty map for n keys so that loading them does not rehash
+void    hm_reserve(HMap *hmap, size_t n);
 size_t  hm_size(HMap *hmap);
 // invoke the callback on each node until it returns false
 void    hm_foreach(HMap *hmap, bool (*cb)(HNode *, void *), void *arg);
+// Batched lookups: call hm_prefetch() for every key of a batch, then
+// hm_prefetch_chain() for every key, then look them up. The cache misses
+// of the batch overlap instead of adding up. These are only hints.
+void    hm_prefetch(HMap *hmap, uint64_t hcode);        // the bucket
+void    hm_prefetch_chain(HMap *hmap, uint64_t hcode);  // the first node in it
+// Invoke the callback on the nodes of the bucket at `cursor` and return the
+// next cursor, 0 when done. Start from 0. A key present for the whole scan
+// is reported at least once, even if the table is resized in between.
+uint64_t hm_scan(HMap *hmap, uint64_t cursor, void (*cb)(HNode *, void *), void *arg);
+// hm_scan() for relocating the nodes: `move` returns the node or a copy of
+// it at a new address, which takes its place in the chain. It must not
+// modify the map otherwise.
+uint64_t hm_defrag(HMap *hmap, uint64_t cursor, HNode *(*move)(HNode *, void *), void *arg);
+
+// The scan cursor counts with reversed bits, i.e. increments the high bits
+// first. When a table of 2^n buckets doubles, bucket i splits into i and
+// i + 2^n, which the reversed counting visits after i, so the buckets
+// already visited stay visited.
+inline uint64_t scan_next(uint64_t v, uint64_t mask) {
+  auto rev = [](uint64_t x) {
+    x = ((x >> 1) & 0x5555555555555555ull) | ((x & 0x5555555555555555ull) << 1);
+    x = ((x >> 2) & 0x3333333333333333ull) | ((x & 0x3333333333333333ull) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((x & 0x0F0F0F0F0F0F0F0Full) << 4);
+    return __builtin_bswap64(x);
+  };
+  return rev(rev(v | ~mask) + 1);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A radix tree (compressed trie) from byte strings to values, for queries
+// by key prefix. Each edge is labelled with a run of bytes, a node has
+// either a value or at least 2 children (except the root), so the depth is
+// bounded by the number of branching points rather than the key length.
+// The children are sorted by their first byte, a walk is in key order.
+
+// a single allocation:
+// +---------------+----------------+-------+
+// | kids[nkids]   | bytes[nkids]   | label |
+// +---------------+----------------+-------+
+// the first byte of each kid's label is repeated in `bytes` for the search.
+struct RNode {
+  void    *val = NULL;  // the value of the key ending here, NULL if none
+  uint32_t len = 0;     // length of the label
+  uint32_t nkids = 0;
+  uint8_t  data[];
+};
+
+struct RTree {
+  RNode *root = NULL;
+  size_t size = 0;   // number of keys
+  size_t nodes = 0;  // number of nodes
+  size_t bytes = 0;  // memory used by the nodes
+};
+
+// returns the replaced value, NULL if the key is new. `val` must not be NULL.
+void * rt_insert(RTree *tree, uint8_t const *key, size_t len, void *val);
+// returns the removed value, NULL if not found
+void * rt_delete(RTree *tree, uint8_t const *key, size_t len);
+void * rt_lookup(RTree *tree, uint8_t const *key, size_t len);
+// invoke the callback on the values of the keys starting with the prefix,
+// in key order, until it returns false. The tree must not be modified.
+void   rt_prefix(RTree *tree, uint8_t const *prefix, size_t len,
+                 bool (*cb)(void *val, void *arg), void *arg);
+// the same, from the first key greater than `after`, to resume a walk
+// stopped by the callback; O(key length) to find where to start
+void   rt_prefix_after(RTree *tree, uint8_t const *prefix, size_t len,
+                       uint8_t const *after, size_t after_len,
+                       bool (*cb)(void *val, void *arg), void *arg);
+void   rt_clear(RTree *tree);
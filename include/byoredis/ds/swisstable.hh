@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "byoredis/ds/hashtable.hh"  // HNode
+
+// An open-addressing alternative to HMap in the style of Swiss tables.
+// Slots come in groups of 16, each with a control byte: empty, deleted, or
+// a 7-bit tag from the hash of the key in it. A probe compares the control
+// bytes of a whole group at once (SSE2) and only dereferences the nodes
+// whose tag matches, instead of walking a chain of nodes.
+// Like HMap, resizing is progressive: the old table is drained into the new
+// one by a bounded number of moves per operation.
+// The HNode is reused for its hash value, `next` is not used.
+
+struct STab {
+  int8_t  *ctrl  = NULL;    // control byte of each slot
+  HNode  **slots = NULL;
+  size_t   mask  = 0;       // number of slots - 1, slots are a multiple of 16
+  size_t   size  = 0;       // number of keys
+  size_t   growth_left = 0; // empty slots that can be filled before resizing
+};
+
+struct SMap {
+  STab newer;
+  STab older;
+  size_t migrate_pos = 0;
+};
+
+HNode * sm_lookup(SMap *smap, HNode *key, bool (*eq)(HNode *, HNode *));
+void    sm_insert(SMap *smap, HNode *node);
+HNode * sm_delete(SMap *smap, HNode *key, bool (*eq)(HNode *, HNode *));
+void    sm_clear(SMap *smap);
+size_t  sm_size(SMap *smap);
+// invoke the callback on each node until it returns false
+void    sm_foreach(SMap *smap, bool (*cb)(HNode *, void *), void *arg);
+// hm_prefetch(): the control bytes and the slots of the first group probed
+void    sm_prefetch(SMap *smap, uint64_t hcode);
+// hm_prefetch_chain(): the nodes in the first group with a matching tag
+void    sm_prefetch_chain(SMap *smap, uint64_t hcode);
+// hm_scan() over the groups: a cursor visits the keys whose probe starts
+// at its group, they are found before the first group with an empty slot
+uint64_t sm_scan(SMap *smap, uint64_t cursor, void (*cb)(HNode *, void *), void *arg);
+// hm_defrag(): the copy returned by `move` takes the slot of the node
+uint64_t sm_defrag(SMap *smap, uint64_t cursor, HNode *(*move)(HNode *, void *), void *arg);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "byoredis/ds/list.hh"
+
+// Hierarchical timing wheel with 1 ms ticks. Level `l` has 64 slots of
+// 64^l ticks each; a timer sits on the level of the highest base-64 digit
+// where its expiration time differs from the current tick, so it is only
+// moved down (cascaded) when the wheel reaches its slot at that level.
+// Timers beyond the last level wait in an overflow list.
+// Schedule and cancel are O(1), the slot is derived from `expire_at`.
+uint32_t const k_tw_bits   = 6;
+uint32_t const k_tw_slots  = 1 << k_tw_bits;
+uint32_t const k_tw_levels = 6;  // 2^36 ms, about 2 years
+
+struct TWNode {
+  DList link;              // unlinked (NULL) if not scheduled
+  uint64_t expire_at = 0;  // in ms
+};
+
+struct TimerWheel {
+  uint64_t cur = 0;  // the current tick, the earlier timers have fired
+  size_t size = 0;
+  DList slots[k_tw_levels][k_tw_slots];
+  uint64_t bits[k_tw_levels] = {};  // nonempty slots
+  DList overflow;
+};
+
+void     tw_init(TimerWheel *tw, uint64_t now_ms);
+// add or reschedule
+void     tw_add(TimerWheel *tw, TWNode *node, uint64_t expire_at);
+void     tw_del(TimerWheel *tw, TWNode *node);
+// remove and return a timer with `expire_at <= now_ms`, NULL if none;
+// called repeatedly until NULL, it can stop and resume at any point
+TWNode * tw_pop(TimerWheel *tw, uint64_t now_ms);
+// the next tick to call `tw_pop()`, which may only cascade timers;
+// -1 if empty
+uint64_t tw_next(TimerWheel *tw);
+// fix the neighbors after the node is moved in memory (realloc)
+void     tw_moved(TWNode *node);
+
+inline bool tw_active(TWNode const *node) {
+  return node->link.next != NULL;
+}
+
+inline size_t tw_size(TimerWheel const *tw) {
+  return tw->size;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+struct Work {
+  void (*task)(void *) = NULL;
+  void *arg = NULL;
+};
+
+struct WSArray;
+
+// Chase-Lev work-stealing deque of `Work`. The owner thread pushes and
+// takes at the bottom (LIFO), any other thread steals from the top (FIFO).
+// Lock-free; the owner grows the array when full, the old arrays may still
+// be read by the thieves and are freed with the deque.
+struct WSDeque {
+  alignas(64) std::atomic<int64_t> top{0};
+  alignas(64) std::atomic<int64_t> bottom{0};
+  std::atomic<WSArray *> array{NULL};
+  std::vector<WSArray *> retired;  // owner only
+};
+
+void   wsd_init(WSDeque *dq, size_t cap);  // rounded up to a power of 2
+void   wsd_free(WSDeque *dq);
+// owner only
+void   wsd_push(WSDeque *dq, Work w);
+bool   wsd_take(WSDeque *dq, Work *out);
+// any thread, false if empty
+bool   wsd_steal(WSDeque *dq, Work *out);
+// a snapshot, may be stale by the time it returns
+size_t wsd_size(WSDeque const *dq);
@@ -1,16 +1,54 @@
 #pragma once
 
 #include "byoredis/ds/avl.hh"
+#include "byoredis/ds/btree.hh"
 #include "byoredis/ds/hashtable.hh"
 
+// A sorted set has one of 2 encodings:
+//  - listpack: small sets are a single buffer of (score, name) tuples
+//    sorted by (score, name), searched linearly.
+//  - tree: an ordered index by (score, name) plus a hashtable by name.
+//    The index is either an AVL tree or a B+tree, see `g_zset_index`.
+// A set starts as a listpack and is promoted to the tree once it has more
+// than `g_zset_max_listpack_entries` members or a name longer than
+// `g_zset_max_listpack_value`. Sets are never demoted, but an emptied set
+// starts over as a listpack.
+
+// encoding thresholds, set before any zset is created
+extern size_t g_zset_max_listpack_entries;
+extern size_t g_zset_max_listpack_value;  // at most 255
+size_t const k_zset_max_listpack_value = 255;
+
+enum ZSET_INDEX {
+  ZSET_INDEX_AVL = 0,
+  ZSET_INDEX_BTREE = 1,
+};
+// the ordered index of new tree encoded sets
+extern int g_zset_index;
+
+// the listpack encoding, followed by the entries:
+// +-------+-----+------+-----+
+// | score | len | name | len | ...
+// +-------+-----+------+-----+
+//    8B     1B    len    1B
+// the trailing len is for walking backwards.
+struct ZListpack {
+  uint32_t bytes = 0;  // size of the entries
+  uint32_t count = 0;  // number of entries
+  uint8_t  data[];
+};
+
 struct ZSet {
-  AVLNode *root = NULL;  // index by (score, name)
+  ZListpack *lp = NULL;  // listpack encoding if not NULL
+  // tree encoding
+  AVLNode *root = NULL;  // index by (score, name), ZSET_INDEX_AVL
+  BTree bt;              // index by (score, name), ZSET_INDEX_BTREE
   HMap hmap;             // index by name
 };
 
 struct ZNode {
   // data structure nodes
-  AVLNode tree;
+  AVLNode tree;          // unused with the B+tree index, `tree.val` is the score
   HNode   hmap;
   // data
   double  score = 0;
@@ -18,9 +56,64 @@ struct ZNode {
   char    name[0];       // flexible array
 };
 
+// a position in a zset, invalidated by any modification.
+// Stepping is amortized O(1), a walk of k members from a rank costs
+// O(log N + k).
+struct ZIter {
+  ZSet    *zset = NULL;
+  int64_t  rank = 0;
+  ZNode   *node = NULL;           // tree encoding
+  BPos     bpos;                  // tree encoding, B+tree index
+  uint8_t const *pos = NULL;      // listpack encoding
+  // the current member, if zit_valid()
+  double   score = 0;
+  char const *name = NULL;
+  size_t   len = 0;
+};
+
+struct ZMember {
+  char const *name = NULL;
+  size_t len = 0;
+  double score = 0;
+};
+
+size_t  zset_len(ZSet const *zset);
+// add a new (score, name) tuple, or update the score of the existing tuple
 bool    zset_insert(ZSet *zset, char const *name, size_t len, double score);
-ZNode * zset_lookup(ZSet *zset, char const *name, size_t len);
-void    zset_delete(ZSet *zset, ZNode *node);
-ZNode * zset_seekge(ZSet *zset, double score, char const *name, size_t len);
-ZNode * znode_offset(ZNode *node, int64_t offset);
+// add `incr` to the score of a member, or add the member with the score
+// `incr`. Returns the new score, or false without any change if it is NaN.
+bool    zset_incrby(ZSet *zset, char const *name, size_t len, double incr, double &score);
+// zset_insert() for many members, returns the number of new members.
+// An empty set is built in O(N) if the members are sorted by (score, name),
+// O(N log N) otherwise. For a duplicated name the last score wins.
+size_t  zset_insert_bulk(ZSet *zset, ZMember const *members, size_t n);
+// returns false if not found
+bool    zset_remove(ZSet *zset, char const *name, size_t len);
+bool    zset_score(ZSet *zset, char const *name, size_t len, double &score);
+// the rank of a member, -1 if not found
+int64_t zset_rank(ZSet *zset, char const *name, size_t len);
+// the rank of the first (score, name) tuple that is >= the key,
+// zset_len() if there is none
+int64_t zset_seekge(ZSet *zset, double score, char const *name, size_t len);
 void    zset_clear(ZSet *zset);
+// the sum of scores in the rank range [start, stop).
+// O(log N) for the AVL index, a walk of the range otherwise.
+double  zset_range_sum(ZSet *zset, int64_t start, int64_t stop);
+// remove the members in the rank range [start, stop) and return the count.
+// The detached nodes are not freed, they are returned in `garbage`
+// (NULL if none) for zset_dispose(), which can run in another thread.
+size_t  zset_remove_range(ZSet *zset, int64_t start, int64_t stop, ZNode **garbage);
+void    zset_dispose(ZNode *garbage);
+
+// Active defragmentation: move the tree nodes in the hashtable buckets at
+// `cursor` out of the sparse slab spans, see slab_defrag_move(). Returns
+// the next cursor, 0 when done, like hm_scan(). Adds the nodes moved to
+// `moved` and the bytes returned to the OS to `released`, see
+// slab_defrag_free(). Invalidates the iterators.
+uint64_t zset_defrag(ZSet *zset, uint64_t cursor, size_t *moved, uint64_t *released);
+
+// iterate in (score, name) order from a rank, forward or backward
+ZIter   zset_at(ZSet *zset, int64_t rank);
+inline bool zit_valid(ZIter const &it) { return it.name != NULL; }
+void    zit_next(ZIter &it);
+void    zit_prev(ZIter &it);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
+
+// An immutable, reference-counted byte string.
+// Values are stored as blobs so a response can reference a large value
+// instead of copying it into the output buffer; the value stays alive
+// until the last reference is written out, even if the key is overwritten
+// or deleted in the meantime. References may be dropped by any thread.
+struct Blob {
+  uint32_t refs;
+  uint32_t len;
+  char     data[];
+};
+
+Blob * blob_new(char const *data, size_t len);
+void   blob_unref(Blob *blob);
+
+inline Blob * blob_new(std::string_view s) {
+  return blob_new(s.data(), s.size());
+}
+
+inline Blob * blob_ref(Blob *blob) {
+  __atomic_fetch_add(&blob->refs, 1, __ATOMIC_RELAXED);
+  return blob;
+}
+
+inline std::string_view blob_view(Blob const *blob) {
+  return std::string_view(blob->data, blob->len);
+}
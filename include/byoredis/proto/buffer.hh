@@ -1,9 +1,22 @@
 #pragma once
 
+#include <stddef.h>
 #include <vector>
 #include <stdint.h>
 #include <assert.h>
 
+#include "byoredis/proto/blob.hh"
+
+struct iovec;
+
+// A blob spliced into the output stream instead of copied,
+// its bytes go right before buf[pos].
+struct BufRef {
+  size_t pos = 0;
+  Blob  *blob = NULL;
+  size_t done = 0;  // bytes already consumed
+};
+
 struct Buffer {
   std::vector<uint8_t> buf;
   size_t readable_begin = 0;
@@ -13,26 +26,64 @@ struct Buffer {
   // Used for response message size or TLV array size and potentially other deferred fields (LIFO order).
   std::vector<size_t> placeholder_stack;
 
+  // Referenced blobs in stream order, refs[ref_head..] are not fully consumed.
+  // The readable stream is buf[readable_begin..writable_begin) with these spliced in.
+  std::vector<BufRef> refs;
+  size_t ref_head = 0;
+  size_t ref_bytes = 0;  // unconsumed bytes in the refs
+
   explicit Buffer(size_t init_cap = 4096) { buf.resize(init_cap); }
+  ~Buffer();
+  Buffer(Buffer const &) = delete;
+  Buffer &operator=(Buffer const &) = delete;
+  // moves swap, the moved-from buffer releases the old content of the target
+  Buffer(Buffer &&other) noexcept : Buffer(0) { swap(other); }
+  Buffer &operator=(Buffer &&other) noexcept { swap(other); return *this; }
+  void swap(Buffer &other) noexcept;
 
   // actual size of the buffer, also upper bound of writable data
   size_t          capacity()      const { return buf.size(); }
+  // the contiguous bytes in `buf`, excluding the refs
   size_t          readable_size() const { return writable_begin - readable_begin; }
   size_t          writable_size() const { return capacity() - writable_begin; }
-  uint8_t const * readable_data() const { return &buf[readable_begin]; }
-  uint8_t       * writable_data()       { return &buf[writable_begin]; }
+  uint8_t const * readable_data() const { return buf.data() + readable_begin; }
+  uint8_t       * writable_data()       { return buf.data() + writable_begin; }
+  // the whole readable stream, including the refs
+  size_t          output_size()   const { return readable_size() + ref_bytes; }
+  bool            has_refs()      const { return ref_head < refs.size(); }
+
+  void ensure_writable(size_t ensure_size);
 
-  void ensure_writable(size_t ensure_size); 
+  void append(uint8_t const *data, size_t n);
 
-  void append(uint8_t const *data, size_t n); 
+  // splice a blob at the current write position, takes a new reference
+  void append_ref(Blob *blob);
 
-  void consume(size_t n); 
+  // append the readable stream of `src` after skipping `skip` bytes,
+  // the refs are shared rather than copied
+  void append_buffer(Buffer const &src, size_t skip = 0);
 
-  void shrink_if_wasteful(size_t hard_min = 4096); 
+  // append buf[begin..end) of `src` (offsets into src.buf) with the refs
+  // spliced into it, those at (begin, end]. `src` must not be consumed.
+  void append_range(Buffer const &src, size_t begin, size_t end);
+
+  // drop everything written at or after `pos` (an offset into buf)
+  void truncate(size_t pos);
+
+  // consume from the readable stream, including the refs
+  void consume(size_t n);
+
+  // gather the readable stream for writev(), returns the number of iovecs used
+  size_t fill_iov(struct iovec *iov, size_t max_iov) const;
+
+  // bytes of the refs spliced after `pos`
+  size_t ref_bytes_after(size_t pos) const;
+
+  void shrink_if_wasteful(size_t hard_min = 4096);
 
   // Placeholder helpers for deferred backfilling
-  inline void push_placeholder() { 
-    placeholder_stack.push_back(writable_begin); 
+  inline void push_placeholder() {
+    placeholder_stack.push_back(writable_begin);
   }
   inline size_t peek_placeholder() {
     assert(!placeholder_stack.empty());
@@ -44,4 +95,8 @@ struct Buffer {
     placeholder_stack.pop_back();
     return pos;
   }
+
+private:
+  // the readable data moved from `shift` to the front of buf
+  void shift_positions(size_t shift);
 };
@@ -2,9 +2,12 @@
 
 #include <stdint.h>
 #include <string>
+#include <string_view>
 
 size_t const k_max_msg  = 32 << 20;
 size_t const k_max_args = 200 * 1000;
+// values at least this large are referenced by the output, not copied
+size_t const k_min_ref_size = 16 << 10;
 
 // Tag-Length-Value (TLV) encoding
 //  nil     int64           str                 array
@@ -32,6 +35,7 @@ enum TAG_ERR_CODE {
 };
 
 struct Buffer;
+struct Blob;
 void buf_append_u8(Buffer &buf, uint8_t data);
 void buf_append_u32(Buffer &buf, uint32_t data);
 void buf_append_i64(Buffer &buf, int64_t data);
@@ -40,6 +44,7 @@ void buf_append_str(Buffer &buf, uint8_t const *data, size_t len);
 
 void out_nil(Buffer &buf);
 void out_str(Buffer &buf, char const *s, size_t size);
+void out_blob(Buffer &buf, Blob *blob);
 void out_int(Buffer &buf, int64_t val);
 void out_dbl(Buffer &buf, double val);
 void out_err(Buffer &buf, uint32_t code, std::string const &msg);
@@ -51,3 +56,5 @@ void out_end_arr(Buffer &buf, uint32_t n);
 bool read_u32(uint8_t const *&cur, uint8_t const *end, uint32_t &out);
 // read n bytes as string, and move cur forward by n
 bool read_str(uint8_t const *&cur, uint8_t const *end, size_t n, std::string &out);
+// same as above, but points into the input instead of copying it
+bool read_str(uint8_t const *&cur, uint8_t const *end, size_t n, std::string_view &out);
@@ -1,18 +1,164 @@
 #pragma once
 
-#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
 #include <vector>
 
 struct Buffer;
-void do_get(std::vector<std::string> &cmd, Buffer &buffer);
-void do_set(std::vector<std::string> &cmd, Buffer &buffer);
-void do_del(std::vector<std::string> &cmd, Buffer &buffer);
-void do_keys(std::vector<std::string> &cmd, Buffer &buffer);
-void do_zadd(std::vector<std::string> &cmd, Buffer &buffer);
-void do_zrem(std::vector<std::string> &cmd, Buffer &buffer);
-void do_zscore(std::vector<std::string> &cmd, Buffer &buffer);
-void do_zquery(std::vector<std::string> &cmd, Buffer &buffer);
-void do_zrank(std::vector<std::string> &cmd, Buffer &buffer);
-void do_zcount(std::vector<std::string> &cmd, Buffer &buffer);
-void do_expire(std::vector<std::string> &cmd, Buffer &buffer);
-void do_ttl(std::vector<std::string> &cmd, Buffer &buffer);
+void do_get(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_set(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_del(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_unlink(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_flushall(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_mget(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_mset(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_keys(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_scan(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_delprefix(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_info(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_memstats(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_zadd(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_zincrby(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_zrem(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_zscore(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_zquery(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_zscan(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_zrank(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_zrange(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_zrevrange(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_zcount(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_zsumrange(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_zquantile(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_zremrangebyrank(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_zremrangebyscore(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_expire(std::vector<std::string_view> &cmd, Buffer &buffer);
+void do_ttl(std::vector<std::string_view> &cmd, Buffer &buffer);
+
+enum CMD_FLAG {
+  CMD_READ     = 1 << 0,  // reads the keyspace
+  CMD_WRITE    = 1 << 1,  // may modify the keyspace
+  CMD_KEYSPACE = 1 << 2,  // works on the whole keyspace rather than on keys
+  CMD_CURSOR   = 1 << 3,  // runs on the shard in the cursor at argument 1
+  CMD_COUNT    = 1 << 4,  // replies a count, summed up over the shards
+};
+
+// The SCAN cursor is the cursor of the shard's table in the high bits and
+// the shard id in the low bits, a scan walks the shards one after another.
+// A walk of the prefix index resumes with "<shard>:<last key>" instead.
+uint32_t const k_scan_shard_bits = 16;
+
+struct Command {
+  std::string_view name;
+  // the number of arguments including the name, -N means at least N
+  int32_t  arity;
+  uint32_t flags;
+  // argument positions of the keys: [first_key, last_key] by key_step,
+  // last_key < 0 counts from the end, first_key = 0 if there is no key
+  int32_t  first_key;
+  int32_t  last_key;
+  int32_t  key_step;
+  void   (*handler)(std::vector<std::string_view> &cmd, Buffer &buffer);
+};
+
+inline constexpr Command k_commands[] = {
+  {"get",     2,  CMD_READ,     1, 1, 1, &do_get},
+  {"set",     3,  CMD_WRITE,    1, 1, 1, &do_set},
+  {"del",     -2, CMD_WRITE | CMD_COUNT, 1, -1, 1, &do_del},
+  {"unlink",  -2, CMD_WRITE | CMD_COUNT, 1, -1, 1, &do_unlink},
+  {"mget",    -2, CMD_READ,     1, -1, 1, &do_mget},
+  {"mset",    -3, CMD_WRITE,    1, -2, 2, &do_mset},
+  {"keys",    -1, CMD_READ | CMD_KEYSPACE, 0, 0, 0, &do_keys},
+  {"delprefix", 2, CMD_WRITE | CMD_KEYSPACE | CMD_COUNT, 0, 0, 0, &do_delprefix},
+  {"info",    1,  CMD_READ | CMD_KEYSPACE, 0, 0, 0, &do_info},
+  {"memstats", 1, 0,           0, 0, 0, &do_memstats},
+  {"flushall", -1, CMD_WRITE | CMD_KEYSPACE, 0, 0, 0, &do_flushall},
+  {"flushdb", -1, CMD_WRITE | CMD_KEYSPACE, 0, 0, 0, &do_flushall},
+  {"scan",    -2, CMD_READ | CMD_CURSOR,   0, 0, 0, &do_scan},
+  {"zadd",    -4, CMD_WRITE,    1, 1, 1, &do_zadd},
+  {"zincrby", 4,  CMD_WRITE,    1, 1, 1, &do_zincrby},
+  {"zrem",    3,  CMD_WRITE,    1, 1, 1, &do_zrem},
+  {"zscore",  3,  CMD_READ,     1, 1, 1, &do_zscore},
+  {"zquery",  6,  CMD_READ,     1, 1, 1, &do_zquery},
+  {"zscan",   -3, CMD_READ,     1, 1, 1, &do_zscan},
+  {"zrank",   3,  CMD_READ,     1, 1, 1, &do_zrank},
+  {"zrange",  -4, CMD_READ,     1, 1, 1, &do_zrange},
+  {"zrevrange", -4, CMD_READ,   1, 1, 1, &do_zrevrange},
+  {"zcount",  6,  CMD_READ,     1, 1, 1, &do_zcount},
+  {"zsumrange", -4, CMD_READ,   1, 1, 1, &do_zsumrange},
+  {"zquantile", 3,  CMD_READ,   1, 1, 1, &do_zquantile},
+  {"zremrangebyrank",  4, CMD_WRITE, 1, 1, 1, &do_zremrangebyrank},
+  {"zremrangebyscore", 4, CMD_WRITE, 1, 1, 1, &do_zremrangebyscore},
+  {"pexpire", 3,  CMD_WRITE,    1, 1, 1, &do_expire},
+  {"pttl",    2,  CMD_READ,     1, 1, 1, &do_ttl},
+};
+size_t const k_num_commands = sizeof(k_commands) / sizeof(k_commands[0]);
+
+// Perfect hash dispatch: a seed is searched at compile time so that every
+// command name lands in its own slot, a lookup is then one hash and one
+// string compare regardless of the number of commands.
+
+// seeded FNV-1a, the slot is taken from the high bits
+constexpr uint64_t cmd_hash(std::string_view name, uint64_t seed) {
+  uint64_t h = 0xCBF29CE484222325ull ^ (seed * 0x9E3779B97F4A7C15ull);
+  for (char c : name) {
+    h = (h ^ (uint8_t)c) * 0x100000001B3ull;
+  }
+  return h;
+}
+
+// at least 4 slots per command, so a seed is found after a few tries
+constexpr uint32_t cmd_slot_bits(size_t n) {
+  uint32_t bits = 2;
+  while (((size_t)1 << bits) < n * 4) {
+    bits++;
+  }
+  return bits;
+}
+uint32_t const k_cmd_slot_bits = cmd_slot_bits(k_num_commands);
+
+struct CmdTable {
+  uint64_t seed = 0;
+  uint8_t  slots[1u << k_cmd_slot_bits] = {};  // index + 1 into k_commands, 0 if empty
+};
+static_assert(k_num_commands < 255, "slots are uint8_t");
+
+constexpr uint32_t cmd_slot(std::string_view name, uint64_t seed) {
+  return (uint32_t)(cmd_hash(name, seed) >> (64 - k_cmd_slot_bits));
+}
+
+// fails to compile (constexpr evaluation limit) on duplicate names
+constexpr CmdTable cmd_table_build() {
+  for (uint64_t seed = 0;; seed++) {
+    CmdTable t;
+    t.seed = seed;
+    bool ok = true;
+    for (size_t i = 0; ok && i < k_num_commands; i++) {
+      uint32_t slot = cmd_slot(k_commands[i].name, seed);
+      ok = (t.slots[slot] == 0);
+      t.slots[slot] = (uint8_t)(i + 1);
+    }
+    if (ok) {
+      return t;
+    }
+  }
+}
+inline constexpr CmdTable k_cmd_table = cmd_table_build();
+
+// NULL if unknown
+inline Command const * cmd_lookup(std::string_view name) {
+  uint8_t idx = k_cmd_table.slots[cmd_slot(name, k_cmd_table.seed)];
+  if (idx == 0 || k_commands[idx - 1].name != name) {
+    return NULL;
+  }
+  return &k_commands[idx - 1];
+}
+
+inline bool cmd_arity_ok(Command const *c, size_t argc) {
+  return c->arity >= 0 ? argc == (size_t)c->arity : argc >= (size_t)-c->arity;
+}
+
+// argument position of the last key
+inline size_t cmd_last_key(Command const *c, size_t argc) {
+  return c->last_key >= 0 ? (size_t)c->last_key : argc + c->last_key;
+}
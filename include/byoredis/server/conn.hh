@@ -2,36 +2,79 @@
 
 #include <stdint.h>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "byoredis/proto/buffer.hh"
 #include "byoredis/ds/list.hh"
 
+struct ShardCall;
+
+// segments gathered by a single writev()/sendmsg()
+size_t const k_max_iov = 64;
+
 struct Conn {
   int fd = -1;
+  uint64_t id = 0;  // unique within the shard, fds can be reused
   // application's intention, for the event loop
   bool want_read = false;
   bool want_write = false;
   bool want_close = false;
+  // waiting for the reply of a request forwarded to other shards
+  bool blocked = false;
+  // arguments of the current request, they point into `incoming`.
+  // Reused across requests so parsing doesn't allocate in the steady state.
+  std::vector<std::string_view> args;
+  // requests parsed by an I/O thread, executed by the event loop thread:
+  // the arguments of all requests back to back, the count of each request,
+  // and the bytes to consume from `incoming` once they are executed
+  std::vector<std::string_view> parsed_args;
+  std::vector<uint32_t> parsed_argc;
+  size_t parsed_bytes = 0;
   // buffered input and output
   Buffer incoming;  // data to be parsed by the application
   Buffer outgoing;  // responses generated by the application
   // timer
   uint64_t last_active_ms = 0;
   DList idle_node;
+  // io_uring backend: the buffer owned by the kernel while a send is in flight
+  Buffer sending{0};
+  bool send_inflight = false;
+  struct msghdr send_msg = {};
+  struct iovec send_iov[k_max_iov];
+  uint32_t io_pending = 0;  // submitted operations referencing this conn
 };
 
+Conn *conn_new(int connfd);
 void conn_destroy(Conn *conn);
+// the memory of a destroyed connection
+void conn_free(Conn *conn);
+// reset the idle timer
+void conn_touch(Conn *conn);
 
 // Server-side connection management APIs
 int32_t handle_accept(int fd);
 bool try_process_one_request(Conn *conn);
 void handle_write(Conn *conn);
 void handle_read(Conn *conn);
+// the I/O steps split for the I/O threads, see io_threads.hh
+bool conn_read(Conn *conn);
+void conn_parse(Conn *conn);
+void conn_execute(Conn *conn);
+void conn_write(Conn *conn);
+// update the readiness intention after writing
+void conn_update_io(Conn *conn);
+// parse and execute buffered requests, then flush the responses
+void conn_process(Conn *conn);
+// the forwarded request is answered, emit its response and continue
+void conn_resume(Conn *conn, ShardCall *call);
 
 // +------|-----|------|-----|------|-----|-----|------+
 // | nstr | len | str1 | len | str2 | ... | len | strn |
 // +------|-----|------|-----|------|-----|-----|------+
 
-int32_t parse_req(uint8_t const *data, size_t size, std::vector<std::string> &out);
-void do_request_and_make_response(std::vector<std::string> &cmd, Buffer &buffer);
+// append the arguments to `out`, they point into `data`
+int32_t parse_req(uint8_t const *data, size_t size, std::vector<std::string_view> &out);
+void do_request_and_make_response(std::vector<std::string_view> &cmd, Buffer &buffer);
@@ -1,31 +1,98 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 
+#include "byoredis/common/hash.hh"
 #include "byoredis/ds/hashtable.hh"
+#include "byoredis/ds/swisstable.hh"
+#include "byoredis/ds/radix.hh"
 #include "byoredis/ds/zset.hh"
 #include "byoredis/server/conn.hh"
-#include "byoredis/ds/heap.hh"
+#include "byoredis/ds/timerwheel.hh"
+#include "byoredis/server/time.hh"
 #include "byoredis/server/thread_pool.hh"
+#include "byoredis/server/shard.hh"
+#include "byoredis/server/defrag.hh"
+#include "byoredis/proto/blob.hh"
 #include <vector>
 
+struct IoUring;
+struct Entry;
+struct IoThreads;
+
+// The index of the top-level keyspace, `make DB=swiss` switches from the
+// chained HMap to the open-addressing SMap.
+#if defined(BYOREDIS_DB_SWISS)
+typedef SMap DbMap;
+inline HNode * db_lookup(DbMap *db, HNode *key, bool (*eq)(HNode *, HNode *)) { return sm_lookup(db, key, eq); }
+inline void    db_insert(DbMap *db, HNode *node) { sm_insert(db, node); }
+inline void    db_clear(DbMap *db) { sm_clear(db); }
+inline HNode * db_delete(DbMap *db, HNode *key, bool (*eq)(HNode *, HNode *)) { return sm_delete(db, key, eq); }
+inline size_t  db_size(DbMap *db) { return sm_size(db); }
+inline void    db_foreach(DbMap *db, bool (*cb)(HNode *, void *), void *arg) { sm_foreach(db, cb, arg); }
+inline uint64_t db_scan(DbMap *db, uint64_t cursor, void (*cb)(HNode *, void *), void *arg) { return sm_scan(db, cursor, cb, arg); }
+inline uint64_t db_defrag(DbMap *db, uint64_t cursor, HNode *(*move)(HNode *, void *), void *arg) { return sm_defrag(db, cursor, move, arg); }
+inline void    db_prefetch(DbMap *db, uint64_t hcode) { sm_prefetch(db, hcode); }
+inline void    db_prefetch_chain(DbMap *db, uint64_t hcode) { sm_prefetch_chain(db, hcode); }
+#else
+typedef HMap DbMap;
+inline HNode * db_lookup(DbMap *db, HNode *key, bool (*eq)(HNode *, HNode *)) { return hm_lookup(db, key, eq); }
+inline void    db_insert(DbMap *db, HNode *node) { hm_insert(db, node); }
+inline void    db_clear(DbMap *db) { hm_clear(db); }
+inline HNode * db_delete(DbMap *db, HNode *key, bool (*eq)(HNode *, HNode *)) { return hm_delete(db, key, eq); }
+inline size_t  db_size(DbMap *db) { return hm_size(db); }
+inline void    db_foreach(DbMap *db, bool (*cb)(HNode *, void *), void *arg) { hm_foreach(db, cb, arg); }
+inline uint64_t db_scan(DbMap *db, uint64_t cursor, void (*cb)(HNode *, void *), void *arg) { return hm_scan(db, cursor, cb, arg); }
+inline uint64_t db_defrag(DbMap *db, uint64_t cursor, HNode *(*move)(HNode *, void *), void *arg) { return hm_defrag(db, cursor, move, arg); }
+inline void    db_prefetch(DbMap *db, uint64_t hcode) { hm_prefetch(db, hcode); }
+inline void    db_prefetch_chain(DbMap *db, uint64_t hcode) { hm_prefetch_chain(db, hcode); }
+#endif
+
+// maintain `GlobalData::prefix_index` for queries by key prefix,
+// set before the reactors start
+extern bool g_prefix_index;
+
 struct GlobalData {
-  HMap db;  // top-level hashtable
+  DbMap db;  // top-level hashtable
+  // the keys in order, to Entry *; empty unless `g_prefix_index`
+  RTree prefix_index;
   // a map of all client connections, keyed by fd
   std::vector<Conn *> fd2conn;
   // timers for idle connections
   DList idle_list;
   // timers for TTLs
-  std::vector<HeapItem> heap;
+  TimerWheel ttl_wheel;
+  // time budget of the next active expire cycle, see process_timers()
+  uint64_t expire_budget_us = k_expire_budget_us;
   // the thread pool for background tasks(free zset nodes)
   ThreadPool thread_pool;
+  // small entries to free in the thread pool as one task, see entry_del_lazy()
+  std::vector<Entry *> lazy_free;
+  // the active defragmentation of this keyspace
+  DefragState defrag;
   // epoll instance fd
   int epoll_fd = -1;
+  // io_uring backend, replaces epoll if enabled
+  IoUring *uring = NULL;
+  // I/O threads for the epoll backend, NULL if disabled
+  IoThreads *io_threads = NULL;
+  // multi-reactor mode
+  uint32_t shard_id = 0;
+  uint64_t next_conn_id = 1;
+  ShardInbox inbox;
 };
-extern GlobalData g_data;
+// each reactor thread owns its own shard
+extern thread_local GlobalData g_data;
+// all shards indexed by shard id, filled before the reactors start serving
+extern std::vector<GlobalData *> g_shards;
 
-// changed from 1000 to 10 just for testing
-size_t const k_large_container_size = 10;  // threshold for background free
+// Freeing is offloaded to the thread pool by its estimated cost, about
+// one unit per allocation (or page of a large string): an entry costing
+// more gets a task of its own.
+size_t const k_lazy_free_cost  = 64;
+// the small entries freed lazily are batched, this many per task at most
+size_t const k_lazy_free_batch = 1024;
 
 enum ENTRY_TYPE {
   T_INIT = 0,
@@ -33,21 +100,40 @@ enum ENTRY_TYPE {
   T_ZSET = 2,  // sorted set
 };
 
-// KV pair for the top-level hashtable
+// string values up to this size are stored inside the entry
+size_t const k_max_inline_str = 64;
+
+// Entry::enc bits
+enum ENTRY_ENC {
+  ENC_KEY_LEN    = 3,       // length class of the key length: 1, 2 or 4 bytes
+  ENC_STR_INLINE = 1 << 2,  // T_STR: the value follows the key, else a Blob *
+};
+
+// The TTL timer of an entry, allocated only for the keys with a TTL so
+// that the others pay a pointer for it.
+struct EntryTimer {
+  TWNode tw;
+  Entry *ent;  // the owner, repointed when the entry moves
+};
+
+// KV pair for the top-level hashtable, a single variable-sized allocation.
+// The key follows the fixed header, prefixed by its length in 1, 2 or 4
+// bytes (its length class), then the value depending on the type:
+//   T_STR, small: 1 byte length + the bytes
+//   T_STR, large: Blob *, shared with the responses still being written
+//   T_ZSET:       ZSet *
+// The pointers are unaligned, use the accessors.
 struct Entry {
-  struct HNode node;       // hashtable node
-  std::string key;
-  size_t heap_idx = -1;    // array index to the heap item
-  // value
-  uint32_t type = T_INIT;
-  // one of the following
-  std::string str; 
-  ZSet zset;
+  struct HNode node;     // hashtable node
+  EntryTimer *ttl;       // NULL if no TTL
+  uint8_t type;          // ENTRY_TYPE
+  uint8_t enc;           // ENTRY_ENC
+  uint8_t data[];        // key, value
 };
 
 struct LookupKey {  // for lookup only
   HNode node;
-  std::string key;
+  std::string_view key;  // points into the request
 };
 
 struct HKey {  // for the hashtable key(zset name) compare function
@@ -56,11 +142,43 @@ struct HKey {  // for the hashtable key(zset name) compare function
   size_t len = 0;
 };
 
-Entry * entry_new(uint32_t type);
+// add to or remove from the keyspace: the hashtable and the prefix index
+void    keyspace_insert(Entry *ent);
+// a key whose TTL has passed is deleted instead of returned, NULL if not found
+Entry * keyspace_lookup(HNode *key, bool (*eq)(HNode *, HNode *));
+// NULL if not found
+Entry * keyspace_delete(HNode *key, bool (*eq)(HNode *, HNode *));
+Entry * entry_new_str(std::string_view key, uint64_t hcode, std::string_view val);
+Entry * entry_new_zset(std::string_view key, uint64_t hcode);
+// freed inline unless costly, for the commands deleting a few keys
 void    entry_del(Entry *ent);
+// never freed on the loop thread, for mass deletes and expiration
+void    entry_del_lazy(Entry *ent);
+// queue the batch of entry_del_lazy(), once per event loop iteration
+void    lazy_free_flush();
+size_t  entry_free_cost(Entry const *ent);
+// delete all keys, the old keyspace is torn down in the thread pool if async
+void    keyspace_flush(bool async);
+// move the entry out of a sparse slab span if worth it, the TTL wheel and
+// the prefix index are repointed, the hashtable is left to db_defrag().
+// Returns the new address, or the entry. Adds the bytes returned to the OS
+// to `released`, see slab_defrag_free().
+Entry * entry_defrag(Entry *ent, uint64_t *released);
+// replace a string value. The entry is reallocated if its size changes,
+// it is then reinserted into the keyspace and the new address is returned.
+Entry * entry_set_str(Entry *ent, std::string_view val);
+std::string_view entry_key(Entry const *ent);
+// T_STR
+std::string_view entry_str(Entry const *ent);
+Blob *  entry_blob(Entry const *ent);  // NULL if stored inline
+// T_ZSET
+ZSet *  entry_zset(Entry const *ent);
+// free the nodes from zset_remove_range(), in the thread pool if many
+void    zset_garbage_del(ZNode *garbage, size_t count);
 void    entry_set_ttl(Entry *ent, int64_t ttl_ms);
+// the TTL has passed, the key is not deleted yet
+bool    entry_expired(Entry const *ent);
 
 bool entry_eq(HNode *lhs, HNode *rhs);
-uint64_t str_hash(uint8_t const *data, size_t len);
 bool hcmp(HNode *node, HNode *key);
 bool hnode_same(HNode *node, HNode *key);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Active defragmentation.
+// After deletes the slab spans are left partly used, and a span is only
+// returned to the OS once it is empty. A pass walks the keyspace in time
+// slices of the event loop and moves the entries and the zset nodes out of
+// the spans used less than average (see slab_defrag_move()), so that they
+// empty. Passes are repeated while the spans are fragmented and objects
+// are moved. Each reactor walks its own keyspace, but the slab spans and
+// so the fragmentation that starts a pass are shared by the process.
+
+// run the passes, set before the reactors start
+extern bool g_active_defrag;
+
+// fragmentation: free bytes in the spans of the slab classes
+uint64_t const k_defrag_min_waste   = 4 << 20;
+uint64_t const k_defrag_start_pct   = 10;    // % of the span bytes to start a pass
+uint64_t const k_defrag_check_ms    = 1000;  // checked this often while idle
+uint64_t const k_defrag_interval_ms = 10;    // a slice this often during a pass
+uint64_t const k_defrag_budget_us   = 1000;  // per slice, ~10% of a core
+// the nodes of a larger zset are moved in later slices, by cursor
+size_t const k_defrag_zset_inline   = 128;
+
+struct DefragState {
+  bool     active = false;  // a pass is running
+  uint64_t next_ms = 0;     // the next slice or check
+  uint64_t cursor = 0;      // db_defrag() cursor
+  bool     keys_done = false;  // the cursor went round
+  // the large zsets found by the pass, continued first by zset_defrag()
+  std::vector<std::string> zsets;
+  uint64_t zset_cursor = 0;  // of zsets.back()
+  // stats
+  uint64_t passes = 0;
+  uint64_t moved = 0;            // entries and zset nodes
+  uint64_t reclaimed_bytes = 0;  // spans emptied by the moves of this shard
+  uint64_t pass_moved = 0;       // `moved` when the pass started
+};
+
+// the time of the next slice or check, -1 if disabled
+uint64_t defrag_next_ms();
+void     defrag_cycle(uint64_t now_ms);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+
+// Redis-6 style I/O threads for the single-reactor epoll loop.
+// Every loop iteration fans the ready connections out to the I/O threads,
+// which read() and parse the requests, and fans back in with a barrier.
+// The event loop thread alone executes the requests, so it stays the sole
+// owner of the keyspace. The responses are then written by the I/O threads
+// in a second fan-out/fan-in round.
+
+struct Conn;
+
+enum IO_OP {
+  IO_READ  = 1,  // read() and parse
+  IO_WRITE = 2,  // write()
+};
+
+struct IoThread {
+  pthread_t tid;
+  // filled by the event loop thread before a fan-out,
+  // owned by the I/O thread while `pending` is non-zero
+  std::vector<Conn *>   jobs;
+  uint32_t              op = 0;
+  std::atomic<uint32_t> pending{0};
+};
+
+struct IoThreads {
+  std::vector<IoThread *> threads;
+  // scratch lists reused across loop iterations
+  std::vector<Conn *> conns;
+  std::vector<Conn *> writes;
+};
+
+void io_threads_init(IoThreads *io, size_t num_threads);
+// serve a batch of ready connections: parallel read and parse, execute on
+// the calling thread, parallel write, then update the epoll interest or close
+void io_threads_serve(IoThreads *io, std::vector<Conn *> const &readable,
+                      std::vector<Conn *> const &writable);
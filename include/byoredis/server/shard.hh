@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "byoredis/proto/buffer.hh"
+
+// Shared-nothing multi-reactor mode.
+// Every reactor thread owns one shard of the keyspace (its own `g_data`),
+// a key belongs to the shard picked by its hash. A request for a key owned
+// by another shard is shipped to the owner as a message, the owner executes
+// it and sends the response payload back to the origin shard.
+
+struct Conn;
+
+// a client request fanned out to one or more shards, owned by the origin shard
+struct ShardCall {
+  uint32_t origin = 0;       // shard that owns the client connection
+  int      fd = -1;          // the client connection on the origin shard
+  uint64_t conn_id = 0;      // guards against fd reuse while in flight
+  uint32_t remaining = 0;    // parts not answered yet
+  std::vector<Buffer> parts; // response payload of each part
+  std::vector<uint32_t> key_parts;  // multi-key: the part of each key
+  // combine the parts into a single response payload
+  void (*merge)(ShardCall *call, Buffer &out) = NULL;
+};
+
+// a request or its reply travelling between reactor threads
+struct ShardMsg {
+  ShardCall *call = NULL;
+  uint32_t   part = 0;       // index into ShardCall::parts
+  bool       is_reply = false;
+  std::vector<std::string> cmd;  // owned copy of the arguments
+  Buffer     out;            // response payload filled by the owner shard
+};
+
+// mailbox of a reactor, drained by its own event loop
+struct ShardInbox {
+  pthread_mutex_t         mu;
+  std::vector<ShardMsg *> msgs;
+  int                     efd = -1;  // eventfd to wake up the event loop
+};
+
+// set on SIGINT or SIGTERM, every reactor leaves its event loop
+extern std::atomic<bool> g_shutdown;
+
+void     shard_init(ShardInbox *inbox);
+// wake up the event loop of every reactor, async-signal-safe
+void     shard_wake_all();
+uint32_t shard_of(uint64_t hcode);
+// returns true if the request was shipped to other shards,
+// the connection must not process further requests until the reply arrives
+bool     shard_forward(Conn *conn, std::vector<std::string_view> &cmd);
+// handle the messages in the inbox of the calling reactor
+void     shard_drain();
@@ -1,21 +1,59 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 #include <pthread.h>
+#include <atomic>
 #include <vector>
-#include <deque>
+#include "byoredis/ds/wsdeque.hh"
 
-struct Work {
-  void (*task)(void *) = NULL;
-  void *arg = NULL;
+// task priority classes, a worker runs the lower values first
+enum TASK_PRIO {
+  PRIO_LAZY_FREE = 0,  // freeing the values of deleted keys
+  PRIO_FLUSH     = 1,  // tearing down a flushed keyspace, a long task
 };
+size_t const k_task_prios = 2;
 
+struct ThreadPool;
+
+struct PoolWorker {
+  ThreadPool *tp = NULL;
+  size_t id = 0;
+  pthread_t thread;
+  // the tasks queued by the tasks running on this worker
+  WSDeque local[k_task_prios];
+  // counters, written by this worker only
+  alignas(64) std::atomic<uint64_t> done[k_task_prios] = {};
+  std::atomic<uint64_t> steals{0};
+};
+
+// Work-stealing pool. The thread that called `thread_pool_init()` (the
+// reactor) queues into the injection deques; a task running on a worker
+// queues into the worker's own deques. An idle worker takes its own work
+// first, then the injected work, then steals from the other workers,
+// one priority class at a time.
 struct ThreadPool {
-  std::vector<pthread_t> threads;
-  std::deque<Work>       queue;
-  pthread_mutex_t        mu;
-  pthread_cond_t         not_empty;
+  std::vector<PoolWorker *> workers;
+  pthread_t owner;
+  WSDeque injected[k_task_prios];
+  std::atomic<uint64_t> queued[k_task_prios] = {};
+  std::atomic<bool> stopping{false};
+  // the idle workers wait on the condvar, queuing skips the mutex if none
+  std::atomic<uint32_t> sleepers{0};
+  pthread_mutex_t mu;
+  pthread_cond_t  wake;
+};
+
+struct ThreadPoolStats {
+  size_t   workers = 0;
+  uint64_t queued[k_task_prios] = {};  // total since start
+  uint64_t done[k_task_prios] = {};
+  uint64_t depth[k_task_prios] = {};   // queued and not started yet
+  uint64_t steals = 0;
 };
 
 void thread_pool_init(ThreadPool *tp, size_t num_threads);
-void thread_pool_queue(ThreadPool *tp, void (*task)(void *), void *arg);
+void thread_pool_queue(ThreadPool *tp, void (*task)(void *), void *arg, TASK_PRIO prio);
+// run all the queued tasks, then join the workers; nothing can be queued after
+void thread_pool_stop(ThreadPool *tp);
+ThreadPoolStats thread_pool_stats(ThreadPool *tp);
@@ -4,8 +4,14 @@
 #include <stdint.h>
 
 uint64_t const k_idle_timeout_ms = 5 * 1000;  // 5 seconds
-size_t   const k_max_works       = 2000;      // TTL timers using a heap 
+// The active expire cycle deletes the expired keys for at most this long
+// per event loop iteration. The budget doubles while expired keys are
+// left over, up to the max, and goes back once they are all deleted.
+// The keys left over are never served, a lookup deletes them first.
+uint64_t const k_expire_budget_us     = 250;
+uint64_t const k_expire_budget_max_us = 4000;
 
 uint64_t get_monotonic_msec();
+uint64_t get_monotonic_usec();
 int32_t next_timer_ms();
 void process_timers();
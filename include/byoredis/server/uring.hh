@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+// io_uring event loop backend, an alternative to epoll.
+// Uses raw syscalls, no liburing dependency.
+//  - multishot accept on the listening socket
+//  - multishot recv into a ring of kernel-provided buffers
+//  - sends are queued and submitted in a batch with the wait for completions
+// so a loop iteration costs a single io_uring_enter() no matter how many
+// requests it serves.
+
+struct Conn;
+
+struct IoUring {
+  int ring_fd = -1;
+  // submission queue
+  unsigned      *sq_head  = NULL;
+  unsigned      *sq_tail  = NULL;
+  unsigned      *sq_array = NULL;
+  unsigned       sq_mask  = 0;
+  unsigned       sq_entries = 0;
+  unsigned       sqe_tail = 0;   // local tail, published on submit
+  io_uring_sqe  *sqes = NULL;
+  // completion queue
+  unsigned      *cq_head = NULL;
+  unsigned      *cq_tail = NULL;
+  unsigned       cq_mask = 0;
+  io_uring_cqe  *cqes = NULL;
+  // provided buffers for multishot recv
+  io_uring_buf_ring *br = NULL;
+  uint8_t       *bufs = NULL;
+  unsigned       br_mask = 0;
+  uint16_t       br_tail = 0;
+  // the listening socket and the inbox eventfd
+  int listen_fd = -1;
+  int inbox_fd  = -1;
+  // closed connections waiting for their last completion to be freed
+  uint32_t closing = 0;
+  // the mappings, unmapped by uring_close()
+  void   *rings = NULL;
+  size_t  rings_size = 0;
+  size_t  sqes_size = 0;
+  size_t  br_size = 0;
+};
+
+// returns false if io_uring is not usable, the caller falls back to epoll
+bool uring_init(IoUring *ring, int listen_fd, int inbox_fd);
+// run the event loop until `g_shutdown`
+void uring_loop(IoUring *ring);
+// after the connections are destroyed: wait for the kernel to release
+// them, then free the ring
+void uring_close(IoUring *ring);
+// queue the outgoing data of the connection, submitted by the event loop
+void uring_send(Conn *conn);
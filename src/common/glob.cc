@@ -0,0 +1,87 @@
+#include "byoredis/common/glob.hh"
+
+// match the [...] class at p[i] == '[' against `c`, advance `i` past it
+static bool class_match(std::string_view p, size_t &i, unsigned char c) {
+  i++;  // '['
+  bool negate = i < p.size() && p[i] == '^';
+  if (negate) {
+    i++;
+  }
+  bool found = false;
+  // a ']' right after the '[' is a literal
+  for (bool first = true; i < p.size() && (first || p[i] != ']'); first = false) {
+    unsigned char lo = (unsigned char)p[i];
+    if (lo == '\\' && i + 1 < p.size()) {
+      lo = (unsigned char)p[++i];
+    }
+    if (i + 2 < p.size() && p[i + 1] == '-' && p[i + 2] != ']') {
+      unsigned char hi = (unsigned char)p[i + 2];
+      if (hi == '\\' && i + 3 < p.size()) {
+        hi = (unsigned char)p[++i + 2];
+      }
+      found |= (lo <= hi) ? (lo <= c && c <= hi) : (hi <= c && c <= lo);
+      i += 3;
+    } else {
+      found |= (lo == c);
+      i++;
+    }
+  }
+  if (i < p.size()) {
+    i++;  // ']', an unterminated class runs to the end of the pattern
+  }
+  return found != negate;
+}
+
+size_t glob_prefix_len(std::string_view p) {
+  size_t i = 0;
+  while (i < p.size() && p[i] != '*' && p[i] != '?' && p[i] != '[' && p[i] != '\\') {
+    i++;
+  }
+  return i;
+}
+
+// Iterative with backtracking to the last '*' only, which is enough since
+// a later '*' can absorb whatever an earlier one would have: O(|p| * |s|)
+// in the worst case instead of exponential.
+bool glob_match(std::string_view p, std::string_view s) {
+  size_t pi = 0, si = 0;
+  size_t star_p = std::string_view::npos, star_s = 0;
+  while (si < s.size()) {
+    if (pi < p.size()) {
+      char pc = p[pi];
+      if (pc == '*') {
+        star_p = ++pi;
+        star_s = si;
+        continue;
+      }
+      size_t next = pi + 1;
+      bool ok = false;
+      if (pc == '?') {
+        ok = true;
+      } else if (pc == '[') {
+        next = pi;
+        ok = class_match(p, next, (unsigned char)s[si]);
+      } else if (pc == '\\' && pi + 1 < p.size()) {
+        ok = (p[pi + 1] == s[si]);
+        next = pi + 2;
+      } else {
+        ok = (pc == s[si]);
+      }
+      if (ok) {
+        pi = next;
+        si++;
+        continue;
+      }
+    }
+    if (star_p == std::string_view::npos) {
+      return false;
+    }
+    // let the last '*' absorb one more byte
+    pi = star_p;
+    si = ++star_s;
+  }
+  while (pi < p.size() && p[pi] == '*') {
+    pi++;
+  }
+  return pi == p.size();
+}
@@ -0,0 +1,95 @@
+#include "byoredis/common/hash.hh"
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+// a fixed default for tools and tests that don't call hash_seed_init()
+uint64_t g_hash_seed = 0x2D358DCCAA6C78A5ull;
+
+static uint64_t const k_secret0 = 0xA0761D6478BD642Full;
+static uint64_t const k_secret1 = 0xE7037ED1A0B428DBull;
+static uint64_t const k_secret2 = 0x8EBC6AF09C88C6E3ull;
+static uint64_t const k_secret3 = 0x589965CC75374CC3ull;
+
+void hash_seed_init() {
+  uint64_t seed = 0;
+  if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) != (ssize_t)sizeof(seed)) {
+    // no entropy yet, good enough to defeat precomputed collisions
+    struct timespec tv;
+    clock_gettime(CLOCK_REALTIME, &tv);
+    seed = ((uint64_t)tv.tv_sec << 32) ^ (uint64_t)tv.tv_nsec ^ ((uint64_t)getpid() << 16);
+  }
+  g_hash_seed = seed;
+}
+
+// 64x64 -> 128-bit multiply, the low and high halves
+static inline void mum(uint64_t &a, uint64_t &b) {
+  __uint128_t r = (__uint128_t)a * b;
+  a = (uint64_t)r;
+  b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+  mum(a, b);
+  return a ^ b;
+}
+
+static inline uint64_t read64(uint8_t const *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static inline uint64_t read32(uint8_t const *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+// 1 to 3 bytes
+static inline uint64_t read_small(uint8_t const *p, size_t k) {
+  return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+uint64_t hash_bytes(void const *data, size_t len, uint64_t seed) {
+  uint8_t const *p = (uint8_t const *)data;
+  seed ^= mix(seed ^ k_secret0, k_secret1);
+  uint64_t a = 0, b = 0;
+  if (len <= 16) {
+    if (len >= 4) {
+      // 2 overlapping reads from each end cover 4 to 16 bytes
+      size_t off = (len >> 3) << 2;
+      a = (read32(p) << 32) | read32(p + off);
+      b = (read32(p + len - 4) << 32) | read32(p + len - 4 - off);
+    } else if (len > 0) {
+      a = read_small(p, len);
+    }
+  } else {
+    size_t i = len;
+    if (i > 48) {
+      // 3 independent multiply chains
+      uint64_t see1 = seed, see2 = seed;
+      do {
+        seed = mix(read64(p)      ^ k_secret1, read64(p + 8)  ^ seed);
+        see1 = mix(read64(p + 16) ^ k_secret2, read64(p + 24) ^ see1);
+        see2 = mix(read64(p + 32) ^ k_secret3, read64(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = mix(read64(p) ^ k_secret1, read64(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    // the last 16 bytes, may overlap with the ones already consumed
+    a = read64(p + i - 16);
+    b = read64(p + i - 8);
+  }
+  a ^= k_secret1;
+  b ^= seed;
+  mum(a, b);
+  return mix(a ^ k_secret0 ^ len, b ^ k_secret1);
+}
@@ -0,0 +1,529 @@
+#include "byoredis/common/slab.hh"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <atomic>
+
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+// the free list link in the first word stays addressable
+#define SLAB_POISON(p, n)   ASAN_POISON_MEMORY_REGION((char *)(p) + sizeof(void *), (n) - sizeof(void *))
+#define SLAB_UNPOISON(p, n) ASAN_UNPOISON_MEMORY_REGION((p), (n))
+#else
+#define SLAB_POISON(p, n)   ((void)(p), (void)(n))
+#define SLAB_UNPOISON(p, n) ((void)(p), (void)(n))
+#endif
+
+size_t const k_chunk_size  = (size_t)2 << 20;
+size_t const k_span_size   = (size_t)64 << 10;
+size_t const k_chunk_spans = k_chunk_size / k_span_size;
+// spans of a partial list compared to pick the fullest one
+size_t const k_span_pick   = 16;
+
+constexpr size_t class_size(size_t c) {
+  if (c < 16) {
+    return (c + 1) * 8;
+  }
+  size_t base = (size_t)128 << ((c - 16) / 4);
+  return base + ((c - 16) % 4 + 1) * (base / 4);
+}
+static_assert(class_size(k_slab_classes - 1) == k_slab_max_size);
+
+// size / 8 (rounded up) -> class
+struct ClassTable {
+  uint8_t idx[k_slab_max_size / 8 + 1] = {};
+};
+
+constexpr ClassTable class_table_build() {
+  ClassTable t;
+  size_t c = 0;
+  for (size_t i = 0; i <= k_slab_max_size / 8; i++) {
+    while (class_size(c) < i * 8) {
+      c++;
+    }
+    t.idx[i] = (uint8_t)c;
+  }
+  return t;
+}
+static constexpr ClassTable k_class_table = class_table_build();
+
+static size_t class_of(size_t size) {
+  return k_class_table.idx[(size + 7) / 8];
+}
+
+// objects moved between a thread cache and its class at once
+static size_t class_batch(size_t c) {
+  return std::clamp((size_t)16 * 1024 / class_size(c), (size_t)4, (size_t)64);
+}
+
+// The metadata of a span, in the first span of its chunk, which holds no
+// objects. Objects are cut from the span in address order, then reused
+// through its own free list. Guarded by the class lock while in use, by
+// the chunk lock while free.
+struct Span {
+  void    *free;   // returned objects, linked through the first word
+  uint32_t nfree;  // objects in `free`
+  uint32_t ncut;   // objects cut so far
+  uint32_t cap;    // objects in the span
+  bool     partial;
+  Span    *prev;   // in the partial list of the class, or the free spans
+  Span    *next;
+};
+
+struct ChunkHeader {
+  Span spans[k_chunk_spans];  // spans[0] is the header itself
+  bool split;                 // no longer a huge page, see span_release()
+};
+static_assert(sizeof(ChunkHeader) <= k_span_size);
+
+static ChunkHeader *chunk_of(void *ptr) {
+  return (ChunkHeader *)((uintptr_t)ptr & ~(uintptr_t)(k_chunk_size - 1));
+}
+
+static Span *span_of(void *ptr) {
+  ChunkHeader *chunk = chunk_of(ptr);
+  return &chunk->spans[((char *)ptr - (char *)chunk) / k_span_size];
+}
+
+static char *span_base(Span *span) {
+  ChunkHeader *chunk = chunk_of(span);
+  return (char *)chunk + (size_t)(span - chunk->spans) * k_span_size;
+}
+
+// objects out of the span: in use or in a thread cache
+static uint32_t span_used(Span const *span) {
+  return span->ncut - span->nfree;
+}
+
+struct SlabClass {
+  pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+  Span *cur = NULL;      // the span allocated from
+  Span *partial = NULL;  // the other spans with free objects
+  Span *partial_tail = NULL;
+  uint64_t used = 0;     // sum of span_used()
+  uint64_t nspans = 0;
+  std::atomic<uint64_t> reserved{0};
+};
+static SlabClass g_classes[k_slab_classes];
+
+static pthread_mutex_t g_chunk_mu = PTHREAD_MUTEX_INITIALIZER;
+static Span *g_chunk_next = NULL;  // the next unused span of the last chunk
+static Span *g_chunk_end  = NULL;
+static Span *g_free_spans = NULL;  // returned to the OS, reused by any class
+static std::atomic<size_t> g_mapped{0};
+static std::atomic<uint64_t> g_released{0};
+
+// a 2 MB aligned chunk so that it can be a single huge page
+static ChunkHeader *chunk_map() {
+  size_t len = 2 * k_chunk_size;
+  char *p = (char *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    abort();
+  }
+  char *aligned = (char *)(((uintptr_t)p + k_chunk_size - 1) & ~(uintptr_t)(k_chunk_size - 1));
+  if (aligned > p) {
+    munmap(p, aligned - p);
+  }
+  munmap(aligned + k_chunk_size, p + len - (aligned + k_chunk_size));
+#if defined(MADV_HUGEPAGE)
+  (void)madvise(aligned, k_chunk_size, MADV_HUGEPAGE);
+#endif
+  g_mapped.fetch_add(k_chunk_size, std::memory_order_relaxed);
+  return (ChunkHeader *)aligned;  // zero-filled
+}
+
+// a span for class `c`, the class lock is held
+static Span *span_new(size_t c) {
+  pthread_mutex_lock(&g_chunk_mu);
+  Span *span = g_free_spans;
+  if (span) {
+    g_free_spans = span->next;
+  } else {
+    if (g_chunk_next == g_chunk_end) {
+      ChunkHeader *chunk = chunk_map();
+      g_chunk_next = &chunk->spans[1];
+      g_chunk_end = &chunk->spans[k_chunk_spans];
+    }
+    span = g_chunk_next++;
+  }
+  pthread_mutex_unlock(&g_chunk_mu);
+  // objects of another class may have been poisoned here
+  SLAB_UNPOISON(span_base(span), k_span_size);
+  *span = Span{};
+  span->cap = (uint32_t)(k_span_size / class_size(c));
+  SlabClass &sc = g_classes[c];
+  sc.nspans++;
+  sc.reserved.fetch_add(k_span_size, std::memory_order_relaxed);
+  return span;
+}
+
+// an empty span goes back to the OS, the class lock is held
+static void span_release(size_t c, Span *span) {
+  SlabClass &sc = g_classes[c];
+  sc.nspans--;
+  sc.reserved.fetch_sub(k_span_size, std::memory_order_relaxed);
+  pthread_mutex_lock(&g_chunk_mu);
+  ChunkHeader *chunk = chunk_of(span);
+  if (!chunk->split) {
+    // or khugepaged would collapse the chunk into a huge page again
+    chunk->split = true;
+#if defined(MADV_NOHUGEPAGE)
+    (void)madvise(chunk, k_chunk_size, MADV_NOHUGEPAGE);
+#endif
+  }
+  (void)madvise(span_base(span), k_span_size, MADV_DONTNEED);
+  g_released.fetch_add(k_span_size, std::memory_order_relaxed);
+  span->next = g_free_spans;
+  g_free_spans = span;
+  pthread_mutex_unlock(&g_chunk_mu);
+}
+
+// less used than the average span of the class
+static bool span_sparse(SlabClass const &sc, Span const *span) {
+  return (uint64_t)span_used(span) * sc.nspans < sc.used;
+}
+
+// no holes to fill, or not sparse
+static bool span_dense(SlabClass const &sc, Span const *span) {
+  return span->nfree == 0 || !span_sparse(sc, span);
+}
+
+static void partial_push(SlabClass &sc, Span *span) {
+  span->partial = true;
+  span->prev = sc.partial_tail;
+  span->next = NULL;
+  if (sc.partial_tail) {
+    sc.partial_tail->next = span;
+  } else {
+    sc.partial = span;
+  }
+  sc.partial_tail = span;
+}
+
+static void partial_unlink(SlabClass &sc, Span *span) {
+  span->partial = false;
+  if (span->prev) {
+    span->prev->next = span->next;
+  } else {
+    sc.partial = span->next;
+  }
+  if (span->next) {
+    span->next->prev = span->prev;
+  } else {
+    sc.partial_tail = span->prev;
+  }
+}
+
+// the next span to allocate from once the current one is full: the
+// fullest of the first few partial spans, so that the sparse ones drain.
+// Only if it is dense for `dense`, else a new span.
+static Span *class_next_span(size_t c, bool dense) {
+  SlabClass &sc = g_classes[c];
+  Span *best = NULL;
+  size_t n = 0;
+  for (Span *span = sc.partial; span && n < k_span_pick; span = span->next, n++) {
+    if (!best || span_used(span) > span_used(best)) {
+      best = span;
+    }
+  }
+  if (best && (!dense || span_dense(sc, best))) {
+    partial_unlink(sc, best);
+    return best;
+  }
+  return span_new(c);
+}
+
+static bool span_full(Span const *span) {
+  return span->nfree == 0 && span->ncut == span->cap;
+}
+
+// an object out of the class, the class lock is held
+static void *class_alloc(size_t c) {
+  SlabClass &sc = g_classes[c];
+  if (!sc.cur || span_full(sc.cur)) {
+    // a full span is on no list until an object is returned to it
+    sc.cur = class_next_span(c, false);
+  }
+  Span *span = sc.cur;
+  void *obj = NULL;
+  if (span->free) {
+    obj = span->free;
+    span->free = *(void **)obj;
+    span->nfree--;
+  } else {
+    obj = span_base(span) + (size_t)span->ncut * class_size(c);
+    span->ncut++;
+  }
+  sc.used++;
+  return obj;
+}
+
+// an object back to its span, the class lock is held.
+// Returns the bytes returned to the OS, the span if it emptied.
+static size_t class_free(size_t c, void *obj) {
+  SlabClass &sc = g_classes[c];
+  Span *span = span_of(obj);
+  *(void **)obj = span->free;
+  span->free = obj;
+  span->nfree++;
+  sc.used--;
+  if (span == sc.cur) {
+    return 0;
+  }
+  if (span_used(span) == 0) {
+    if (span->partial) {
+      partial_unlink(sc, span);
+    }
+    span_release(c, span);
+    return k_span_size;
+  }
+  if (!span->partial) {
+    partial_push(sc, span);
+  }
+  return 0;
+}
+
+// Per-thread cache. Constant-initialized and trivially destructible, so
+// it can be used from any thread at any time, including the destructors
+// run at thread exit.
+struct SlabCache {
+  void *free[k_slab_classes];
+  size_t nfree[k_slab_classes];
+  // written by the owner thread only, summed up by slab_stats()
+  std::atomic<int64_t> live[k_slab_classes];
+  std::atomic<int64_t> requested[k_slab_classes];
+  bool registered;
+  SlabCache *prev;
+  SlabCache *next;
+};
+static thread_local SlabCache t_cache;
+
+// all registered caches, and the counters of the exited threads
+static pthread_mutex_t g_registry_mu = PTHREAD_MUTEX_INITIALIZER;
+static SlabCache *g_caches = NULL;
+static int64_t g_retired_live[k_slab_classes];
+static int64_t g_retired_requested[k_slab_classes];
+static pthread_key_t g_cache_key;
+static pthread_once_t g_cache_key_once = PTHREAD_ONCE_INIT;
+
+static void counter_add(std::atomic<int64_t> &x, int64_t d) {
+  x.store(x.load(std::memory_order_relaxed) + d, std::memory_order_relaxed);
+}
+
+// move `n` objects off the front of a cache list onto the class list
+static void cache_release(SlabCache *tc, size_t c, size_t n) {
+  if (n == 0) {
+    return;
+  }
+  void *first = tc->free[c];
+  void *last = first;
+  for (size_t i = 1; i < n; i++) {
+    last = *(void **)last;
+  }
+  tc->free[c] = *(void **)last;
+  tc->nfree[c] -= n;
+  *(void **)last = NULL;
+  SlabClass &sc = g_classes[c];
+  pthread_mutex_lock(&sc.mu);
+  for (void *obj = first; obj; ) {
+    void *next = *(void **)obj;
+    class_free(c, obj);
+    obj = next;
+  }
+  pthread_mutex_unlock(&sc.mu);
+}
+
+// at thread exit
+static void cache_exit(void *arg) {
+  SlabCache *tc = (SlabCache *)arg;
+  pthread_mutex_lock(&g_registry_mu);
+  for (size_t c = 0; c < k_slab_classes; c++) {
+    cache_release(tc, c, tc->nfree[c]);
+    g_retired_live[c] += tc->live[c].load(std::memory_order_relaxed);
+    g_retired_requested[c] += tc->requested[c].load(std::memory_order_relaxed);
+    tc->live[c].store(0, std::memory_order_relaxed);
+    tc->requested[c].store(0, std::memory_order_relaxed);
+  }
+  if (tc->prev) {
+    tc->prev->next = tc->next;
+  } else {
+    g_caches = tc->next;
+  }
+  if (tc->next) {
+    tc->next->prev = tc->prev;
+  }
+  tc->registered = false;
+  pthread_mutex_unlock(&g_registry_mu);
+}
+
+static void cache_key_init() {
+  int rv = pthread_key_create(&g_cache_key, &cache_exit);
+  assert(rv == 0);
+  (void)rv;
+}
+
+static SlabCache *cache_get() {
+  SlabCache *tc = &t_cache;
+  if (!tc->registered) {
+    pthread_once(&g_cache_key_once, &cache_key_init);
+    pthread_mutex_lock(&g_registry_mu);
+    tc->prev = NULL;
+    tc->next = g_caches;
+    if (g_caches) {
+      g_caches->prev = tc;
+    }
+    g_caches = tc;
+    tc->registered = true;
+    pthread_mutex_unlock(&g_registry_mu);
+    pthread_setspecific(g_cache_key, tc);
+  }
+  return tc;
+}
+
+// take a batch from the spans of the class
+static void cache_refill(SlabCache *tc, size_t c) {
+  SlabClass &sc = g_classes[c];
+  pthread_mutex_lock(&sc.mu);
+  for (size_t i = class_batch(c); i > 0; i--) {
+    void *obj = class_alloc(c);
+    *(void **)obj = tc->free[c];
+    tc->free[c] = obj;
+    tc->nfree[c]++;
+  }
+  pthread_mutex_unlock(&sc.mu);
+}
+
+void *slab_alloc(size_t size) {
+  if (size > k_slab_max_size) {
+    void *p = malloc(size);
+    assert(p);
+    return p;
+  }
+  size_t c = class_of(size);
+  SlabCache *tc = cache_get();
+  if (!tc->free[c]) {
+    cache_refill(tc, c);
+  }
+  void *obj = tc->free[c];
+  tc->free[c] = *(void **)obj;
+  tc->nfree[c]--;
+  counter_add(tc->live[c], 1);
+  counter_add(tc->requested[c], (int64_t)size);
+  SLAB_UNPOISON(obj, class_size(c));
+  return obj;
+}
+
+void slab_free(void *ptr, size_t size) {
+  if (!ptr) {
+    return;
+  }
+  if (size > k_slab_max_size) {
+    return free(ptr);
+  }
+  size_t c = class_of(size);
+  SlabCache *tc = cache_get();
+  *(void **)ptr = tc->free[c];
+  tc->free[c] = ptr;
+  tc->nfree[c]++;
+  SLAB_POISON(ptr, class_size(c));
+  counter_add(tc->live[c], -1);
+  counter_add(tc->requested[c], -(int64_t)size);
+  // keep a batch for the next allocations, give back the next one
+  size_t batch = class_batch(c);
+  if (tc->nfree[c] >= 2 * batch) {
+    cache_release(tc, c, batch);
+  }
+}
+
+void *slab_realloc(void *ptr, size_t old_size, size_t new_size) {
+  if (old_size <= k_slab_max_size && new_size <= k_slab_max_size
+      && class_of(old_size) == class_of(new_size)) {
+    // same class, only the accounting changes
+    SlabCache *tc = cache_get();
+    counter_add(tc->requested[class_of(new_size)], (int64_t)new_size - (int64_t)old_size);
+    return ptr;
+  }
+  void *p = slab_alloc(new_size);
+  memcpy(p, ptr, std::min(old_size, new_size));
+  slab_free(ptr, old_size);
+  return p;
+}
+
+void *slab_defrag_move(void *ptr, size_t size) {
+  if (size > k_slab_max_size) {
+    return NULL;
+  }
+  size_t c = class_of(size);
+  SlabClass &sc = g_classes[c];
+  Span *span = span_of(ptr);
+  void *obj = NULL;
+  pthread_mutex_lock(&sc.mu);
+  if (span != sc.cur && span_sparse(sc, span)) {
+    // the copies fill a dense span, the sparse ones are drained
+    if (!sc.cur || span_full(sc.cur) || !span_dense(sc, sc.cur)) {
+      if (sc.cur && span_used(sc.cur) == 0) {
+        span_release(c, sc.cur);
+      } else if (sc.cur && !span_full(sc.cur)) {
+        partial_push(sc, sc.cur);
+      }
+      sc.cur = class_next_span(c, true);
+    }
+    if (sc.cur != span) {
+      obj = class_alloc(c);
+    }
+  }
+  pthread_mutex_unlock(&sc.mu);
+  if (obj) {
+    SLAB_UNPOISON(obj, class_size(c));
+    memcpy(obj, ptr, size);
+  }
+  return obj;
+}
+
+size_t slab_defrag_free(void *ptr, size_t size) {
+  size_t c = class_of(size);
+  SLAB_POISON(ptr, class_size(c));
+  SlabClass &sc = g_classes[c];
+  pthread_mutex_lock(&sc.mu);
+  size_t released = class_free(c, ptr);
+  pthread_mutex_unlock(&sc.mu);
+  return released;
+}
+
+size_t slab_size(size_t size) {
+  return size > k_slab_max_size ? size : class_size(class_of(size));
+}
+
+void slab_stats(SlabClassStats out[k_slab_classes]) {
+  int64_t live[k_slab_classes], requested[k_slab_classes];
+  pthread_mutex_lock(&g_registry_mu);
+  for (size_t c = 0; c < k_slab_classes; c++) {
+    live[c] = g_retired_live[c];
+    requested[c] = g_retired_requested[c];
+  }
+  for (SlabCache *tc = g_caches; tc; tc = tc->next) {
+    for (size_t c = 0; c < k_slab_classes; c++) {
+      live[c] += tc->live[c].load(std::memory_order_relaxed);
+      requested[c] += tc->requested[c].load(std::memory_order_relaxed);
+    }
+  }
+  pthread_mutex_unlock(&g_registry_mu);
+  for (size_t c = 0; c < k_slab_classes; c++) {
+    out[c].size = class_size(c);
+    // the per-thread counters are read at slightly different times
+    out[c].live = (uint64_t)std::max(live[c], (int64_t)0);
+    out[c].requested = (uint64_t)std::max(requested[c], (int64_t)0);
+    out[c].reserved = g_classes[c].reserved.load(std::memory_order_relaxed);
+  }
+}
+
+size_t slab_mapped_bytes() {
+  return g_mapped.load(std::memory_order_relaxed);
+}
+
+uint64_t slab_released_bytes() {
+  return g_released.load(std::memory_order_relaxed);
+}
@@ -5,10 +5,11 @@ static uint32_t max(uint32_t lhs, uint32_t rhs) {
   return lhs > rhs ? lhs : rhs;
 }
 
-// maintain the height and size of the node
+// maintain the augmented data of the node
 static void avl_update(AVLNode *node) {
   node->height = 1 + max(avl_height(node->left), avl_height(node->right));
   node->size   = 1 + avl_size(node->left) + avl_size(node->right);
+  node->sum    = node->val + avl_sum(node->left) + avl_sum(node->right);
 }
 
 // The rotated node links to the parent, but the parent-to-child link is not updated here.
@@ -128,7 +129,9 @@ AVLNode *avl_del(AVLNode *node) {
   // detach the successor
   AVLNode *root = avl_del_easy(victim);
   // swap with the successor
+  double val = victim->val;
   *victim = *node;  // copy all fields, left, right, parent
+  victim->val = val;
   if (victim->left) {
     victim->left->parent = victim;
   }
@@ -142,40 +145,46 @@ AVLNode *avl_del(AVLNode *node) {
     from = parent->left == node ? &parent->left : &parent->right;
   }
   *from = victim;
+  // the sums still include the deleted node
+  for (AVLNode *cur = victim; cur; cur = cur->parent) {
+    avl_update(cur);
+  }
   return root;
 }
 
-// static AVLNode * successor(AVLNode *node) {
-//   // find the leftmost node in the right subtree
-//   if (node->right) {
-//     for (node = node->right; node->left; node = node->left) {}
-//     return node;
-//   }
-//   // find the ancestor where I'm the rightmost node in the left subtree
-//   while (AVLNode *parent = node->parent) {
-//     if (node == parent->left) {
-//       return parent;
-//     }
-//     node = parent;
-//   }
-//   return NULL; // no successor
-// }
-
-// static AVLNode * predecessor(AVLNode *node) {
-//   // find the rightmost node in the left subtree
-//   if (node->left) {
-//     for (node = node->left; node->right; node = node->right) {}
-//     return node;
-//   }
-//   // find the ancestor where I'm the leftmost node in the right subtree
-//   while (AVLNode *parent = node->parent) {
-//     if (node == parent->right) {
-//       return parent;
-//     }
-//     node = parent;
-//   }
-//   return NULL; // no predecessor
-// }
+// the next node in order, amortized O(1) over a walk
+AVLNode * avl_successor(AVLNode *node) {
+  // find the leftmost node in the right subtree
+  if (node->right) {
+    for (node = node->right; node->left; node = node->left) {}
+    return node;
+  }
+  // find the ancestor where I'm the rightmost node in the left subtree
+  while (AVLNode *parent = node->parent) {
+    if (node == parent->left) {
+      return parent;
+    }
+    node = parent;
+  }
+  return NULL; // no successor
+}
+
+// the previous node in order, amortized O(1) over a walk
+AVLNode * avl_predecessor(AVLNode *node) {
+  // find the rightmost node in the left subtree
+  if (node->left) {
+    for (node = node->left; node->right; node = node->right) {}
+    return node;
+  }
+  // find the ancestor where I'm the leftmost node in the right subtree
+  while (AVLNode *parent = node->parent) {
+    if (node == parent->right) {
+      return parent;
+    }
+    node = parent;
+  }
+  return NULL; // no predecessor
+}
 
 // offset into the succeeding or preceding node.
 // Find a path to the target node via the lowest common ancestor.
@@ -219,3 +228,137 @@ int64_t avl_rank(AVLNode *node) {
   }
   return rank;
 }
+
+// join 2 trees with a middle node, all in `left` < `mid` < all in `right`.
+// Attach `mid` to a subtree of the taller tree with a similar height to the
+// shorter tree, then fix it up like an insertion. O(height difference).
+AVLNode * avl_join(AVLNode *left, AVLNode *mid, AVLNode *right) {
+  uint32_t lh = avl_height(left);
+  uint32_t rh = avl_height(right);
+  AVLNode *parent = NULL;
+  AVLNode **from = NULL;
+  if (lh > rh + 1) {
+    // descend the right spine of the left tree
+    while (avl_height(left) > rh + 1) {
+      parent = left;
+      left = left->right;
+    }
+    from = &parent->right;
+  } else if (rh > lh + 1) {
+    // descend the left spine of the right tree
+    while (avl_height(right) > lh + 1) {
+      parent = right;
+      right = right->left;
+    }
+    from = &parent->left;
+  }
+  mid->left = left;
+  mid->right = right;
+  mid->parent = parent;
+  if (left) {
+    left->parent = mid;
+  }
+  if (right) {
+    right->parent = mid;
+  }
+  if (from) {
+    *from = mid;
+  }
+  return avl_fix(mid);
+}
+
+// join 2 trees, all in `left` < all in `right`
+AVLNode * avl_concat(AVLNode *left, AVLNode *right) {
+  if (!left || !right) {
+    return left ? left : right;
+  }
+  // use the leftmost node of the right tree as the middle node
+  AVLNode *mid = right;
+  while (mid->left) {
+    mid = mid->left;
+  }
+  right = avl_del(mid);
+  return avl_join(left, mid, right);
+}
+
+// split a tree into the first `rank` nodes and the rest.
+// The joins along the path telescope to O(log N) in total.
+void avl_split(AVLNode *root, int64_t rank, AVLNode **left, AVLNode **right) {
+  if (!root) {
+    *left = *right = NULL;
+    return;
+  }
+  AVLNode *l = root->left;
+  AVLNode *r = root->right;
+  if (l) {
+    l->parent = NULL;
+  }
+  if (r) {
+    r->parent = NULL;
+  }
+  AVLNode *sub = NULL;
+  if (rank <= (int64_t)avl_size(l)) {
+    avl_split(l, rank, left, &sub);
+    *right = avl_join(sub, root, r);
+  } else {
+    avl_split(r, rank - (int64_t)avl_size(l) - 1, &sub, right);
+    *left = avl_join(l, root, sub);
+  }
+}
+
+static AVLNode * build(AVLNode **nodes, size_t n, AVLNode *parent) {
+  if (n == 0) {
+    return NULL;
+  }
+  // the subtrees differ in size by at most 1, so do their heights
+  size_t mid = n / 2;
+  AVLNode *node = nodes[mid];
+  node->parent = parent;
+  node->left = build(nodes, mid, node);
+  node->right = build(nodes + mid + 1, n - mid - 1, node);
+  avl_update(node);
+  return node;
+}
+
+AVLNode * avl_build(AVLNode **nodes, size_t n) {
+  return build(nodes, n, NULL);
+}
+
+void avl_moved(AVLNode *node, AVLNode const *old, AVLNode **root) {
+  if (AVLNode *parent = node->parent) {
+    (parent->left == old ? parent->left : parent->right) = node;
+  } else {
+    *root = node;
+  }
+  if (node->left) {
+    node->left->parent = node;
+  }
+  if (node->right) {
+    node->right->parent = node;
+  }
+}
+
+void avl_set_val(AVLNode *node, double val) {
+  node->val = val;
+  for (; node; node = node->parent) {
+    avl_update(node);
+  }
+}
+
+// a subtree is either fully covered or split, only O(log N) nodes are visited
+double avl_range_sum(AVLNode *node, int64_t start, int64_t stop) {
+  if (!node || start >= stop) {
+    return 0;
+  }
+  int64_t size = (int64_t)avl_size(node);
+  if (start <= 0 && stop >= size) {
+    return node->sum;
+  }
+  int64_t lsize = (int64_t)avl_size(node->left);
+  double sum = avl_range_sum(node->left, start, stop < lsize ? stop : lsize);
+  if (start <= lsize && lsize < stop) {
+    sum += node->val;
+  }
+  int64_t rstart = start - lsize - 1;
+  return sum + avl_range_sum(node->right, rstart < 0 ? 0 : rstart, stop - lsize - 1);
+}
@@ -0,0 +1,456 @@
+#include "byoredis/ds/btree.hh"
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+
+uint32_t const k_bt_min = k_bt_order / 2;  // min fill of a non-root node
+
+// (score1, item) < (score2, key)
+static inline bool entry_less(double score1, void const *item, double score2,
+                              void const *key, BtLess less) {
+  if (score1 != score2) {
+    return score1 < score2;
+  }
+  return less(item, key);
+}
+
+// the first index whose entry is not < (score, key)
+static uint32_t node_lower_bound(BNode const *node, uint32_t lo, double score,
+                                 void const *key, BtLess less) {
+  uint32_t hi = node->n;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (entry_less(node->scores[mid], node->items[mid], score, key, less)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// the child that may hold the first item >= (score, key):
+// the last child whose smallest item is < (score, key), or the first child
+static inline uint32_t inner_pick(BInner const *node, double score, void const *key, BtLess less) {
+  return node_lower_bound(node, 1, score, key, less) - 1;
+}
+
+static size_t node_size(BNode const *node) {
+  if (node->leaf) {
+    return node->n;
+  }
+  BInner const *in = (BInner const *)node;
+  size_t total = 0;
+  for (uint32_t i = 0; i < in->n; i++) {
+    total += in->counts[i];
+  }
+  return total;
+}
+
+// copy the smallest item of a child into its parent
+static inline void refresh(BInner *in, uint32_t i) {
+  in->scores[i] = in->kids[i]->scores[0];
+  in->items[i]  = in->kids[i]->items[0];
+}
+
+// make room at `pos` for `cnt` entries
+static void node_shift(BNode *node, uint32_t pos, uint32_t cnt) {
+  uint32_t tail = node->n - pos;
+  memmove(&node->scores[pos + cnt], &node->scores[pos], tail * sizeof(double));
+  memmove(&node->items[pos + cnt],  &node->items[pos],  tail * sizeof(void *));
+  if (!node->leaf) {
+    BInner *in = (BInner *)node;
+    memmove(&in->kids[pos + cnt],   &in->kids[pos],   tail * sizeof(BNode *));
+    memmove(&in->counts[pos + cnt], &in->counts[pos], tail * sizeof(size_t));
+  }
+  node->n += cnt;
+}
+
+// remove `cnt` entries at `pos`
+static void node_erase(BNode *node, uint32_t pos, uint32_t cnt) {
+  uint32_t tail = node->n - pos - cnt;
+  memmove(&node->scores[pos], &node->scores[pos + cnt], tail * sizeof(double));
+  memmove(&node->items[pos],  &node->items[pos + cnt],  tail * sizeof(void *));
+  if (!node->leaf) {
+    BInner *in = (BInner *)node;
+    memmove(&in->kids[pos],   &in->kids[pos + cnt],   tail * sizeof(BNode *));
+    memmove(&in->counts[pos], &in->counts[pos + cnt], tail * sizeof(size_t));
+  }
+  node->n -= cnt;
+}
+
+// copy `cnt` entries from src[spos] into dst[dpos], the room must exist
+static void node_copy(BNode *dst, uint32_t dpos, BNode const *src, uint32_t spos, uint32_t cnt) {
+  memcpy(&dst->scores[dpos], &src->scores[spos], cnt * sizeof(double));
+  memcpy(&dst->items[dpos],  &src->items[spos],  cnt * sizeof(void *));
+  if (!src->leaf) {
+    BInner *d = (BInner *)dst;
+    BInner const *s = (BInner const *)src;
+    memcpy(&d->kids[dpos],   &s->kids[spos],   cnt * sizeof(BNode *));
+    memcpy(&d->counts[dpos], &s->counts[spos], cnt * sizeof(size_t));
+  }
+}
+
+// move the upper half of a full node into a new right sibling
+static BNode * node_split(BNode *node) {
+  BNode *right = NULL;
+  if (node->leaf) {
+    BLeaf *l = (BLeaf *)node;
+    BLeaf *r = new BLeaf();
+    r->prev = l;
+    r->next = l->next;
+    if (l->next) {
+      l->next->prev = r;
+    }
+    l->next = r;
+    right = r;
+  } else {
+    BInner *r = new BInner();
+    r->leaf = false;
+    right = r;
+  }
+  uint32_t half = node->n / 2;
+  node_copy(right, 0, node, half, node->n - half);
+  right->n = node->n - half;
+  node->n = half;
+  return right;
+}
+
+static void inner_insert_child(BInner *in, uint32_t pos, BNode *child) {
+  node_shift(in, pos, 1);
+  in->kids[pos] = child;
+  in->counts[pos] = node_size(child);
+  refresh(in, pos);
+}
+
+// returns the new right sibling if the node was split
+static BNode * node_insert(BNode *node, double score, void *item, void const *key, BtLess less) {
+  if (node->leaf) {
+    uint32_t pos = node_lower_bound(node, 0, score, key, less);
+    BNode *right = NULL;
+    if (node->n == k_bt_order) {
+      right = node_split(node);
+      if (pos > node->n) {
+        pos -= node->n;
+        node = right;
+      }
+    }
+    node_shift(node, pos, 1);
+    node->scores[pos] = score;
+    node->items[pos] = item;
+    return right;
+  }
+  BInner *in = (BInner *)node;
+  uint32_t i = inner_pick(in, score, key, less);
+  BNode *split = node_insert(in->kids[i], score, item, key, less);
+  refresh(in, i);
+  if (!split) {
+    in->counts[i]++;
+    return NULL;
+  }
+  in->counts[i] = node_size(in->kids[i]);
+  BNode *right = NULL;
+  uint32_t pos = i + 1;
+  if (in->n == k_bt_order) {
+    right = node_split(in);
+    if (pos > in->n) {
+      pos -= in->n;
+      in = (BInner *)right;
+    }
+  }
+  inner_insert_child(in, pos, split);
+  return right;
+}
+
+void bt_insert(BTree *tree, double score, void *item, void const *key, BtLess less) {
+  if (!tree->root) {
+    tree->root = new BLeaf();
+  }
+  if (BNode *split = node_insert(tree->root, score, item, key, less)) {
+    // grow a level
+    BInner *root = new BInner();
+    root->leaf = false;
+    root->n = 2;
+    root->kids[0] = tree->root;
+    root->kids[1] = split;
+    root->counts[0] = node_size(tree->root);
+    root->counts[1] = node_size(split);
+    refresh(root, 0);
+    refresh(root, 1);
+    tree->root = root;
+  }
+  tree->size++;
+}
+
+static void node_free(BNode *node) {
+  if (node->leaf) {
+    BLeaf *l = (BLeaf *)node;
+    if (l->prev) {
+      l->prev->next = l->next;
+    }
+    if (l->next) {
+      l->next->prev = l->prev;
+    }
+    delete l;
+  } else {
+    delete (BInner *)node;
+  }
+}
+
+// the child i is underfull, merge it with a sibling or borrow from it
+static void fix_underflow(BInner *in, uint32_t i) {
+  if (in->n < 2) {
+    return;  // the root, collapsed by the caller
+  }
+  uint32_t j = (i > 0) ? i - 1 : i;  // the pair (j, j + 1)
+  BNode *a = in->kids[j];
+  BNode *b = in->kids[j + 1];
+  uint32_t total = a->n + b->n;
+  if (total <= k_bt_order) {
+    node_copy(a, a->n, b, 0, b->n);
+    a->n = total;
+    b->n = 0;
+    node_free(b);
+    node_erase(in, j + 1, 1);
+    in->counts[j] = node_size(a);
+    refresh(in, j);
+    return;
+  }
+  // redistribute evenly
+  uint32_t want = total / 2;
+  if (a->n > want) {
+    uint32_t cnt = a->n - want;
+    node_shift(b, 0, cnt);
+    node_copy(b, 0, a, want, cnt);
+    a->n = want;
+  } else {
+    uint32_t cnt = want - a->n;
+    node_copy(a, a->n, b, 0, cnt);
+    a->n = want;
+    node_erase(b, 0, cnt);
+  }
+  in->counts[j] = node_size(a);
+  in->counts[j + 1] = node_size(b);
+  refresh(in, j);
+  refresh(in, j + 1);
+}
+
+static void node_delete(BNode *node, double score, void *item, void const *key, BtLess less) {
+  if (node->leaf) {
+    uint32_t pos = node_lower_bound(node, 0, score, key, less);
+    assert(pos < node->n && node->items[pos] == item);
+    node_erase(node, pos, 1);
+    return;
+  }
+  BInner *in = (BInner *)node;
+  uint32_t i = inner_pick(in, score, key, less);
+  if (i + 1 < in->n && in->items[i + 1] == item) {
+    i++;  // the smallest item of the next child
+  }
+  node_delete(in->kids[i], score, item, key, less);
+  in->counts[i]--;
+  if (in->kids[i]->n < k_bt_min) {
+    fix_underflow(in, i);
+  } else {
+    refresh(in, i);
+  }
+}
+
+void bt_delete(BTree *tree, double score, void *item, void const *key, BtLess less) {
+  assert(tree->root);
+  node_delete(tree->root, score, item, key, less);
+  tree->size--;
+  // shrink a level
+  BNode *root = tree->root;
+  if (!root->leaf && root->n == 1) {
+    tree->root = ((BInner *)root)->kids[0];
+    node_free(root);
+  } else if (root->leaf && root->n == 0) {
+    node_free(root);
+    tree->root = NULL;
+  }
+}
+
+void bt_replace(BTree *tree, double score, void *item, void const *key, BtLess less, void *by) {
+  BNode *node = tree->root;
+  assert(node);
+  while (!node->leaf) {
+    BInner *in = (BInner *)node;
+    uint32_t i = inner_pick(in, score, key, less);
+    if (i + 1 < in->n && in->items[i + 1] == item) {
+      i++;  // the smallest item of the next child
+    }
+    if (in->items[i] == item) {
+      in->items[i] = by;
+    }
+    node = in->kids[i];
+  }
+  uint32_t pos = node_lower_bound(node, 0, score, key, less);
+  assert(pos < node->n && node->items[pos] == item);
+  node->items[pos] = by;
+}
+
+BPos bt_seekge(BTree *tree, double score, void const *key, BtLess less, int64_t *rank) {
+  BPos pos;
+  int64_t r = 0;
+  BNode *node = tree->root;
+  if (!node) {
+    *rank = 0;
+    return pos;
+  }
+  while (!node->leaf) {
+    BInner *in = (BInner *)node;
+    uint32_t i = inner_pick(in, score, key, less);
+    for (uint32_t k = 0; k < i; k++) {
+      r += (int64_t)in->counts[k];
+    }
+    node = in->kids[i];
+  }
+  pos.leaf = (BLeaf *)node;
+  pos.idx = node_lower_bound(node, 0, score, key, less);
+  r += pos.idx;
+  if (pos.idx == node->n) {
+    // all smaller, the answer is the first item of the next leaf
+    pos.leaf = pos.leaf->next;
+    pos.idx = 0;
+  }
+  *rank = r;
+  return pos;
+}
+
+BPos bt_at(BTree *tree, int64_t rank) {
+  BPos pos;
+  if (rank < 0 || (size_t)rank >= tree->size) {
+    return pos;
+  }
+  size_t r = (size_t)rank;
+  BNode *node = tree->root;
+  while (!node->leaf) {
+    BInner *in = (BInner *)node;
+    uint32_t i = 0;
+    while (r >= in->counts[i]) {
+      r -= in->counts[i];
+      i++;
+    }
+    node = in->kids[i];
+  }
+  pos.leaf = (BLeaf *)node;
+  pos.idx = (uint32_t)r;
+  return pos;
+}
+
+static void node_dispose(BNode *node, void (*free_item)(void *item)) {
+  if (node->leaf) {
+    for (uint32_t i = 0; free_item && i < node->n; i++) {
+      free_item(node->items[i]);
+    }
+    delete (BLeaf *)node;
+    return;
+  }
+  BInner *in = (BInner *)node;
+  for (uint32_t i = 0; i < in->n; i++) {
+    node_dispose(in->kids[i], free_item);
+  }
+  delete in;
+}
+
+void bt_clear(BTree *tree, void (*free_item)(void *item)) {
+  if (tree->root) {
+    node_dispose(tree->root, free_item);
+  }
+  *tree = BTree{};
+}
+
+// remove the items at the ranks [lo, hi) of the subtree. The children in
+// the range are freed whole without unlinking their leaves, the others may
+// be left underfull but not empty.
+static void node_remove_range(BNode *node, size_t lo, size_t hi) {
+  if (node->leaf) {
+    node_erase(node, (uint32_t)lo, (uint32_t)(hi - lo));
+    return;
+  }
+  BInner *in = (BInner *)node;
+  uint32_t first = in->n, cnt = 0;  // the children removed whole
+  size_t off = 0;
+  for (uint32_t i = 0; i < in->n && off < hi; i++) {
+    size_t size = in->counts[i];
+    if (off + size > lo) {
+      size_t a = std::max(lo, off) - off;
+      size_t b = std::min(hi, off + size) - off;
+      if (a == 0 && b == size) {
+        node_dispose(in->kids[i], NULL);
+        first = std::min(first, i);
+        cnt++;
+      } else {
+        node_remove_range(in->kids[i], a, b);
+        in->counts[i] -= b - a;
+        refresh(in, i);
+      }
+    }
+    off += size;
+  }
+  if (cnt > 0) {
+    node_erase(in, first, cnt);
+  }
+}
+
+// After a range removal, only the nodes on the paths to the items at
+// `rank` - 1 and `rank` can be underfull. They are fixed top-down, again
+// from the root after each change, so a node is merged or borrowed from
+// only once its parent has enough children for it.
+static void seam_fix(BTree *tree, size_t rank) {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    // shrink levels
+    while (!tree->root->leaf && tree->root->n == 1) {
+      BNode *root = tree->root;
+      tree->root = ((BInner *)root)->kids[0];
+      node_free(root);
+    }
+    for (size_t side = 0; side < 2 && !changed; side++) {
+      size_t r = rank - 1 + side;  // wraps around for the rank -1
+      if (r >= tree->size) {
+        continue;
+      }
+      BNode *node = tree->root;
+      while (!node->leaf) {
+        BInner *in = (BInner *)node;
+        uint32_t i = 0;
+        while (r >= in->counts[i]) {
+          r -= in->counts[i];
+          i++;
+        }
+        if (in->kids[i]->n < k_bt_min) {
+          fix_underflow(in, i);
+          changed = true;
+          break;
+        }
+        node = in->kids[i];
+      }
+    }
+  }
+}
+
+void bt_remove_range(BTree *tree, int64_t start, int64_t stop) {
+  assert(0 <= start && start < stop && (size_t)stop <= tree->size);
+  if (start == 0 && (size_t)stop == tree->size) {
+    return bt_clear(tree, NULL);
+  }
+  // the leaves around the range are linked once the ones inside are gone
+  BPos first = bt_at(tree, start);
+  BPos last = bt_at(tree, stop - 1);
+  BLeaf *left = first.idx > 0 ? first.leaf : first.leaf->prev;
+  BLeaf *right = last.idx + 1 < last.leaf->n ? last.leaf : last.leaf->next;
+  node_remove_range(tree->root, (size_t)start, (size_t)stop);
+  tree->size -= (size_t)(stop - start);
+  if (left != right) {
+    if (left) {
+      left->next = right;
+    }
+    if (right) {
+      right->prev = left;
+    }
+  }
+  seam_fix(tree, (size_t)start);
+}
@@ -1,6 +1,7 @@
 #include <stdlib.h>  // calloc(), free()
 #include "byoredis/ds/hashtable.hh"
 #include <assert.h>
+#include <utility>
 
 size_t const k_max_load_factor = 8;
 size_t const k_rehashing_work = 128;  // how many keys to migrate in one rehashing step
@@ -91,6 +92,25 @@ HNode * hm_lookup(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *)) {
   return from ? *from : NULL;
 }
 
+void hm_prefetch(HMap *hmap, uint64_t hcode) {
+  // the older table too, during a rehash the key may be in either
+  for (HTab *htab : {&hmap->newer, &hmap->older}) {
+    if (htab->tab) {
+      __builtin_prefetch(&htab->tab[hcode & htab->mask]);
+    }
+  }
+}
+
+void hm_prefetch_chain(HMap *hmap, uint64_t hcode) {
+  for (HTab *htab : {&hmap->newer, &hmap->older}) {
+    if (htab->tab) {
+      if (HNode *node = htab->tab[hcode & htab->mask]) {
+        __builtin_prefetch(node);
+      }
+    }
+  }
+}
+
 HNode * hm_delete(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *)) {
   hm_help_rehashing(hmap);
   if (HNode **from = h_lookup(&hmap->newer, key, eq)) {
@@ -124,6 +144,14 @@ void hm_clear(HMap *hmap) {
   *hmap = HMap{};
 }
 
+void hm_reserve(HMap *hmap, size_t n) {
+  if (hmap->newer.size + hmap->older.size > 0) {
+    return;  // only for an empty map
+  }
+  hm_clear(hmap);
+  h_init(&hmap->newer, n < 4 ? 4 : n);  // load factor <= 1
+}
+
 size_t hm_size(HMap *hmap) {
   return hmap->newer.size + hmap->older.size;
 }
@@ -142,3 +170,48 @@ static bool h_foreach(HTab *htab, bool (*cb)(HNode *, void *), void *arg) {
 void hm_foreach(HMap *hmap, bool (*cb)(HNode *, void *), void *arg) {
   h_foreach(&hmap->newer, cb, arg) && h_foreach(&hmap->older, cb, arg);
 }
+
+static void h_scan(HTab *htab, size_t pos, void (*cb)(HNode *, void *), void *arg) {
+  for (HNode *node = htab->tab[pos]; node != NULL; node = node->next) {
+    cb(node, arg);
+  }
+}
+
+static void h_defrag(HTab *htab, size_t pos, HNode *(*move)(HNode *, void *), void *arg) {
+  for (HNode **from = &htab->tab[pos]; *from != NULL; from = &(*from)->next) {
+    *from = move(*from, arg);
+  }
+}
+
+// visit the buckets of the cursor in both tables, returns the next cursor
+template <class F>
+static uint64_t h_visit(HMap *hmap, uint64_t cursor, F const &visit) {
+  HTab *small = &hmap->newer;
+  HTab *large = &hmap->older;
+  if (!small->tab) {
+    return 0;
+  }
+  if (!large->tab) {
+    visit(small, cursor & small->mask);
+    return scan_next(cursor, small->mask);
+  }
+  // rehashing: the bucket of the smaller table, then the buckets of the
+  // larger table it expands to
+  if (small->mask > large->mask) {
+    std::swap(small, large);
+  }
+  visit(small, cursor & small->mask);
+  do {
+    visit(large, cursor & large->mask);
+    cursor = scan_next(cursor, large->mask);
+  } while (cursor & (small->mask ^ large->mask));
+  return cursor;
+}
+
+uint64_t hm_scan(HMap *hmap, uint64_t cursor, void (*cb)(HNode *, void *), void *arg) {
+  return h_visit(hmap, cursor, [&](HTab *htab, size_t pos) { h_scan(htab, pos, cb, arg); });
+}
+
+uint64_t hm_defrag(HMap *hmap, uint64_t cursor, HNode *(*move)(HNode *, void *), void *arg) {
+  return h_visit(hmap, cursor, [&](HTab *htab, size_t pos) { h_defrag(htab, pos, move, arg); });
+}
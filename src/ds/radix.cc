@@ -0,0 +1,332 @@
+#include "byoredis/ds/radix.hh"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+static RNode ** rn_kids(RNode *node) {
+  return (RNode **)node->data;
+}
+
+static uint8_t * rn_bytes(RNode *node) {
+  return node->data + sizeof(RNode *) * node->nkids;
+}
+
+static uint8_t * rn_label(RNode *node) {
+  return rn_bytes(node) + node->nkids;
+}
+
+static size_t rn_size(uint32_t nkids, uint32_t len) {
+  return sizeof(RNode) + (sizeof(RNode *) + 1) * nkids + len;
+}
+
+static RNode * rn_alloc(RTree *tree, uint32_t nkids, uint32_t len) {
+  size_t size = rn_size(nkids, len);
+  RNode *node = (RNode *)malloc(size);
+  assert(node);
+  node->val = NULL;
+  node->len = len;
+  node->nkids = nkids;
+  tree->nodes++;
+  tree->bytes += size;
+  return node;
+}
+
+static void rn_free(RTree *tree, RNode *node) {
+  tree->nodes--;
+  tree->bytes -= rn_size(node->nkids, node->len);
+  free(node);
+}
+
+static RNode * rn_leaf(RTree *tree, uint8_t const *label, size_t len, void *val) {
+  RNode *node = rn_alloc(tree, 0, (uint32_t)len);
+  node->val = val;
+  memcpy(rn_label(node), label, len);
+  return node;
+}
+
+// the index of the kid starting with `c`, or where to insert it
+static uint32_t rn_find(RNode *node, uint8_t c) {
+  uint8_t const *bytes = rn_bytes(node);
+  uint32_t lo = 0, hi = node->nkids;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (bytes[mid] < c) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// a copy with a kid inserted at `idx` or removed from it, frees the node
+static RNode * rn_resize(RTree *tree, RNode *node, uint32_t idx, RNode *kid) {
+  uint32_t nkids = kid ? node->nkids + 1 : node->nkids - 1;
+  RNode *copy = rn_alloc(tree, nkids, node->len);
+  copy->val = node->val;
+  RNode **kids = rn_kids(node);
+  uint8_t *bytes = rn_bytes(node);
+  uint32_t skip = kid ? 0 : 1;  // the removed kid
+  memcpy(rn_kids(copy), kids, sizeof(RNode *) * idx);
+  memcpy(rn_kids(copy) + idx + !skip, kids + idx + skip, sizeof(RNode *) * (node->nkids - idx - skip));
+  memcpy(rn_bytes(copy), bytes, idx);
+  memcpy(rn_bytes(copy) + idx + !skip, bytes + idx + skip, node->nkids - idx - skip);
+  if (kid) {
+    rn_kids(copy)[idx] = kid;
+    rn_bytes(copy)[idx] = rn_label(kid)[0];
+  }
+  memcpy(rn_label(copy), rn_label(node), node->len);
+  rn_free(tree, node);
+  return copy;
+}
+
+// drop the first `n` bytes of the label
+static RNode * rn_cut(RTree *tree, RNode *node, uint32_t n) {
+  uint8_t *label = rn_label(node);
+  memmove(label, label + n, node->len - n);
+  size_t old_size = rn_size(node->nkids, node->len);
+  node->len -= n;
+  tree->bytes -= old_size - rn_size(node->nkids, node->len);
+  RNode *smaller = (RNode *)realloc(node, rn_size(node->nkids, node->len));
+  return smaller ? smaller : node;
+}
+
+// a node without a value and with a single kid is merged into the kid
+static RNode * rn_merge(RTree *tree, RNode *node) {
+  RNode *kid = rn_kids(node)[0];
+  RNode *merged = rn_alloc(tree, kid->nkids, node->len + kid->len);
+  merged->val = kid->val;
+  memcpy(rn_kids(merged), rn_kids(kid), sizeof(RNode *) * kid->nkids);
+  memcpy(rn_bytes(merged), rn_bytes(kid), kid->nkids);
+  memcpy(rn_label(merged), rn_label(node), node->len);
+  memcpy(rn_label(merged) + node->len, rn_label(kid), kid->len);
+  rn_free(tree, kid);
+  rn_free(tree, node);
+  return merged;
+}
+
+static uint32_t common_prefix(uint8_t const *a, size_t alen, uint8_t const *b, size_t blen) {
+  size_t n = alen < blen ? alen : blen;
+  size_t i = 0;
+  while (i < n && a[i] == b[i]) {
+    i++;
+  }
+  return (uint32_t)i;
+}
+
+void * rt_insert(RTree *tree, uint8_t const *key, size_t len, void *val) {
+  assert(val);
+  RNode **from = &tree->root;
+  size_t pos = 0;
+  while (true) {
+    RNode *node = *from;
+    if (!node) {
+      *from = rn_leaf(tree, key + pos, len - pos, val);
+      tree->size++;
+      return NULL;
+    }
+    uint32_t m = common_prefix(rn_label(node), node->len, key + pos, len - pos);
+    if (m < node->len) {
+      // split the label: a new parent with the common part
+      RNode *parent = rn_leaf(tree, rn_label(node), m, NULL);
+      node = rn_cut(tree, node, m);
+      node = rn_resize(tree, parent, 0, node);
+      *from = node;
+    }
+    pos += m;
+    if (pos == len) {
+      void *old = node->val;
+      node->val = val;
+      tree->size += !old;
+      return old;
+    }
+    uint32_t idx = rn_find(node, key[pos]);
+    if (idx < node->nkids && rn_bytes(node)[idx] == key[pos]) {
+      from = &rn_kids(node)[idx];
+      continue;
+    }
+    RNode *leaf = rn_leaf(tree, key + pos, len - pos, val);
+    *from = rn_resize(tree, node, idx, leaf);
+    tree->size++;
+    return NULL;
+  }
+}
+
+void * rt_delete(RTree *tree, uint8_t const *key, size_t len) {
+  // the slots from the root to the node
+  std::vector<RNode **> path;
+  RNode **from = &tree->root;
+  size_t pos = 0;
+  while (true) {
+    RNode *node = *from;
+    if (!node || node->len > len - pos || memcmp(rn_label(node), key + pos, node->len) != 0) {
+      return NULL;
+    }
+    path.push_back(from);
+    pos += node->len;
+    if (pos == len) {
+      break;
+    }
+    uint32_t idx = rn_find(node, key[pos]);
+    if (idx == node->nkids || rn_bytes(node)[idx] != key[pos]) {
+      return NULL;
+    }
+    from = &rn_kids(node)[idx];
+  }
+  RNode *node = *path.back();
+  void *val = node->val;
+  if (!val) {
+    return NULL;
+  }
+  node->val = NULL;
+  tree->size--;
+  // restore the invariant upwards: remove empty leaves, merge single kids
+  while (!path.empty()) {
+    from = path.back();
+    path.pop_back();
+    node = *from;
+    if (node->val || node->nkids >= 2) {
+      break;
+    }
+    if (node->nkids == 1) {
+      *from = rn_merge(tree, node);
+      break;
+    }
+    // an empty leaf, remove it from the parent
+    rn_free(tree, node);
+    *from = NULL;
+    if (path.empty()) {
+      break;
+    }
+    RNode **pfrom = path.back();
+    RNode *parent = *pfrom;
+    uint32_t idx = (uint32_t)(from - rn_kids(parent));
+    *pfrom = rn_resize(tree, parent, idx, NULL);
+    // the parent may be a valueless node with a single kid now
+  }
+  return val;
+}
+
+void * rt_lookup(RTree *tree, uint8_t const *key, size_t len) {
+  RNode *node = tree->root;
+  size_t pos = 0;
+  while (node) {
+    if (node->len > len - pos || memcmp(rn_label(node), key + pos, node->len) != 0) {
+      return NULL;
+    }
+    pos += node->len;
+    if (pos == len) {
+      return node->val;
+    }
+    uint32_t idx = rn_find(node, key[pos]);
+    if (idx == node->nkids || rn_bytes(node)[idx] != key[pos]) {
+      return NULL;
+    }
+    node = rn_kids(node)[idx];
+  }
+  return NULL;
+}
+
+// a node to visit; `greater` if all the keys under it are after the bound
+struct RWalk {
+  RNode *node;
+  size_t depth;  // the key length before the label
+  bool greater;
+};
+
+// the keys under the prefix, in key order; if `after` is not NULL, only
+// those greater than it
+static void rt_walk(RTree *tree, uint8_t const *prefix, size_t len,
+                    uint8_t const *after, size_t after_len,
+                    bool (*cb)(void *val, void *arg), void *arg) {
+  // find the subtree, the prefix may end inside a label
+  RNode *node = tree->root;
+  size_t pos = 0;
+  while (node) {
+    uint32_t m = common_prefix(rn_label(node), node->len, prefix + pos, len - pos);
+    if (pos + m == len) {
+      break;
+    }
+    if (m < node->len) {
+      return;
+    }
+    pos += m;
+    uint32_t idx = rn_find(node, prefix[pos]);
+    if (idx == node->nkids || rn_bytes(node)[idx] != prefix[pos]) {
+      return;
+    }
+    node = rn_kids(node)[idx];
+  }
+  if (!node) {
+    return;
+  }
+  // the key of the nodes along `after`, the others are not compared
+  std::vector<uint8_t> path(prefix, prefix + pos);
+  // preorder, an explicit stack as the depth is bounded by the key length
+  std::vector<RWalk> stack = {{node, pos, after == NULL}};
+  while (!stack.empty()) {
+    RWalk w = stack.back();
+    stack.pop_back();
+    node = w.node;
+    if (!w.greater) {
+      path.resize(w.depth);
+      path.insert(path.end(), rn_label(node), rn_label(node) + node->len);
+      size_t n = std::min(path.size(), after_len);
+      int cmp = n > 0 ? memcmp(path.data(), after, n) : 0;  // data() may be NULL
+      if (cmp < 0) {
+        continue;  // all before
+      }
+      if (cmp == 0 && path.size() <= after_len) {
+        // a prefix of `after`, this key is not greater but some below may be
+        uint8_t next = path.size() < after_len ? after[path.size()] : 0;
+        for (uint32_t i = node->nkids; i-- > 0;) {
+          uint8_t c = rn_bytes(node)[i];
+          bool all = path.size() == after_len || c > next;
+          if (!all && c < next) {
+            break;
+          }
+          stack.push_back({rn_kids(node)[i], path.size(), all});
+        }
+        continue;
+      }
+    }
+    if (node->val && !cb(node->val, arg)) {
+      return;
+    }
+    for (uint32_t i = node->nkids; i-- > 0;) {
+      stack.push_back({rn_kids(node)[i], 0, true});
+    }
+  }
+}
+
+void rt_prefix(RTree *tree, uint8_t const *prefix, size_t len,
+               bool (*cb)(void *val, void *arg), void *arg) {
+  rt_walk(tree, prefix, len, NULL, 0, cb, arg);
+}
+
+void rt_prefix_after(RTree *tree, uint8_t const *prefix, size_t len,
+                     uint8_t const *after, size_t after_len,
+                     bool (*cb)(void *val, void *arg), void *arg) {
+  static uint8_t const empty = 0;
+  rt_walk(tree, prefix, len, after ? after : &empty, after_len, cb, arg);
+}
+
+void rt_clear(RTree *tree) {
+  std::vector<RNode *> stack;
+  if (tree->root) {
+    stack.push_back(tree->root);
+  }
+  while (!stack.empty()) {
+    RNode *node = stack.back();
+    stack.pop_back();
+    for (uint32_t i = 0; i < node->nkids; i++) {
+      stack.push_back(rn_kids(node)[i]);
+    }
+    rn_free(tree, node);
+  }
+  tree->root = NULL;
+  tree->size = 0;
+  assert(tree->nodes == 0 && tree->bytes == 0);
+}
@@ -0,0 +1,301 @@
+#include <stdlib.h>  // aligned_alloc(), calloc(), free()
+#include <string.h>
+#include <assert.h>
+#include <utility>
+#include "byoredis/ds/swisstable.hh"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+size_t const k_group = 16;            // slots per group
+size_t const k_rehashing_work = 128;  // how many slots to migrate in one rehashing step
+
+int8_t const k_empty   = -128;  // 0b10000000
+int8_t const k_deleted = -2;    // 0b11111110, a tombstone, probing goes on
+// full slots hold a tag in [0, 127]
+
+// the hash values of HMap users only need good low bits, mix them
+// so that both the tag and the group index are usable
+static inline uint64_t s_mix(uint64_t h) {
+  h ^= h >> 32;
+  h *= 0x9E3779B97F4A7C15ull;
+  h ^= h >> 29;
+  return h;
+}
+
+// bitmask of the slots in a group whose control byte is `tag`
+static inline uint32_t g_match(int8_t const *ctrl, int8_t tag) {
+#if defined(__SSE2__)
+  __m128i group = _mm_load_si128((__m128i const *)ctrl);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+#else
+  uint32_t mask = 0;
+  for (size_t i = 0; i < k_group; i++) {
+    mask |= (uint32_t)(ctrl[i] == tag) << i;
+  }
+  return mask;
+#endif
+}
+
+// bitmask of the empty or deleted slots (the sign bit is set)
+static inline uint32_t g_match_free(int8_t const *ctrl) {
+#if defined(__SSE2__)
+  return (uint32_t)_mm_movemask_epi8(_mm_load_si128((__m128i const *)ctrl));
+#else
+  uint32_t mask = 0;
+  for (size_t i = 0; i < k_group; i++) {
+    mask |= (uint32_t)(ctrl[i] < 0) << i;
+  }
+  return mask;
+#endif
+}
+
+static void s_init(STab *stab, size_t n) {
+  assert(n >= k_group && ((n - 1) & n) == 0);
+  stab->ctrl  = (int8_t *)aligned_alloc(k_group, n);
+  stab->slots = (HNode **)calloc(n, sizeof(HNode *));
+  memset(stab->ctrl, k_empty, n);
+  stab->mask  = n - 1;
+  stab->size  = 0;
+  stab->growth_left = n - n / 8;  // max load factor 7/8
+}
+
+static void s_free(STab *stab) {
+  free(stab->ctrl);
+  free(stab->slots);
+  *stab = STab{};
+}
+
+// Groups are probed in triangular steps (+1, +2, +3, ...), which visits
+// every group of a power-of-2 table. The table always has empty slots,
+// so a probe for a missing key ends at the first group with one.
+struct Probe {
+  size_t group;
+  size_t gmask;
+  size_t step = 0;
+
+  Probe(STab const *stab, uint64_t h)
+    : group((size_t)(h >> 7) & (stab->mask / k_group)), gmask(stab->mask / k_group) {}
+  size_t offset() const { return group * k_group; }
+  void next() { group = (group + ++step) & gmask; }
+};
+
+// returns the slot index of the key, or -1
+static size_t s_lookup(STab *stab, HNode *key, bool (*eq)(HNode *, HNode *)) {
+  if (!stab->ctrl) {
+    return (size_t)-1;
+  }
+  uint64_t h = s_mix(key->hcode);
+  int8_t tag = (int8_t)(h & 0x7F);
+  for (Probe p(stab, h);; p.next()) {
+    int8_t const *ctrl = stab->ctrl + p.offset();
+    for (uint32_t m = g_match(ctrl, tag); m != 0; m &= m - 1) {
+      size_t idx = p.offset() + (size_t)__builtin_ctz(m);
+      HNode *cur = stab->slots[idx];
+      if (cur->hcode == key->hcode && eq(cur, key)) {
+        return idx;
+      }
+    }
+    if (g_match(ctrl, k_empty) != 0) {
+      return (size_t)-1;
+    }
+  }
+}
+
+// the key must not exist, takes the first free slot of its probe sequence
+static void s_insert(STab *stab, HNode *node) {
+  uint64_t h = s_mix(node->hcode);
+  for (Probe p(stab, h);; p.next()) {
+    uint32_t m = g_match_free(stab->ctrl + p.offset());
+    if (m != 0) {
+      size_t idx = p.offset() + (size_t)__builtin_ctz(m);
+      if (stab->ctrl[idx] == k_empty) {
+        assert(stab->growth_left > 0);
+        stab->growth_left--;
+      }
+      stab->ctrl[idx]  = (int8_t)(h & 0x7F);
+      stab->slots[idx] = node;
+      stab->size++;
+      return;
+    }
+  }
+}
+
+static HNode * s_detach(STab *stab, size_t idx) {
+  HNode *node = stab->slots[idx];
+  // A group with an empty slot has never been full, so no probe has gone
+  // past it and the slot can be made empty again instead of a tombstone.
+  int8_t const *group = stab->ctrl + (idx & ~(k_group - 1));
+  if (g_match(group, k_empty) != 0) {
+    stab->ctrl[idx] = k_empty;
+    stab->growth_left++;
+  } else {
+    stab->ctrl[idx] = k_deleted;
+  }
+  stab->slots[idx] = NULL;
+  stab->size--;
+  return node;
+}
+
+static void sm_help_rehashing(SMap *smap, size_t nwork) {
+  STab *older = &smap->older;
+  while (nwork > 0 && older->size > 0) {
+    size_t idx = smap->migrate_pos++;
+    assert(idx <= older->mask);
+    if (older->ctrl[idx] >= 0) {
+      s_insert(&smap->newer, s_detach(older, idx));
+    }
+    nwork--;
+  }
+  // discard the old table if done
+  if (older->ctrl && older->size == 0) {
+    s_free(older);
+  }
+}
+
+static void sm_trigger_rehashing(SMap *smap) {
+  // A migration scans the whole old table in (slots / k_rehashing_work)
+  // operations, the new table is at least as large and can't fill up before.
+  assert(!smap->older.ctrl);
+  size_t cap = smap->newer.mask + 1;
+  // mostly tombstones: rehash in place to clean them up
+  size_t new_cap = smap->newer.size * 2 < cap ? cap : cap * 2;
+  smap->older = smap->newer;
+  s_init(&smap->newer, new_cap);
+  smap->migrate_pos = 0;
+}
+
+HNode * sm_lookup(SMap *smap, HNode *key, bool (*eq)(HNode *, HNode *)) {
+  sm_help_rehashing(smap, k_rehashing_work);
+  size_t idx = s_lookup(&smap->newer, key, eq);
+  if (idx != (size_t)-1) {
+    return smap->newer.slots[idx];
+  }
+  idx = s_lookup(&smap->older, key, eq);
+  return idx != (size_t)-1 ? smap->older.slots[idx] : NULL;
+}
+
+void sm_prefetch(SMap *smap, uint64_t hcode) {
+  uint64_t h = s_mix(hcode);
+  for (STab *stab : {&smap->newer, &smap->older}) {
+    if (stab->ctrl) {
+      size_t off = Probe(stab, h).offset();
+      __builtin_prefetch(stab->ctrl + off);
+      __builtin_prefetch(stab->slots + off);
+      __builtin_prefetch(stab->slots + off + k_group / 2);  // the 2nd cache line
+    }
+  }
+}
+
+void sm_prefetch_chain(SMap *smap, uint64_t hcode) {
+  uint64_t h = s_mix(hcode);
+  int8_t tag = (int8_t)(h & 0x7F);
+  for (STab *stab : {&smap->newer, &smap->older}) {
+    if (stab->ctrl) {
+      size_t off = Probe(stab, h).offset();
+      for (uint32_t m = g_match(stab->ctrl + off, tag); m != 0; m &= m - 1) {
+        __builtin_prefetch(stab->slots[off + (size_t)__builtin_ctz(m)]);
+      }
+    }
+  }
+}
+
+HNode * sm_delete(SMap *smap, HNode *key, bool (*eq)(HNode *, HNode *)) {
+  sm_help_rehashing(smap, k_rehashing_work);
+  size_t idx = s_lookup(&smap->newer, key, eq);
+  if (idx != (size_t)-1) {
+    return s_detach(&smap->newer, idx);
+  }
+  idx = s_lookup(&smap->older, key, eq);
+  if (idx != (size_t)-1) {
+    return s_detach(&smap->older, idx);
+  }
+  return NULL;
+}
+
+// insertion always goes to the newer table
+void sm_insert(SMap *smap, HNode *node) {
+  if (!smap->newer.ctrl) {
+    s_init(&smap->newer, k_group);
+  }
+  if (smap->newer.growth_left == 0) {
+    sm_trigger_rehashing(smap);
+  }
+  s_insert(&smap->newer, node);
+  sm_help_rehashing(smap, k_rehashing_work);
+}
+
+void sm_clear(SMap *smap) {
+  s_free(&smap->newer);
+  s_free(&smap->older);
+  *smap = SMap{};
+}
+
+size_t sm_size(SMap *smap) {
+  return smap->newer.size + smap->older.size;
+}
+
+static bool s_foreach(STab *stab, bool (*cb)(HNode *, void *), void *arg) {
+  for (size_t i = 0; stab->ctrl && i <= stab->mask; i++) {
+    if (stab->ctrl[i] >= 0 && !cb(stab->slots[i], arg)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void sm_foreach(SMap *smap, bool (*cb)(HNode *, void *), void *arg) {
+  s_foreach(&smap->newer, cb, arg) && s_foreach(&smap->older, cb, arg);
+}
+
+// the slots of the keys whose probe sequence starts at group `g`
+template <class F>
+static void s_visit(STab *stab, size_t g, F const &visit) {
+  size_t gmask = stab->mask / k_group;
+  for (Probe p(stab, (uint64_t)g << 7);; p.next()) {
+    int8_t const *ctrl = stab->ctrl + p.offset();
+    for (size_t i = 0; i < k_group; i++) {
+      HNode **slot = &stab->slots[p.offset() + i];
+      if (ctrl[i] >= 0 && ((s_mix((*slot)->hcode) >> 7) & gmask) == g) {
+        visit(slot);
+      }
+    }
+    if (g_match(ctrl, k_empty) != 0) {
+      return;
+    }
+  }
+}
+
+// visit the groups of the cursor in both tables, returns the next cursor
+template <class F>
+static uint64_t s_visit_map(SMap *smap, uint64_t cursor, F const &visit) {
+  STab *small = &smap->newer;
+  STab *large = &smap->older;
+  if (!small->ctrl) {
+    return 0;
+  }
+  if (!large->ctrl) {
+    size_t gmask = small->mask / k_group;
+    s_visit(small, cursor & gmask, visit);
+    return scan_next(cursor, gmask);
+  }
+  if (small->mask > large->mask) {
+    std::swap(small, large);
+  }
+  size_t m0 = small->mask / k_group;
+  size_t m1 = large->mask / k_group;
+  s_visit(small, cursor & m0, visit);
+  do {
+    s_visit(large, cursor & m1, visit);
+    cursor = scan_next(cursor, m1);
+  } while (cursor & (m0 ^ m1));
+  return cursor;
+}
+
+uint64_t sm_scan(SMap *smap, uint64_t cursor, void (*cb)(HNode *, void *), void *arg) {
+  return s_visit_map(smap, cursor, [&](HNode **slot) { cb(*slot, arg); });
+}
+
+uint64_t sm_defrag(SMap *smap, uint64_t cursor, HNode *(*move)(HNode *, void *), void *arg) {
+  return s_visit_map(smap, cursor, [&](HNode **slot) { *slot = move(*slot, arg); });
+}
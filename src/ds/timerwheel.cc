@@ -0,0 +1,147 @@
+#include "byoredis/ds/timerwheel.hh"
+#include "byoredis/ds/intrusive.hh"  // for container_of
+#include <assert.h>
+
+uint64_t const k_tw_mask = k_tw_slots - 1;
+
+void tw_init(TimerWheel *tw, uint64_t now_ms) {
+  tw->cur = now_ms;
+  tw->size = 0;
+  for (uint32_t l = 0; l < k_tw_levels; l++) {
+    for (uint32_t i = 0; i < k_tw_slots; i++) {
+      dlist_init(&tw->slots[l][i]);
+    }
+    tw->bits[l] = 0;
+  }
+  dlist_init(&tw->overflow);
+}
+
+// The slot is a function of the expiration time and the current tick:
+// the current tick only moves past a slot once it is empty, and the slots
+// ahead keep the same highest differing digit until they are cascaded.
+static DList *tw_slot(TimerWheel *tw, uint64_t expire_at, uint32_t *level, uint32_t *idx) {
+  if (expire_at <= tw->cur) {
+    // overdue, fire at the current tick
+    *level = 0;
+    *idx = tw->cur & k_tw_mask;
+  } else {
+    uint32_t hi = 63 - __builtin_clzll(expire_at ^ tw->cur);
+    *level = hi / k_tw_bits;
+    if (*level >= k_tw_levels) {
+      return &tw->overflow;
+    }
+    *idx = (expire_at >> (*level * k_tw_bits)) & k_tw_mask;
+  }
+  return &tw->slots[*level][*idx];
+}
+
+static void tw_place(TimerWheel *tw, TWNode *node) {
+  uint32_t level = 0, idx = 0;
+  DList *head = tw_slot(tw, node->expire_at, &level, &idx);
+  dlist_insert_before(head, &node->link);
+  if (head != &tw->overflow) {
+    tw->bits[level] |= (uint64_t)1 << idx;
+  }
+}
+
+void tw_add(TimerWheel *tw, TWNode *node, uint64_t expire_at) {
+  tw_del(tw, node);
+  node->expire_at = expire_at;
+  tw_place(tw, node);
+  tw->size++;
+}
+
+void tw_del(TimerWheel *tw, TWNode *node) {
+  if (!tw_active(node)) {
+    return;
+  }
+  uint32_t level = 0, idx = 0;
+  DList *head = tw_slot(tw, node->expire_at, &level, &idx);
+  dlist_detach(&node->link);
+  node->link.prev = node->link.next = NULL;
+  if (head != &tw->overflow && dlist_empty(head)) {
+    tw->bits[level] &= ~((uint64_t)1 << idx);
+  }
+  tw->size--;
+}
+
+void tw_moved(TWNode *node) {
+  if (tw_active(node)) {
+    node->link.prev->next = &node->link;
+    node->link.next->prev = &node->link;
+  }
+}
+
+// move the timers of a slot to the lower levels
+static void tw_cascade(TimerWheel *tw, DList *head) {
+  if (dlist_empty(head)) {
+    return;
+  }
+  // detach the whole list first, the overflow list may take some back
+  DList list;
+  list.next = head->next;
+  list.prev = head->prev;
+  list.next->prev = &list;
+  list.prev->next = &list;
+  dlist_init(head);
+  while (!dlist_empty(&list)) {
+    TWNode *node = container_of(list.next, TWNode, link);
+    dlist_detach(&node->link);
+    tw_place(tw, node);
+  }
+}
+
+// jump to a tick; the slots skipped over must be empty
+static void tw_advance(TimerWheel *tw, uint64_t tick) {
+  tw->cur = tick;
+  if (tick & k_tw_mask) {
+    return;
+  }
+  for (uint32_t l = 1; l < k_tw_levels; l++) {
+    uint32_t idx = (tick >> (l * k_tw_bits)) & k_tw_mask;
+    tw->bits[l] &= ~((uint64_t)1 << idx);
+    tw_cascade(tw, &tw->slots[l][idx]);
+    if (idx) {
+      return;
+    }
+  }
+  tw_cascade(tw, &tw->overflow);
+}
+
+uint64_t tw_next(TimerWheel *tw) {
+  for (uint32_t l = 0; l < k_tw_levels; l++) {
+    uint32_t shift = l * k_tw_bits;
+    uint32_t digit = (tw->cur >> shift) & k_tw_mask;
+    // level 0 includes the current slot, the others are cascaded on arrival
+    uint32_t from = l ? digit + 1 : digit;
+    uint64_t ahead = from < k_tw_slots ? tw->bits[l] & (~(uint64_t)0 << from) : 0;
+    if (ahead) {
+      uint64_t base = tw->cur & ~(((uint64_t)1 << (shift + k_tw_bits)) - 1);
+      return base + ((uint64_t)__builtin_ctzll(ahead) << shift);
+    }
+  }
+  if (!dlist_empty(&tw->overflow)) {
+    uint64_t span = (uint64_t)1 << (k_tw_levels * k_tw_bits);
+    return (tw->cur | (span - 1)) + 1;
+  }
+  return -1;
+}
+
+TWNode *tw_pop(TimerWheel *tw, uint64_t now_ms) {
+  while (tw->cur <= now_ms) {
+    DList *head = &tw->slots[0][tw->cur & k_tw_mask];
+    if (!dlist_empty(head)) {
+      TWNode *node = container_of(head->next, TWNode, link);
+      tw_del(tw, node);
+      return node;
+    }
+    if (tw->cur == now_ms) {
+      break;  // stays here for the timers added late
+    }
+    // skip the empty slots, up to the next one to fire or cascade
+    uint64_t next = tw_next(tw);
+    assert(next > tw->cur);
+    tw_advance(tw, next < now_ms ? next : now_ms);
+  }
+  return NULL;
+}
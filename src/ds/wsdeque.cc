@@ -0,0 +1,128 @@
+#include "byoredis/ds/wsdeque.hh"
+
+// "Correct and Efficient Work-Stealing for Weak Memory Models", Lê et al.
+// The slots are atomic since a thief may read one while the owner
+// overwrites it after a wrap around; the thief then loses the CAS on `top`.
+struct WSSlot {
+  std::atomic<void (*)(void *)> task{NULL};
+  std::atomic<void *> arg{NULL};
+};
+
+struct WSArray {
+  int64_t mask = 0;
+  WSSlot *slots = NULL;
+};
+
+static WSArray *wsa_new(size_t cap) {
+  WSArray *a = new WSArray();
+  a->mask = (int64_t)cap - 1;
+  a->slots = new WSSlot[cap];
+  return a;
+}
+
+static void wsa_del(WSArray *a) {
+  delete[] a->slots;
+  delete a;
+}
+
+static void wsa_put(WSArray *a, int64_t i, Work w) {
+  WSSlot &s = a->slots[i & a->mask];
+  s.task.store(w.task, std::memory_order_relaxed);
+  s.arg.store(w.arg, std::memory_order_relaxed);
+}
+
+static Work wsa_get(WSArray *a, int64_t i) {
+  WSSlot &s = a->slots[i & a->mask];
+  return Work{s.task.load(std::memory_order_relaxed), s.arg.load(std::memory_order_relaxed)};
+}
+
+void wsd_init(WSDeque *dq, size_t cap) {
+  size_t n = 2;
+  while (n < cap) {
+    n *= 2;
+  }
+  dq->top.store(0, std::memory_order_relaxed);
+  dq->bottom.store(0, std::memory_order_relaxed);
+  dq->array.store(wsa_new(n), std::memory_order_relaxed);
+}
+
+void wsd_free(WSDeque *dq) {
+  for (WSArray *a : dq->retired) {
+    wsa_del(a);
+  }
+  dq->retired.clear();
+  if (WSArray *a = dq->array.load(std::memory_order_relaxed)) {
+    wsa_del(a);
+  }
+  dq->array.store(NULL, std::memory_order_relaxed);
+}
+
+// double the array, copying the live range [t, b)
+static WSArray *wsd_grow(WSDeque *dq, WSArray *a, int64_t t, int64_t b) {
+  WSArray *bigger = wsa_new((size_t)(a->mask + 1) * 2);
+  for (int64_t i = t; i < b; i++) {
+    wsa_put(bigger, i, wsa_get(a, i));
+  }
+  dq->retired.push_back(a);
+  dq->array.store(bigger, std::memory_order_release);
+  return bigger;
+}
+
+void wsd_push(WSDeque *dq, Work w) {
+  int64_t b = dq->bottom.load(std::memory_order_relaxed);
+  int64_t t = dq->top.load(std::memory_order_acquire);
+  WSArray *a = dq->array.load(std::memory_order_relaxed);
+  if (b - t > a->mask) {
+    a = wsd_grow(dq, a, t, b);
+  }
+  wsa_put(a, b, w);
+  std::atomic_thread_fence(std::memory_order_release);
+  dq->bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+bool wsd_take(WSDeque *dq, Work *out) {
+  int64_t b = dq->bottom.load(std::memory_order_relaxed) - 1;
+  WSArray *a = dq->array.load(std::memory_order_relaxed);
+  dq->bottom.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t t = dq->top.load(std::memory_order_relaxed);
+  if (t > b) {
+    // empty
+    dq->bottom.store(b + 1, std::memory_order_relaxed);
+    return false;
+  }
+  *out = wsa_get(a, b);
+  if (t == b) {
+    // the last one, race against the thieves
+    bool won = dq->top.compare_exchange_strong(
+      t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    dq->bottom.store(b + 1, std::memory_order_relaxed);
+    return won;
+  }
+  return true;
+}
+
+bool wsd_steal(WSDeque *dq, Work *out) {
+  while (true) {
+    int64_t t = dq->top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = dq->bottom.load(std::memory_order_acquire);
+    if (t >= b) {
+      return false;
+    }
+    WSArray *a = dq->array.load(std::memory_order_acquire);
+    Work w = wsa_get(a, t);
+    if (dq->top.compare_exchange_strong(
+          t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      *out = w;
+      return true;
+    }
+    // lost to another thief or the owner, retry
+  }
+}
+
+size_t wsd_size(WSDeque const *dq) {
+  int64_t b = dq->bottom.load(std::memory_order_relaxed);
+  int64_t t = dq->top.load(std::memory_order_relaxed);
+  return b > t ? (size_t)(b - t) : 0;
+}
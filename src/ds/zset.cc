@@ -1,9 +1,17 @@
 #include "byoredis/ds/zset.hh"
 #include "byoredis/ds/intrusive.hh"
+#include "byoredis/common/hash.hh"
+#include "byoredis/common/slab.hh"
 #include <string.h>
+#include <math.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <algorithm>
+#include <vector>
+
+size_t g_zset_max_listpack_entries = 128;
+size_t g_zset_max_listpack_value   = 64;
+int    g_zset_index = ZSET_INDEX_AVL;
 
 // provide local key type and helpers so zset does not depend on server/db
 struct HKey {  // for the hashtable key (zset name) compare function
@@ -12,14 +20,119 @@ struct HKey {  // for the hashtable key (zset name) compare function
   size_t len = 0;
 };
 
-static uint64_t str_hash(uint8_t const *data, size_t len) {
-  uint32_t h = 0x811C9DC5;  // FNV variant
-  for (size_t i = 0; i < len; i++) {
-    h = (h + data[i]) * 0x1000193;
+// (score1, name1) < (score2, name2)
+static bool tuple_less(double score1, char const *name1, size_t len1,
+                       double score2, char const *name2, size_t len2) {
+  if (score1 != score2) {
+    return score1 < score2;
   }
-  return h;
+  int rv = memcmp(name1, name2, std::min(len1, len2));
+  return (rv != 0) ? (rv < 0) : (len1 < len2);
+}
+
+// listpack encoding
+
+size_t const k_lp_entry_hdr = 9;      // score + len
+size_t const k_lp_entry_trailer = 1;  // len again, to walk backwards
+
+static inline double lpe_score(uint8_t const *p) {
+  double score = 0;
+  memcpy(&score, p, 8);
+  return score;
+}
+static inline size_t      lpe_len(uint8_t const *p)  { return p[8]; }
+static inline char const *lpe_name(uint8_t const *p) { return (char const *)p + k_lp_entry_hdr; }
+static inline size_t      lpe_size(uint8_t const *p) {
+  return k_lp_entry_hdr + p[8] + k_lp_entry_trailer;
+}
+// the size of the entry before `p`
+static inline size_t      lpe_prev_size(uint8_t const *p) {
+  return k_lp_entry_hdr + p[-1] + k_lp_entry_trailer;
+}
+
+static inline uint8_t * lp_end(ZListpack *lp) {
+  return lp->data + lp->bytes;
+}
+
+// find by name, also returns the rank
+static uint8_t * lp_find(ZListpack *lp, char const *name, size_t len, int64_t *rank) {
+  int64_t r = 0;
+  for (uint8_t *p = lp->data; p < lp_end(lp); p += lpe_size(p), r++) {
+    if (lpe_len(p) == len && 0 == memcmp(lpe_name(p), name, len)) {
+      *rank = r;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+// the first entry >= the key, or the end
+static uint8_t * lp_seekge(ZListpack *lp, double score, char const *name, size_t len, int64_t *rank) {
+  int64_t r = 0;
+  uint8_t *p = lp->data;
+  for (; p < lp_end(lp); p += lpe_size(p), r++) {
+    if (!tuple_less(lpe_score(p), lpe_name(p), lpe_len(p), score, name, len)) {
+      break;
+    }
+  }
+  *rank = r;
+  return p;
+}
+
+static void lp_insert(ZSet *zset, char const *name, size_t len, double score) {
+  assert(len <= k_zset_max_listpack_value);
+  int64_t rank = 0;
+  size_t off = (size_t)(lp_seekge(zset->lp, score, name, len, &rank) - zset->lp->data);
+  size_t n = k_lp_entry_hdr + len + k_lp_entry_trailer;
+  ZListpack *lp = (ZListpack *)realloc(zset->lp, sizeof(ZListpack) + zset->lp->bytes + n);
+  assert(lp);
+  uint8_t *p = lp->data + off;
+  memmove(p + n, p, lp->bytes - off);
+  memcpy(p, &score, 8);
+  p[8] = (uint8_t)len;
+  memcpy(p + k_lp_entry_hdr, name, len);
+  p[n - 1] = (uint8_t)len;
+  lp->bytes += (uint32_t)n;
+  lp->count++;
+  zset->lp = lp;
+}
+
+static void lp_delete(ZListpack *lp, uint8_t *p) {
+  size_t n = lpe_size(p);
+  memmove(p, p + n, (size_t)(lp_end(lp) - p) - n);
+  lp->bytes -= (uint32_t)n;
+  lp->count--;
 }
 
+// change the score, in place if the entry stays between its neighbours
+static void lp_update(ZSet *zset, uint8_t *p, double score) {
+  ZListpack *lp = zset->lp;
+  char const *name = lpe_name(p);
+  size_t len = lpe_len(p);
+  uint8_t *prev = (p == lp->data) ? NULL : p - lpe_prev_size(p);
+  uint8_t *next = p + lpe_size(p);
+  if ((!prev || tuple_less(lpe_score(prev), lpe_name(prev), lpe_len(prev), score, name, len))
+      && (next == lp_end(lp)
+          || tuple_less(score, name, len, lpe_score(next), lpe_name(next), lpe_len(next)))) {
+    memcpy(p, &score, 8);
+    return;
+  }
+  char copy[k_zset_max_listpack_value];
+  memcpy(copy, name, len);
+  lp_delete(lp, p);
+  lp_insert(zset, copy, len, score);
+}
+
+static ZListpack * lp_new() {
+  ZListpack *lp = (ZListpack *)malloc(sizeof(ZListpack));
+  assert(lp);
+  lp->bytes = 0;
+  lp->count = 0;
+  return lp;
+}
+
+// tree encoding
+
 static bool hcmp(HNode *node, HNode *key) {
   ZNode *znode = container_of(node, ZNode, hmap);
   HKey  *hkey  = container_of(key, HKey, node);
@@ -29,11 +142,31 @@ static bool hcmp(HNode *node, HNode *key) {
   return 0 == memcmp(znode->name, hkey->name, znode->len);
 }
 
-// lookup by name in the hashtable
-ZNode * zset_lookup(ZSet *zset, char const *name, size_t len) {
-  if (!zset->root) {
-    return NULL;
-  }
+// the B+tree index is used by existing B+trees and new trees
+static inline bool use_bt(ZSet const *zset) {
+  return zset->bt.root || (!zset->root && g_zset_index == ZSET_INDEX_BTREE);
+}
+
+// the B+tree key for the tie-break on equal scores
+struct BKey {
+  char const *name = NULL;
+  size_t len = 0;
+};
+
+static bool bt_less(void const *item, void const *key) {
+  ZNode const *znode = (ZNode const *)item;
+  BKey const *bkey = (BKey const *)key;
+  return tuple_less(0, znode->name, znode->len, 0, bkey->name, bkey->len);
+}
+
+static inline BKey bkey_of(ZNode const *node) {
+  BKey key;
+  key.name = node->name;
+  key.len = node->len;
+  return key;
+}
+
+static ZNode * hash_lookup(ZSet *zset, char const *name, size_t len) {
   HKey key;
   key.node.hcode = str_hash((uint8_t const *)name, len);
   key.name = name;
@@ -42,29 +175,34 @@ ZNode * zset_lookup(ZSet *zset, char const *name, size_t len) {
   return found ? container_of(found, ZNode, hmap) : NULL;
 }
 
+// lookup by name in the hashtable
+static ZNode * zset_lookup(ZSet *zset, char const *name, size_t len) {
+  if (!zset->root && !zset->bt.root) {
+    return NULL;
+  }
+  return hash_lookup(zset, name, len);
+}
+
 // (lhs.score, lhs.name) < (rhs.score, rhs.name)
 static bool zless(AVLNode *lhs, AVLNode *rhs) {
   ZNode *zl = container_of(lhs, ZNode, tree);
   ZNode *zr = container_of(rhs, ZNode, tree);
-  if (zl->score != zr->score) {
-    return zl->score < zr->score;
-  }
-  int rv = memcmp(zl->name, zr->name, std::min(zl->len, zr->len));
-  return (rv != 0) ? (rv < 0) : (zl->len < zr->len);
+  return tuple_less(zl->score, zl->name, zl->len, zr->score, zr->name, zr->len);
 }
 
 // compare by the (score, name) tuple
 static bool zless(AVLNode *lhs, double score, char const *name, size_t len) {
   ZNode *zl = container_of(lhs, ZNode, tree);
-  if (zl->score != score) {
-    return zl->score < score;
-  }
-  int rv = memcmp(zl->name, name, std::min(zl->len, len));
-  return (rv != 0) ? (rv < 0) : (zl->len < len);
+  return tuple_less(zl->score, zl->name, zl->len, score, name, len);
 }
 
-// insert into the AVL tree
+// insert into the ordered index
 static void tree_insert(ZSet *zset, ZNode *node) {
+  if (use_bt(zset)) {
+    BKey key = bkey_of(node);
+    bt_insert(&zset->bt, node->score, node, &key, &bt_less);
+    return;
+  }
   AVLNode *parent = NULL;
   AVLNode **from  = &zset->root;
   while (*from) {
@@ -78,8 +216,26 @@ static void tree_insert(ZSet *zset, ZNode *node) {
 
 // update the score of an existing node
 static void zset_update(ZSet *zset, ZNode *node, double score) {
+  if (!zset->bt.root) {
+    // keep the node in place if it stays between its neighbours
+    AVLNode *prev = avl_predecessor(&node->tree);
+    AVLNode *next = avl_successor(&node->tree);
+    if ((!prev || zless(prev, score, node->name, node->len))
+        && (!next || !zless(next, score, node->name, node->len))) {
+      node->score = score;
+      avl_set_val(&node->tree, score);
+      return;
+    }
+  } else {
+    BKey key = bkey_of(node);
+    bt_delete(&zset->bt, node->score, node, &key, &bt_less);
+    node->score = score;
+    tree_insert(zset, node);
+    return;
+  }
   // detach the tree node
   zset->root = avl_del(&node->tree);
+  node->tree.val = score;
   avl_init(&node->tree);
   // reinsert the tree node
   node->score = score;
@@ -87,8 +243,8 @@ static void zset_update(ZSet *zset, ZNode *node, double score) {
 }
 
 static ZNode * znode_new(char const *name, size_t len, double score) {
-  ZNode *node = (ZNode *)malloc(sizeof(ZNode) + len);  // struct + array
-  assert(node);  // not a good idea in read projects
+  ZNode *node = (ZNode *)slab_alloc(sizeof(ZNode) + len);  // struct + array
+  node->tree.val = score;  // for the sum of scores
   avl_init(&node->tree);   // init AVLNode
   node->hmap.next  = NULL; // init HNode
   node->hmap.hcode = str_hash((uint8_t const *)name, len);
@@ -99,42 +255,45 @@ static ZNode * znode_new(char const *name, size_t len, double score) {
 }
 
 static void znode_free(ZNode *node) {
-  free(node);
+  slab_free(node, sizeof(ZNode) + node->len);
 }
 
-// add a new (score, name) tuple, or update the score of the existing tuple
-bool zset_insert(ZSet *zset, char const *name, size_t len, double score) {
-  if (ZNode *node = zset_lookup(zset, name, len)) {
-    zset_update(zset, node, score);
-    return false;
-  }
+static void bt_item_free(void *item) {
+  znode_free((ZNode *)item);
+}
+
+static void tree_add(ZSet *zset, char const *name, size_t len, double score) {
   ZNode *node = znode_new(name, len, score);
   hm_insert(&zset->hmap, &node->hmap);
   tree_insert(zset, node);
-  return true;
 }
 
-// delete a node from both the AVL tree and the hashtable
-void zset_delete(ZSet *zset, ZNode *node) {
-  // remove from the hashtable
+static void hash_unlink(ZSet *zset, ZNode *node) {
   HKey key;
   key.node.hcode = node->hmap.hcode;
   key.name = node->name;
   key.len  = node->len;
   HNode *found = hm_delete(&zset->hmap, &key.node, &hcmp);
   assert(found);
-  // remove from the AVL tree
-  zset->root = avl_del(&node->tree);
+}
+
+// delete a node from both the AVL tree and the hashtable
+static void zset_delete(ZSet *zset, ZNode *node) {
+  // remove from the hashtable
+  hash_unlink(zset, node);
+  // remove from the ordered index
+  if (zset->bt.root) {
+    BKey bkey = bkey_of(node);
+    bt_delete(&zset->bt, node->score, node, &bkey, &bt_less);
+  } else {
+    zset->root = avl_del(&node->tree);
+  }
   // deallocate the node
   znode_free(node);
 }
 
 // find the first (score, name) tuple that is >= key
-// range query command: ZQUERY key score name offset limit
-// 1. Seek to the first pair where pair >= (score, name).
-// 2. Walk to the n-th successor/predecessor (offset).
-// 3. Iterate and output (limit).
-ZNode * zset_seekge(ZSet *zset, double score, char const *name, size_t len) {
+static ZNode * tree_seekge(ZSet *zset, double score, char const *name, size_t len) {
   AVLNode *found = NULL;
   for (AVLNode *node = zset->root; node; ) {
     if (zless(node, score, name, len)) {
@@ -147,10 +306,385 @@ ZNode * zset_seekge(ZSet *zset, double score, char const *name, size_t len) {
   return found ? container_of(found, ZNode, tree) : NULL;
 }
 
-// offset into the succeeding or preceding node in the AVL tree
-ZNode * znode_offset(ZNode *node, int64_t offset) {
-  AVLNode *tnode = node ? avl_offset(&node->tree, offset) : NULL;
-  return tnode ? container_of(tnode, ZNode, tree) : NULL;
+// convert the listpack into the tree
+static void zset_promote(ZSet *zset) {
+  ZListpack *lp = zset->lp;
+  zset->lp = NULL;
+  for (uint8_t *p = lp->data; p < lp_end(lp); p += lpe_size(p)) {
+    tree_add(zset, lpe_name(p), lpe_len(p), lpe_score(p));
+  }
+  free(lp);
+}
+
+// encoding independent API
+
+size_t zset_len(ZSet const *zset) {
+  if (zset->lp) {
+    return zset->lp->count;
+  }
+  return zset->bt.root ? zset->bt.size : avl_size(zset->root);
+}
+
+// add a member or update its score. With `incr`, the score is added to the
+// existing one and the result is returned in `score`. Returns false without
+// any change if the result is NaN.
+static bool zset_upsert(ZSet *zset, char const *name, size_t len, double &score,
+                        bool incr, bool &added) {
+  added = false;
+  if (!zset->lp && !zset->root && !zset->bt.root && g_zset_max_listpack_entries > 0) {
+    hm_clear(&zset->hmap);  // emptied tree
+    zset->lp = lp_new();
+  }
+  if (ZListpack *lp = zset->lp) {
+    int64_t rank = 0;
+    if (uint8_t *p = lp_find(lp, name, len, &rank)) {
+      if (incr) {
+        score += lpe_score(p);
+        if (isnan(score)) {
+          return false;
+        }
+      }
+      if (lpe_score(p) != score) {
+        lp_update(zset, p, score);
+      }
+      return true;
+    }
+    if (lp->count < g_zset_max_listpack_entries
+        && len <= std::min(g_zset_max_listpack_value, k_zset_max_listpack_value)) {
+      lp_insert(zset, name, len, score);
+      added = true;
+      return true;
+    }
+    zset_promote(zset);
+  }
+  if (ZNode *node = zset_lookup(zset, name, len)) {
+    if (incr) {
+      score += node->score;
+      if (isnan(score)) {
+        return false;
+      }
+    }
+    if (node->score != score) {
+      zset_update(zset, node, score);
+    }
+    return true;
+  }
+  tree_add(zset, name, len, score);
+  added = true;
+  return true;
+}
+
+bool zset_insert(ZSet *zset, char const *name, size_t len, double score) {
+  bool added = false;
+  zset_upsert(zset, name, len, score, false, added);
+  return added;
+}
+
+bool zset_incrby(ZSet *zset, char const *name, size_t len, double incr, double &score) {
+  bool added = false;
+  score = incr;
+  return zset_upsert(zset, name, len, score, true, added);
+}
+
+size_t zset_insert_bulk(ZSet *zset, ZMember const *members, size_t n) {
+  if (zset_len(zset) > 0 || n <= g_zset_max_listpack_entries
+      || g_zset_index == ZSET_INDEX_BTREE) {
+    size_t added = 0;
+    for (size_t i = 0; i < n; i++) {
+      added += zset_insert(zset, members[i].name, members[i].len, members[i].score);
+    }
+    return added;
+  }
+  // build the tree encoding from scratch
+  free(zset->lp);
+  zset->lp = NULL;
+  hm_clear(&zset->hmap);
+  hm_reserve(&zset->hmap, n);
+  std::vector<AVLNode *> nodes;
+  nodes.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    ZMember const &m = members[i];
+    if (ZNode *node = hash_lookup(zset, m.name, m.len)) {
+      node->score = node->tree.val = m.score;  // the last one wins
+      continue;
+    }
+    ZNode *node = znode_new(m.name, m.len, m.score);
+    hm_insert(&zset->hmap, &node->hmap);
+    nodes.push_back(&node->tree);
+  }
+  auto less = [](AVLNode *lhs, AVLNode *rhs) { return zless(lhs, rhs); };
+  if (!std::is_sorted(nodes.begin(), nodes.end(), less)) {
+    std::sort(nodes.begin(), nodes.end(), less);
+  }
+  zset->root = avl_build(nodes.data(), nodes.size());
+  return nodes.size();
+}
+
+bool zset_remove(ZSet *zset, char const *name, size_t len) {
+  if (ZListpack *lp = zset->lp) {
+    int64_t rank = 0;
+    uint8_t *p = lp_find(lp, name, len, &rank);
+    if (p) {
+      lp_delete(lp, p);
+    }
+    return p != NULL;
+  }
+  ZNode *node = zset_lookup(zset, name, len);
+  if (node) {
+    zset_delete(zset, node);
+  }
+  return node != NULL;
+}
+
+bool zset_score(ZSet *zset, char const *name, size_t len, double &score) {
+  if (ZListpack *lp = zset->lp) {
+    int64_t rank = 0;
+    uint8_t *p = lp_find(lp, name, len, &rank);
+    if (p) {
+      score = lpe_score(p);
+    }
+    return p != NULL;
+  }
+  ZNode *node = zset_lookup(zset, name, len);
+  if (node) {
+    score = node->score;
+  }
+  return node != NULL;
+}
+
+int64_t zset_rank(ZSet *zset, char const *name, size_t len) {
+  if (ZListpack *lp = zset->lp) {
+    int64_t rank = -1;
+    lp_find(lp, name, len, &rank);
+    return rank;
+  }
+  ZNode *node = zset_lookup(zset, name, len);
+  if (!node) {
+    return -1;
+  }
+  if (zset->bt.root) {
+    BKey key = bkey_of(node);
+    int64_t rank = 0;
+    bt_seekge(&zset->bt, node->score, &key, &bt_less, &rank);
+    return rank;
+  }
+  return avl_rank(&node->tree);
+}
+
+int64_t zset_seekge(ZSet *zset, double score, char const *name, size_t len) {
+  if (ZListpack *lp = zset->lp) {
+    int64_t rank = 0;
+    lp_seekge(lp, score, name, len, &rank);
+    return rank;
+  }
+  if (zset->bt.root) {
+    BKey key;
+    key.name = name;
+    key.len = len;
+    int64_t rank = 0;
+    bt_seekge(&zset->bt, score, &key, &bt_less, &rank);
+    return rank;
+  }
+  ZNode *node = tree_seekge(zset, score, name, len);
+  return node ? avl_rank(&node->tree) : (int64_t)zset_len(zset);
+}
+
+static void zit_load(ZIter &it) {
+  if (bt_valid(it.bpos)) {
+    it.node = (ZNode *)bt_item(it.bpos);
+  }
+  if (it.node) {
+    it.score = it.node->score;
+    it.name  = it.node->name;
+    it.len   = it.node->len;
+  } else if (it.pos) {
+    it.score = lpe_score(it.pos);
+    it.name  = lpe_name(it.pos);
+    it.len   = lpe_len(it.pos);
+  } else {
+    it.name  = NULL;
+  }
+}
+
+ZIter zset_at(ZSet *zset, int64_t rank) {
+  ZIter it;
+  it.zset = zset;
+  it.rank = rank;
+  if (rank >= 0 && rank < (int64_t)zset_len(zset)) {
+    if (ZListpack *lp = zset->lp) {
+      uint8_t const *p = lp->data;
+      for (int64_t i = 0; i < rank; i++) {
+        p += lpe_size(p);
+      }
+      it.pos = p;
+    } else if (zset->bt.root) {
+      it.bpos = bt_at(&zset->bt, rank);
+    } else {
+      AVLNode *root = zset->root;
+      AVLNode *node = avl_offset(root, rank - avl_rank(root));
+      it.node = container_of(node, ZNode, tree);
+    }
+  }
+  zit_load(it);
+  return it;
+}
+
+void zit_next(ZIter &it) {
+  assert(zit_valid(it));
+  it.rank++;
+  if (bt_valid(it.bpos)) {
+    bt_next(it.bpos);
+    it.node = NULL;
+  } else if (it.node) {
+    AVLNode *next = avl_successor(&it.node->tree);
+    it.node = next ? container_of(next, ZNode, tree) : NULL;
+  } else {
+    it.pos += lpe_size(it.pos);
+    if (it.pos >= lp_end(it.zset->lp)) {
+      it.pos = NULL;
+    }
+  }
+  zit_load(it);
+}
+
+void zit_prev(ZIter &it) {
+  assert(zit_valid(it));
+  it.rank--;
+  if (bt_valid(it.bpos)) {
+    bt_prev(it.bpos);
+    it.node = NULL;
+  } else if (it.node) {
+    AVLNode *prev = avl_predecessor(&it.node->tree);
+    it.node = prev ? container_of(prev, ZNode, tree) : NULL;
+  } else if (it.pos == it.zset->lp->data) {
+    it.pos = NULL;
+  } else {
+    it.pos -= lpe_prev_size(it.pos);
+  }
+  zit_load(it);
+}
+
+double zset_range_sum(ZSet *zset, int64_t start, int64_t stop) {
+  start = std::max(start, (int64_t)0);
+  stop = std::min(stop, (int64_t)zset_len(zset));
+  if (start >= stop) {
+    return 0;
+  }
+  if (zset->root) {
+    return avl_range_sum(zset->root, start, stop);
+  }
+  // no sums in the listpack and the B+tree, walk the range
+  double sum = 0;
+  ZIter it = zset_at(zset, start);
+  for (int64_t i = start; i < stop; i++) {
+    sum += it.score;
+    zit_next(it);
+  }
+  return sum;
+}
+
+size_t zset_remove_range(ZSet *zset, int64_t start, int64_t stop, ZNode **garbage) {
+  *garbage = NULL;
+  start = std::max(start, (int64_t)0);
+  stop = std::min(stop, (int64_t)zset_len(zset));
+  if (start >= stop) {
+    return 0;
+  }
+  size_t count = (size_t)(stop - start);
+  if (ZListpack *lp = zset->lp) {
+    ZIter it = zset_at(zset, start);
+    uint8_t *begin = (uint8_t *)it.pos;
+    uint8_t *end = begin;
+    for (size_t i = 0; i < count; i++) {
+      end += lpe_size(end);
+    }
+    memmove(begin, end, (size_t)(lp_end(lp) - end));
+    lp->bytes -= (uint32_t)(end - begin);
+    lp->count -= (uint32_t)count;
+    return count;
+  }
+  if (zset->bt.root) {
+    // chain the nodes along the leaves, then cut the leaves out;
+    // the hashtable is still O(k)
+    ZNode *chain = NULL;
+    BPos pos = bt_at(&zset->bt, start);
+    for (size_t i = 0; i < count; i++, bt_next(pos)) {
+      ZNode *node = (ZNode *)bt_item(pos);
+      hash_unlink(zset, node);
+      avl_init(&node->tree);
+      node->tree.right = chain ? &chain->tree : NULL;
+      chain = node;
+    }
+    bt_remove_range(&zset->bt, start, stop);
+    *garbage = chain;
+    return count;
+  }
+  // cut the subtree out
+  AVLNode *left = NULL, *mid = NULL, *right = NULL;
+  avl_split(zset->root, stop, &left, &right);
+  avl_split(left, start, &left, &mid);
+  zset->root = avl_concat(left, right);
+  // the hashtable is still O(k)
+  AVLNode *node = mid;
+  while (node->left) {
+    node = node->left;
+  }
+  for (; node; node = avl_successor(node)) {
+    hash_unlink(zset, container_of(node, ZNode, tree));
+  }
+  *garbage = container_of(mid, ZNode, tree);
+  return count;
+}
+
+void zset_dispose(ZNode *garbage) {
+  // flatten the tree by rotations so that no stack is needed
+  AVLNode *node = garbage ? &garbage->tree : NULL;
+  while (node) {
+    if (AVLNode *left = node->left) {
+      node->left = left->right;
+      left->right = node;
+      node = left;
+    } else {
+      AVLNode *next = node->right;
+      znode_free(container_of(node, ZNode, tree));
+      node = next;
+    }
+  }
+}
+
+struct ZDefrag {
+  ZSet    *zset = NULL;
+  size_t   moved = 0;
+  uint64_t released = 0;
+};
+
+// the hashtable repoints its chain to the returned node
+static HNode * znode_defrag(HNode *hnode, void *arg) {
+  ZDefrag *zd = (ZDefrag *)arg;
+  ZNode *old = container_of(hnode, ZNode, hmap);
+  size_t size = sizeof(ZNode) + old->len;
+  ZNode *node = (ZNode *)slab_defrag_move(old, size);
+  if (!node) {
+    return hnode;
+  }
+  if (zd->zset->bt.root) {
+    BKey key = bkey_of(node);
+    bt_replace(&zd->zset->bt, node->score, old, &key, &bt_less, node);
+  } else {
+    avl_moved(&node->tree, &old->tree, &zd->zset->root);
+  }
+  zd->released += slab_defrag_free(old, size);
+  zd->moved++;
+  return &node->hmap;
+}
+
+uint64_t zset_defrag(ZSet *zset, uint64_t cursor, size_t *moved, uint64_t *released) {
+  ZDefrag zd;
+  zd.zset = zset;
+  cursor = hm_defrag(&zset->hmap, cursor, &znode_defrag, &zd);
+  *moved += zd.moved;
+  *released += zd.released;
+  return cursor;
 }
 
 static void tree_dispose(AVLNode *node) {
@@ -164,7 +698,10 @@ static void tree_dispose(AVLNode *node) {
 
 // destroy the zset
 void zset_clear(ZSet *zset) {
+  free(zset->lp);
+  zset->lp = NULL;
   hm_clear(&zset->hmap);
   tree_dispose(zset->root);
   zset->root = NULL;
+  bt_clear(&zset->bt, &bt_item_free);
 }
@@ -0,0 +1,23 @@
+#include "byoredis/proto/blob.hh"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+Blob * blob_new(char const *data, size_t len) {
+  assert(len <= UINT32_MAX);
+  Blob *blob = (Blob *)malloc(sizeof(Blob) + len);
+  assert(blob);
+  blob->refs = 1;
+  blob->len = (uint32_t)len;
+  if (len > 0) {
+    memcpy(blob->data, data, len);
+  }
+  return blob;
+}
+
+void blob_unref(Blob *blob) {
+  // acq_rel: the last owner must see all uses by the other owners
+  if (__atomic_sub_fetch(&blob->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(blob);
+  }
+}
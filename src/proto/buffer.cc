@@ -1,5 +1,35 @@
 #include "byoredis/proto/buffer.hh"
 #include <string.h>
+#include <sys/uio.h>
+#include <utility>
+
+Buffer::~Buffer() {
+  for (size_t i = ref_head; i < refs.size(); i++) {
+    blob_unref(refs[i].blob);
+  }
+}
+
+void Buffer::swap(Buffer &other) noexcept {
+  buf.swap(other.buf);
+  std::swap(readable_begin, other.readable_begin);
+  std::swap(writable_begin, other.writable_begin);
+  placeholder_stack.swap(other.placeholder_stack);
+  refs.swap(other.refs);
+  std::swap(ref_head, other.ref_head);
+  std::swap(ref_bytes, other.ref_bytes);
+}
+
+void Buffer::shift_positions(size_t shift) {
+  // adjust all deferred placeholders
+  for (size_t &pos : placeholder_stack) {
+    if (pos >= shift) {
+      pos -= shift;
+    }
+  }
+  for (size_t i = ref_head; i < refs.size(); i++) {
+    refs[i].pos -= shift;
+  }
+}
 
 void Buffer::ensure_writable(size_t ensure_size) {
   if (writable_size() >= ensure_size) {
@@ -9,72 +39,178 @@ void Buffer::ensure_writable(size_t ensure_size) {
   size_t old_readable_begin = readable_begin;
   // solution 1: move the readable data(not consumed yet) to the front
   if (readable_begin + writable_size() >= ensure_size) {
-    memmove(&buf[0], &buf[readable_begin], unread_len);
+    memmove(buf.data(), buf.data() + readable_begin, unread_len);
     readable_begin = 0;
     writable_begin = unread_len;
-
-    // adjust all deferred placeholders
-    if (!placeholder_stack.empty()) {
-      size_t shift = old_readable_begin;
-      for (size_t &pos : placeholder_stack) {
-        if (pos >= old_readable_begin) {
-          pos -= shift;
-        }
-      }
-    }
+    shift_positions(old_readable_begin);
     return;
   }
   // solution 2: resize the buffer
   size_t new_cap = std::max(capacity() * 2, unread_len + ensure_size);
   std::vector<uint8_t> new_buf;
   new_buf.resize(new_cap);
-  memcpy(&new_buf[0], &buf[readable_begin], unread_len);
-  size_t shift = old_readable_begin;
+  if (unread_len > 0) {
+    memcpy(new_buf.data(), buf.data() + readable_begin, unread_len);
+  }
   buf.swap(new_buf);
   readable_begin = 0;
   writable_begin = unread_len;
-  if (!placeholder_stack.empty()) {
-    for (size_t &pos : placeholder_stack) {
-      if (pos >= shift) {
-        pos -= shift;
-      }
-    }
-  }
+  shift_positions(old_readable_begin);
 }
 
 void Buffer::append(uint8_t const *data, size_t n) {
   ensure_writable(n);
-  memcpy(&buf[writable_begin], data, n);
+  memcpy(writable_data(), data, n);
   writable_begin += n;
 }
 
+void Buffer::append_ref(Blob *blob) {
+  if (blob->len == 0) {
+    return;
+  }
+  BufRef ref;
+  ref.pos = writable_begin;
+  ref.blob = blob_ref(blob);
+  refs.push_back(ref);
+  ref_bytes += blob->len;
+}
+
+void Buffer::append_buffer(Buffer const &src, size_t skip) {
+  size_t pos = src.readable_begin;
+  auto copy_until = [&](size_t end) {
+    size_t k = std::min(skip, end - pos);
+    pos += k;
+    skip -= k;
+    append(src.buf.data() + pos, end - pos);
+    pos = end;
+  };
+  for (size_t i = src.ref_head; i < src.refs.size(); i++) {
+    BufRef const &ref = src.refs[i];
+    copy_until(ref.pos);
+    size_t left = ref.blob->len - ref.done;
+    if (skip >= left) {
+      skip -= left;
+    } else if (skip > 0 || ref.done > 0) {
+      // a partial blob, just copy the rest
+      size_t off = ref.done + skip;
+      append((uint8_t const *)ref.blob->data + off, ref.blob->len - off);
+      skip = 0;
+    } else {
+      append_ref(ref.blob);
+    }
+  }
+  copy_until(src.writable_begin);
+}
+
+void Buffer::append_range(Buffer const &src, size_t begin, size_t end) {
+  assert(src.ref_head == 0);
+  size_t pos = begin;
+  for (BufRef const &ref : src.refs) {
+    if (ref.pos <= begin) {
+      continue;
+    }
+    if (ref.pos > end) {
+      break;
+    }
+    append(src.buf.data() + pos, ref.pos - pos);
+    append_ref(ref.blob);
+    pos = ref.pos;
+  }
+  append(src.buf.data() + pos, end - pos);
+}
+
+void Buffer::truncate(size_t pos) {
+  assert(readable_begin <= pos && pos <= writable_begin);
+  writable_begin = pos;
+  while (has_refs() && refs.back().pos >= pos) {
+    BufRef &ref = refs.back();
+    ref_bytes -= ref.blob->len - ref.done;
+    blob_unref(ref.blob);
+    refs.pop_back();
+  }
+}
+
 void Buffer::consume(size_t n) {
-  n = std::min(n, readable_size());
-  readable_begin += n;
-  if (readable_begin >= writable_begin) {
+  n = std::min(n, output_size());
+  while (n > 0) {
+    // the bytes in buf before the next ref
+    size_t stop = has_refs() ? refs[ref_head].pos : writable_begin;
+    size_t k = std::min(n, stop - readable_begin);
+    readable_begin += k;
+    n -= k;
+    if (n == 0) {
+      break;
+    }
+    BufRef &ref = refs[ref_head];
+    size_t m = std::min(n, (size_t)ref.blob->len - ref.done);
+    ref.done += m;
+    ref_bytes -= m;
+    n -= m;
+    if (ref.done == ref.blob->len) {
+      blob_unref(ref.blob);
+      ref_head++;
+    }
+  }
+  if (!has_refs()) {
+    refs.clear();
+    ref_head = 0;
+  } else if (ref_head >= 64 && ref_head * 2 >= refs.size()) {
+    refs.erase(refs.begin(), refs.begin() + ref_head);
+    ref_head = 0;
+  }
+  if (readable_begin >= writable_begin && !has_refs()) {
     // all consumed, reset
     readable_begin = 0;
     writable_begin = 0;
   }
 }
 
+size_t Buffer::fill_iov(struct iovec *iov, size_t max_iov) const {
+  size_t n = 0;
+  size_t pos = readable_begin;
+  for (size_t i = ref_head; i < refs.size() && n < max_iov; i++) {
+    BufRef const &ref = refs[i];
+    if (ref.pos > pos) {
+      iov[n].iov_base = (void *)(buf.data() + pos);
+      iov[n].iov_len = ref.pos - pos;
+      pos = ref.pos;
+      if (++n == max_iov) {
+        return n;
+      }
+    }
+    iov[n].iov_base = ref.blob->data + ref.done;
+    iov[n].iov_len = ref.blob->len - ref.done;
+    n++;
+  }
+  if (n < max_iov && writable_begin > pos) {
+    iov[n].iov_base = (void *)(buf.data() + pos);
+    iov[n].iov_len = writable_begin - pos;
+    n++;
+  }
+  return n;
+}
+
+size_t Buffer::ref_bytes_after(size_t pos) const {
+  size_t total = 0;
+  for (size_t i = refs.size(); i > ref_head && refs[i - 1].pos > pos; i--) {
+    total += refs[i - 1].blob->len - refs[i - 1].done;
+  }
+  return total;
+}
+
 void Buffer::shrink_if_wasteful(size_t hard_min) {
   size_t const unread_len = readable_size();
   if (capacity() > std::max(hard_min, unread_len * 4)) {
     size_t new_cap = std::max(hard_min, unread_len * 2);
     std::vector<uint8_t> new_buf;
     new_buf.resize(new_cap);
-    memcpy(&new_buf[0], &buf[readable_begin], unread_len);
+    if (unread_len > 0) {
+      memcpy(new_buf.data(), buf.data() + readable_begin, unread_len);
+    }
     buf.swap(new_buf);
     size_t shift = readable_begin;
     readable_begin = 0;
     writable_begin = unread_len;
-    if (!placeholder_stack.empty()) {
-      for (size_t &pos : placeholder_stack) {
-        if (pos >= shift) {
-          pos -= shift;
-        }
-      }
-    }
+    shift_positions(shift);
   }
 }
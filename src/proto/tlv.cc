@@ -20,6 +20,15 @@ bool read_str(uint8_t const *&cur, uint8_t const *end, size_t n, std::string &ou
   return true;
 }
 
+bool read_str(uint8_t const *&cur, uint8_t const *end, size_t n, std::string_view &out) {
+  if (cur + n > end) {
+    return false;
+  }
+  out = std::string_view((char const *)cur, n);
+  cur += n;
+  return true;
+}
+
 void buf_append_u8(Buffer &buf, uint8_t data) {
   buf.append(&data, 1);
 }
@@ -50,6 +59,15 @@ void out_str(Buffer &buf, char const *s, size_t size) {
   buf_append_str(buf, (uint8_t const *)s, size);  // val
 }
 
+void out_blob(Buffer &buf, Blob *blob) {
+  if (blob->len < k_min_ref_size) {
+    return out_str(buf, blob->data, blob->len);
+  }
+  buf_append_u8(buf, TAG_STR);
+  buf_append_u32(buf, blob->len);
+  buf.append_ref(blob);  // written straight from the value
+}
+
 void out_int(Buffer &buf, int64_t val) {
   buf_append_u8(buf, TAG_INT);
   buf_append_i64(buf, val);
@@ -5,161 +5,562 @@
 #include "byoredis/ds/intrusive.hh"  // for container_of
 #include "byoredis/ds/zset.hh"
 #include "byoredis/server/time.hh"
+#include "byoredis/common/glob.hh"
+#include "byoredis/common/slab.hh"
 #include <math.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
 
-void do_get(std::vector<std::string> &cmd, Buffer &buffer) {
+static void out_str_entry(Buffer &buffer, Entry *ent) {
+  if (Blob *blob = entry_blob(ent)) {
+    return out_blob(buffer, blob);
+  }
+  std::string_view val = entry_str(ent);
+  return out_str(buffer, val.data(), val.size());
+}
+
+void do_get(std::vector<std::string_view> &cmd, Buffer &buffer) {
   LookupKey key;
-  key.key.swap(cmd[1]);
+  key.key = cmd[1];
   key.node.hcode = str_hash((uint8_t const *)key.key.data(), key.key.size());
-  HNode *node = hm_lookup(&g_data.db, &key.node, &entry_eq);
-  if (!node) {
+  Entry *ent = keyspace_lookup(&key.node, &entry_eq);
+  if (!ent) {
     return out_nil(buffer);
   }
-  Entry *ent = container_of(node, Entry, node);
   if (ent->type != T_STR) {
     return out_err(buffer, ERR_BAD_TYP, "not a string value");
   }
-  return out_str(buffer, ent->str.data(), ent->str.size());
+  return out_str_entry(buffer, ent);
+}
+
+// Multi-key commands look up their keys in batches. The hashes of a batch
+// are computed and its buckets prefetched, then the first nodes of the
+// buckets, and only then are the keys compared one by one: the cache
+// misses of the batch overlap instead of being serialized.
+size_t const k_lookup_batch = 16;
+
+// the keys cmd[first], cmd[first + step], ... with their hashes
+static std::vector<LookupKey> lookup_keys(std::vector<std::string_view> &cmd, size_t first, size_t step) {
+  std::vector<LookupKey> keys((cmd.size() - first + step - 1) / step);
+  for (size_t i = 0; i < keys.size(); i++) {
+    keys[i].key = cmd[first + i * step];
+    keys[i].node.hcode = str_hash((uint8_t const *)keys[i].key.data(), keys[i].key.size());
+  }
+  return keys;
+}
+
+// prefetch for the lookups of keys[0..n)
+static void lookup_prefetch(LookupKey const *keys, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    db_prefetch(&g_data.db, keys[i].node.hcode);
+  }
+  for (size_t i = 0; i < n; i++) {
+    db_prefetch_chain(&g_data.db, keys[i].node.hcode);
+  }
 }
 
-void do_set(std::vector<std::string> &cmd, Buffer &buffer) {
+// mget key [key ...]
+// the values, nil for a missing key or a value that is not a string
+void do_mget(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  std::vector<LookupKey> keys = lookup_keys(cmd, 1, 1);
+  out_arr(buffer, (uint32_t)keys.size());
+  for (size_t b = 0; b < keys.size(); b += k_lookup_batch) {
+    size_t n = std::min(k_lookup_batch, keys.size() - b);
+    lookup_prefetch(&keys[b], n);
+    for (size_t i = b; i < b + n; i++) {
+      Entry *ent = keyspace_lookup(&keys[i].node, &entry_eq);
+      if (ent && ent->type == T_STR) {
+        out_str_entry(buffer, ent);
+      } else {
+        out_nil(buffer);
+      }
+    }
+  }
+}
+
+// mset key value [key value ...]
+// unlike set, a value of another type is replaced, so it never fails halfway
+void do_mset(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  if (cmd.size() % 2 != 1) {
+    return out_err(buffer, ERR_BAD_ARG, "wrong number of arguments");
+  }
+  std::vector<LookupKey> keys = lookup_keys(cmd, 1, 2);
+  for (size_t b = 0; b < keys.size(); b += k_lookup_batch) {
+    size_t n = std::min(k_lookup_batch, keys.size() - b);
+    lookup_prefetch(&keys[b], n);
+    for (size_t i = b; i < b + n; i++) {
+      LookupKey &key = keys[i];
+      std::string_view val = cmd[2 + i * 2];
+      Entry *ent = keyspace_lookup(&key.node, &entry_eq);
+      if (ent && ent->type == T_STR) {
+        entry_set_str(ent, val);
+        continue;
+      }
+      if (ent) {
+        keyspace_delete(&ent->node, &hnode_same);
+        entry_del(ent);
+      }
+      keyspace_insert(entry_new_str(key.key, key.node.hcode, val));
+    }
+  }
+  return out_nil(buffer);
+}
+
+void do_set(std::vector<std::string_view> &cmd, Buffer &buffer) {
   LookupKey key;
-  key.key.swap(cmd[1]);
+  key.key = cmd[1];
   key.node.hcode = str_hash((uint8_t const *)key.key.data(), key.key.size());
-  HNode *node = hm_lookup(&g_data.db, &key.node, &entry_eq);
-  if (node) {
+  Entry *ent = keyspace_lookup(&key.node, &entry_eq);
+  if (ent) {
     // found, update the value
-    Entry *ent = container_of(node, Entry, node);
     if (ent->type != T_STR) {
       return out_err(buffer, ERR_BAD_TYP, "a non-string value exists");
     }
-    ent->str.swap(cmd[2]);
+    entry_set_str(ent, cmd[2]);  // the only copy of the value
   } else {
     // not found, allocate & insert a new pair
-    Entry *ent = entry_new(T_STR);
-    ent->key.swap(key.key);
-    ent->node.hcode = key.node.hcode;
-    ent->str.swap(cmd[2]);
-    hm_insert(&g_data.db, &ent->node);
+    keyspace_insert(entry_new_str(key.key, key.node.hcode, cmd[2]));
   }
   return out_nil(buffer);
 }
 
-void do_del(std::vector<std::string> &cmd, Buffer &buffer) {
-  LookupKey key;
-  key.key.swap(cmd[1]);
-  key.node.hcode = str_hash((uint8_t const *)key.key.data(), key.key.size());
-  HNode *node = hm_delete(&g_data.db, &key.node, &entry_eq);
-  if (node) {  // deallocate the pair if found
-    entry_del(container_of(node, Entry, node));
+// del key [key ...]
+// unlink key [key ...]
+static void del_keys(std::vector<std::string_view> &cmd, Buffer &buffer, void (*del)(Entry *)) {
+  std::vector<LookupKey> keys = lookup_keys(cmd, 1, 1);
+  int64_t deleted = 0;
+  for (size_t b = 0; b < keys.size(); b += k_lookup_batch) {
+    size_t n = std::min(k_lookup_batch, keys.size() - b);
+    lookup_prefetch(&keys[b], n);
+    for (size_t i = b; i < b + n; i++) {
+      Entry *ent = keyspace_delete(&keys[i].node, &entry_eq);
+      if (ent) {  // deallocate the pair if found
+        deleted += !entry_expired(ent);
+        del(ent);
+      }
+    }
+  }
+  return out_int(buffer, deleted);  // the number of deleted keys
+}
+
+void do_del(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  del_keys(cmd, buffer, &entry_del);
+}
+
+// the values are freed in the thread pool
+void do_unlink(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  del_keys(cmd, buffer, &entry_del_lazy);
+}
+
+// flushall [async|sync], flushdb [async|sync]
+void do_flushall(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  if (cmd.size() > 2 || (cmd.size() == 2 && cmd[1] != "async" && cmd[1] != "sync")) {
+    return out_err(buffer, ERR_BAD_ARG, "syntax error");
   }
-  return out_int(buffer, node ? 1 : 0);  // the number of deleted keys
+  keyspace_flush(cmd.size() == 2 && cmd[1] == "async");
+  return out_nil(buffer);
 }
 
-static bool cb_keys(HNode *node, void *arg) {
-  Buffer &buf = *(Buffer *)arg;
-  std::string const &key = container_of(node, struct Entry, node)->key;
-  out_str(buf, key.data(), key.size()); 
+// the keys starting with `prefix` and matching the pattern if any
+struct KeyFilter {
+  std::string_view prefix;
+  bool match = false;
+  std::string_view pattern;
+  std::vector<Entry *> out;
+  // with the prefix index: the keys after this one, `limit` of them at most
+  bool resume = false;
+  std::string_view after;
+  size_t limit = SIZE_MAX;
+  size_t visited = 0;
+  Entry *last = NULL;  // the last key visited
+};
+
+static bool cb_filter_index(void *val, void *arg) {
+  KeyFilter &f = *(KeyFilter *)arg;
+  Entry *ent = (Entry *)val;
+  f.visited++;
+  f.last = ent;
+  if (entry_expired(ent)) {
+    return f.visited < f.limit;  // left to the active expire cycle
+  }
+  if (!f.match || glob_match(f.pattern, entry_key(ent))) {
+    f.out.push_back(ent);
+  }
+  return f.visited < f.limit;
+}
+
+static bool cb_filter(HNode *node, void *arg) {
+  KeyFilter &f = *(KeyFilter *)arg;
+  Entry *ent = container_of(node, Entry, node);
+  if (entry_key(ent).starts_with(f.prefix)) {
+    cb_filter_index(ent, arg);
+  }
   return true;
 }
 
-void do_keys(std::vector<std::string> &, Buffer &buffer) {
-  out_arr(buffer, (uint32_t)hm_size(&g_data.db));
-  hm_foreach(&g_data.db, &cb_keys, (void *)&buffer);
+// O(prefix + keys under it) with the prefix index, a full walk otherwise
+static void keys_filter(KeyFilter &f) {
+  if (g_prefix_index && f.resume) {
+    rt_prefix_after(&g_data.prefix_index, (uint8_t const *)f.prefix.data(), f.prefix.size(),
+                    (uint8_t const *)f.after.data(), f.after.size(), &cb_filter_index, &f);
+  } else if (g_prefix_index) {
+    RTree *index = &g_data.prefix_index;
+    rt_prefix(index, (uint8_t const *)f.prefix.data(), f.prefix.size(), &cb_filter_index, &f);
+  } else {
+    db_foreach(&g_data.db, &cb_filter, &f);
+  }
 }
 
-static bool str2dbl(std::string const &s, double &out) {
+static void out_keys(Buffer &buffer, std::vector<Entry *> const &ents) {
+  out_arr(buffer, (uint32_t)ents.size());
+  for (Entry *ent : ents) {
+    std::string_view key = entry_key(ent);
+    out_str(buffer, key.data(), key.size());
+  }
+}
+
+// keys [pattern]
+void do_keys(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  if (cmd.size() > 2) {
+    return out_err(buffer, ERR_BAD_ARG, "syntax error");
+  }
+  KeyFilter f;
+  if (cmd.size() == 2) {
+    f.match = true;
+    f.pattern = cmd[1];
+    f.prefix = cmd[1].substr(0, glob_prefix_len(cmd[1]));
+  }
+  keys_filter(f);
+  out_keys(buffer, f.out);
+}
+
+// delprefix prefix
+// returns the number of deleted keys
+void do_delprefix(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  KeyFilter f;
+  f.prefix = cmd[1];
+  keys_filter(f);
+  for (Entry *ent : f.out) {
+    Entry *found = keyspace_delete(&ent->node, &hnode_same);
+    assert(found == ent);
+    (void)found;
+    entry_del_lazy(ent);
+  }
+  return out_int(buffer, (int64_t)f.out.size());
+}
+
+// info
+// [name, value, ...] of this shard
+void do_info(std::vector<std::string_view> &, Buffer &buffer) {
+  RTree const &index = g_data.prefix_index;
+  ThreadPoolStats pool = thread_pool_stats(&g_data.thread_pool);
+  std::pair<char const *, int64_t> const stats[] = {
+    {"shard", (int64_t)g_data.shard_id},
+    {"keys", (int64_t)db_size(&g_data.db)},
+    {"prefix_index", g_prefix_index ? 1 : 0},
+    {"prefix_index_nodes", (int64_t)index.nodes},
+    {"prefix_index_bytes", (int64_t)index.bytes},
+    {"pool_workers", (int64_t)pool.workers},
+    {"pool_steals", (int64_t)pool.steals},
+    {"pool_depth_lazy_free", (int64_t)pool.depth[PRIO_LAZY_FREE]},
+    {"pool_depth_flush", (int64_t)pool.depth[PRIO_FLUSH]},
+    {"pool_done_lazy_free", (int64_t)pool.done[PRIO_LAZY_FREE]},
+    {"pool_done_flush", (int64_t)pool.done[PRIO_FLUSH]},
+    {"defrag_active", g_data.defrag.active ? 1 : 0},
+    {"defrag_passes", (int64_t)g_data.defrag.passes},
+    {"defrag_moved", (int64_t)g_data.defrag.moved},
+    {"defrag_reclaimed_bytes", (int64_t)g_data.defrag.reclaimed_bytes},
+  };
+  out_arr(buffer, (uint32_t)(std::size(stats) * 2));
+  for (auto const &stat : stats) {
+    out_str(buffer, stat.first, strlen(stat.first));
+    out_int(buffer, stat.second);
+  }
+}
+
+// memstats
+// [[size, live, requested, reserved, wasted], ...] of the slab classes in use,
+// for the whole process
+void do_memstats(std::vector<std::string_view> &, Buffer &buffer) {
+  SlabClassStats stats[k_slab_classes];
+  slab_stats(stats);
+  uint32_t n = 0;
+  for (SlabClassStats const &s : stats) {
+    n += s.reserved > 0;
+  }
+  out_arr(buffer, n);
+  for (SlabClassStats const &s : stats) {
+    if (s.reserved == 0) {
+      continue;
+    }
+    out_arr(buffer, 5);
+    out_int(buffer, (int64_t)s.size);
+    out_int(buffer, (int64_t)s.live);
+    out_int(buffer, (int64_t)s.requested);
+    out_int(buffer, (int64_t)s.reserved);
+    out_int(buffer, (int64_t)(s.reserved - std::min(s.reserved, s.requested)));
+  }
+}
+
+// the arguments are not NUL-terminated, numbers are short enough for SSO
+static bool str2dbl(std::string_view sv, double &out) {
+  std::string s(sv);
   char *endp = NULL;
   out = strtod(s.c_str(), &endp);
   return endp == s.c_str() + s.size() && !isnan(out);
 }
 
-static bool str2int(std::string const &s, int64_t &out) {
+static bool str2int(std::string_view sv, int64_t &out) {
+  std::string s(sv);
   char *endp = NULL;
   out = strtoll(s.c_str(), &endp, 10);
   return endp == s.c_str() + s.size();
 }
 
-// zadd zset score name
-void do_zadd(std::vector<std::string> &cmd, Buffer &buffer) {
-  double score = 0;
-  if (!str2dbl(cmd[2], score)) {
-    return out_err(buffer, ERR_BAD_ARG, "expect float");
+// [match pattern] [count n] of SCAN and ZSCAN
+struct ScanOpts {
+  bool match = false;
+  std::string_view pattern;
+  int64_t count = 10;  // keys to visit per call, a hint
+};
+
+// each call visits at most count * k_scan_max_steps buckets,
+// so that a sparse table can't make a call unbounded
+int64_t const k_scan_max_steps = 10;
+
+static bool scan_opts(std::vector<std::string_view> &cmd, size_t i, ScanOpts &opts, Buffer &buffer) {
+  for (; i < cmd.size(); i += 2) {
+    if (i + 1 >= cmd.size()) {
+      out_err(buffer, ERR_BAD_ARG, "syntax error");
+      return false;
+    }
+    if (cmd[i] == "match") {
+      opts.match = true;
+      opts.pattern = cmd[i + 1];
+    } else if (cmd[i] == "count") {
+      if (!str2int(cmd[i + 1], opts.count) || opts.count < 1) {
+        out_err(buffer, ERR_BAD_ARG, "expect a positive int");
+        return false;
+      }
+    } else {
+      out_err(buffer, ERR_BAD_ARG, "syntax error");
+      return false;
+    }
+  }
+  return true;
+}
+
+static void cb_scan(HNode *node, void *arg) {
+  ((std::vector<HNode *> *)arg)->push_back(node);
+}
+
+// scan cursor [match pattern] [count n]
+// returns [next cursor, [keys]], start from 0, the scan is over when the
+// cursor is "0" again. A key present for the whole scan is returned at least
+// once, keys added or removed meanwhile may or may not be.
+// The cursor is always a string, sent back as-is: a decimal number, or with
+// the prefix index, "<shard>:<last key>" when a pattern with a literal
+// prefix walks the keys under it in order, `count` keys per call.
+void do_scan(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  // a cursor of the prefix walk
+  std::string_view arg = cmd[1], after;
+  size_t colon = arg.find(':');
+  bool resume = colon != std::string_view::npos;
+  if (resume) {
+    after = arg.substr(colon + 1);
+    arg = arg.substr(0, colon);
+  }
+  int64_t cursor = 0;
+  if (!str2int(arg, cursor) || cursor < 0) {
+    return out_err(buffer, ERR_BAD_ARG, "invalid cursor");
+  }
+  ScanOpts opts;
+  if (!scan_opts(cmd, 2, opts, buffer)) {
+    return;
   }
-  // lookup or create the zset
+  uint64_t shard = (uint64_t)cursor & ((1u << k_scan_shard_bits) - 1);
+  if (shard != g_data.shard_id) {
+    return out_err(buffer, ERR_BAD_ARG, "invalid cursor");
+  }
+  uint64_t tc = (uint64_t)cursor >> k_scan_shard_bits;
+  size_t plen = glob_prefix_len(opts.pattern);
+  bool by_prefix = g_prefix_index && opts.match && plen > 0 && tc == 0;
+  if (resume && !by_prefix) {
+    return out_err(buffer, ERR_BAD_ARG, "invalid cursor");
+  }
+  if (by_prefix) {
+    KeyFilter f;
+    f.match = true;
+    f.pattern = opts.pattern;
+    f.prefix = opts.pattern.substr(0, plen);
+    f.resume = resume;
+    f.after = after;
+    f.limit = (size_t)opts.count;
+    keys_filter(f);
+    std::string next;
+    if (f.visited == f.limit) {
+      // more keys may follow
+      next = std::to_string(shard) + ":";
+      next.append(entry_key(f.last));
+    } else {
+      // this shard is done, continue with the next one
+      next = std::to_string(shard + 1 < g_shards.size() ? shard + 1 : 0);
+    }
+    out_arr(buffer, 2);
+    out_str(buffer, next.data(), next.size());
+    return out_keys(buffer, f.out);
+  }
+  std::vector<HNode *> nodes;
+  int64_t steps = 0;
+  do {
+    tc = db_scan(&g_data.db, tc, &cb_scan, &nodes);
+  } while (tc != 0 && (int64_t)nodes.size() < opts.count
+           && ++steps < opts.count * k_scan_max_steps);
+  // this shard is done, continue with the next one
+  if (tc == 0 && shard + 1 < g_shards.size()) {
+    shard++;
+  } else if (tc == 0) {
+    shard = 0;
+  }
+  std::string next = std::to_string(tc << k_scan_shard_bits | shard);
+  out_arr(buffer, 2);
+  out_str(buffer, next.data(), next.size());
+  out_begin_arr(buffer);
+  uint32_t n = 0;
+  for (HNode *node : nodes) {
+    Entry *ent = container_of(node, Entry, node);
+    std::string_view key = entry_key(ent);
+    if (!entry_expired(ent) && (!opts.match || glob_match(opts.pattern, key))) {
+      out_str(buffer, key.data(), key.size());
+      n++;
+    }
+  }
+  out_end_arr(buffer, n);
+}
+
+// lookup or create a zset, NULL for type mismatch
+static ZSet * upsert_zset(std::string_view s) {
   LookupKey key;
-  key.key.swap(cmd[1]);
+  key.key = s;
   key.node.hcode = str_hash((uint8_t const *)key.key.data(), key.key.size());
-  HNode *hnode = hm_lookup(&g_data.db, &key.node, &entry_eq);
-
-  Entry *ent = NULL;
-  if (!hnode) {  // insert a new key
-    ent = entry_new(T_ZSET);
-    ent->key.swap(key.key);
-    ent->node.hcode = key.node.hcode;
-    hm_insert(&g_data.db, &ent->node);
-  } else {      // check the existing key
-    ent = container_of(hnode, Entry, node);
-    if (ent->type != T_ZSET) {
-      return out_err(buffer, ERR_BAD_TYP, "expect zset");
-    }
+  Entry *ent = keyspace_lookup(&key.node, &entry_eq);
+  if (!ent) {  // insert a new key
+    ent = entry_new_zset(key.key, key.node.hcode);
+    keyspace_insert(ent);
+    return entry_zset(ent);
   }
+  return ent->type == T_ZSET ? entry_zset(ent) : NULL;
+}
 
-  // add or update the tuple
-  std::string const &name = cmd[3];
-  bool added = zset_insert(&ent->zset, name.data(), name.size(), score);
+// zadd zset score name [score name ...]
+void do_zadd(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  if (cmd.size() % 2 != 0) {
+    return out_err(buffer, ERR_BAD_ARG, "wrong number of arguments");
+  }
+  // parse all scores before changing anything
+  std::vector<ZMember> members(cmd.size() / 2 - 1);
+  for (size_t i = 0; i < members.size(); i++) {
+    if (!str2dbl(cmd[2 + i * 2], members[i].score)) {
+      return out_err(buffer, ERR_BAD_ARG, "expect float");
+    }
+    members[i].name = cmd[3 + i * 2].data();
+    members[i].len  = cmd[3 + i * 2].size();
+  }
+  ZSet *zset = upsert_zset(cmd[1]);
+  if (!zset) {
+    return out_err(buffer, ERR_BAD_TYP, "expect zset");
+  }
+  // add or update the tuples
+  size_t added = zset_insert_bulk(zset, members.data(), members.size());
   return out_int(buffer, (int64_t)added);
 }
 
+// zincrby zset incr name
+void do_zincrby(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  double incr = 0;
+  if (!str2dbl(cmd[2], incr)) {
+    return out_err(buffer, ERR_BAD_ARG, "expect float");
+  }
+  ZSet *zset = upsert_zset(cmd[1]);
+  if (!zset) {
+    return out_err(buffer, ERR_BAD_TYP, "expect zset");
+  }
+  std::string_view name = cmd[3];
+  double score = 0;
+  if (!zset_incrby(zset, name.data(), name.size(), incr, score)) {
+    return out_err(buffer, ERR_BAD_ARG, "resulting score is not a number");
+  }
+  return out_dbl(buffer, score);
+}
+
 static ZSet const EMPTY_ZSET;  // for key not exist; NULL for type mismatch
 
-static ZSet * expect_zset(std::string &s) {
+static ZSet * expect_zset(std::string_view s) {
   LookupKey key;
-  key.key.swap(s);
+  key.key = s;
   key.node.hcode = str_hash((uint8_t const *)key.key.data(), key.key.size());
-  HNode *hnode = hm_lookup(&g_data.db, &key.node, &entry_eq);
-  if (!hnode) {  // a non-existent key is treated as an empty zset
+  Entry *ent = keyspace_lookup(&key.node, &entry_eq);
+  if (!ent) {  // a non-existent key is treated as an empty zset
     return (ZSet *)&EMPTY_ZSET;
   }
-  Entry *ent = container_of(hnode, Entry, node);
-  return ent->type == T_ZSET ? &ent->zset : NULL;
+  return ent->type == T_ZSET ? entry_zset(ent) : NULL;
+}
+
+// convert inclusive ranks, negative from the end, into [start, stop).
+// The range is empty if start >= stop.
+static void rank_range(int64_t len, int64_t &start, int64_t &stop) {
+  if (start < 0) {
+    start += len;
+  }
+  if (stop < 0) {
+    stop += len;
+  }
+  start = std::max(start, (int64_t)0);
+  stop = std::min(stop, len - 1) + 1;
+}
+
+// the rank range [start, stop) of the inclusive score range [min, max]
+static void score_range(ZSet *zset, double min, double max, int64_t &start, int64_t &stop) {
+  // the empty name sorts first for a score
+  start = zset_seekge(zset, min, "", 0);
+  stop = (max == INFINITY)
+    ? (int64_t)zset_len(zset) : zset_seekge(zset, nextafter(max, INFINITY), "", 0);
 }
 
 // zrem zset name
-void do_zrem(std::vector<std::string> &cmd, Buffer &buffer) {
+void do_zrem(std::vector<std::string_view> &cmd, Buffer &buffer) {
   ZSet *zset = expect_zset(cmd[1]);
   if (!zset) {
     return out_err(buffer, ERR_BAD_TYP, "expect zset");
   }
 
-  std::string const &name = cmd[2];
-  ZNode *znode = zset_lookup(zset, name.data(), name.size());
-  if (znode) {
-    zset_delete(zset, znode);
-  }
-  return out_int(buffer, znode ? 1 : 0);
+  std::string_view name = cmd[2];
+  bool removed = zset_remove(zset, name.data(), name.size());
+  return out_int(buffer, removed ? 1 : 0);
 }
 
 // zscore zset name
-void do_zscore(std::vector<std::string> &cmd, Buffer &buffer) {
+void do_zscore(std::vector<std::string_view> &cmd, Buffer &buffer) {
   ZSet *zset = expect_zset(cmd[1]);
   if (!zset) {
     return out_err(buffer, ERR_BAD_TYP, "expect zset");
   }
 
-  std::string const &name = cmd[2];
-  ZNode *znode = zset_lookup(zset, name.data(), name.size());
-  return znode ? out_dbl(buffer, znode->score) : out_nil(buffer); 
+  std::string_view name = cmd[2];
+  double score = 0;
+  bool found = zset_score(zset, name.data(), name.size(), score);
+  return found ? out_dbl(buffer, score) : out_nil(buffer);
 }
 
 // zquery zset score name offset limit
-void do_zquery(std::vector<std::string> &cmd, Buffer &buffer) {
+void do_zquery(std::vector<std::string_view> &cmd, Buffer &buffer) {
   // parse the arguments and lookup the KV pair
   double score = 0;
   if (!str2dbl(cmd[2], score)) {
     return out_err(buffer, ERR_BAD_ARG, "expect fp number");
   }
-  std::string const &name = cmd[3];
+  std::string_view name = cmd[3];
   int64_t offset = 0, limit = 0;
   if (!str2int(cmd[4], offset) || !str2int(cmd[5], limit)) {
     return out_err(buffer, ERR_BAD_ARG, "expect int");
@@ -173,35 +574,86 @@ void do_zquery(std::vector<std::string> &cmd, Buffer &buffer) {
   if (limit <= 0) {
     return out_arr(buffer, 0); // empty array
   }
-  ZNode *znode = zset_seekge(zset, score, name.data(), name.size());
+  int64_t rank = zset_seekge(zset, score, name.data(), name.size());
+  if (rank == (int64_t)zset_len(zset)) {
+    return out_arr(buffer, 0);  // nothing to offset from
+  }
   // offset
-  znode = znode_offset(znode, offset);
+  ZIter it = zset_at(zset, rank + offset);
   // iterate and output
   out_begin_arr(buffer);
   int64_t n = 0;
-  while (znode && n < limit) {
-    out_str(buffer, znode->name, znode->len);
-    out_dbl(buffer, znode->score);
-    znode = znode_offset(znode, +1);
+  while (zit_valid(it) && n < limit) {
+    out_str(buffer, it.name, it.len);
+    out_dbl(buffer, it.score);
+    zit_next(it);
     n++;
   }
   out_end_arr(buffer, (uint32_t)(n * 2));
 }
 
+// zrange zset start stop [withscores]
+// zrevrange zset start stop [withscores]
+// inclusive ranks, negative from the end
+static void zrange(std::vector<std::string_view> &cmd, Buffer &buffer, bool rev) {
+  bool withscores = false;
+  if (cmd.size() == 5) {
+    if (cmd[4] != "withscores") {
+      return out_err(buffer, ERR_BAD_ARG, "syntax error");
+    }
+    withscores = true;
+  } else if (cmd.size() > 5) {
+    return out_err(buffer, ERR_BAD_ARG, "syntax error");
+  }
+  int64_t start = 0, stop = 0;
+  if (!str2int(cmd[2], start) || !str2int(cmd[3], stop)) {
+    return out_err(buffer, ERR_BAD_ARG, "expect int");
+  }
+  ZSet *zset = expect_zset(cmd[1]);
+  if (!zset) {
+    return out_err(buffer, ERR_BAD_TYP, "expect zset");
+  }
+  int64_t len = (int64_t)zset_len(zset);
+  rank_range(len, start, stop);
+  if (start >= stop) {
+    return out_arr(buffer, 0);
+  }
+  // walk from the first rank in the output order
+  ZIter it = zset_at(zset, rev ? len - 1 - start : start);
+  out_begin_arr(buffer);
+  int64_t n = 0;
+  for (; zit_valid(it) && n < stop - start; n++) {
+    out_str(buffer, it.name, it.len);
+    if (withscores) {
+      out_dbl(buffer, it.score);
+    }
+    rev ? zit_prev(it) : zit_next(it);
+  }
+  out_end_arr(buffer, (uint32_t)(withscores ? n * 2 : n));
+}
+
+void do_zrange(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  zrange(cmd, buffer, false);
+}
+
+void do_zrevrange(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  zrange(cmd, buffer, true);
+}
+
 // zrank zset name
-void do_zrank(std::vector<std::string> &cmd, Buffer &buffer) {
+void do_zrank(std::vector<std::string_view> &cmd, Buffer &buffer) {
   ZSet *zset = expect_zset(cmd[1]);
   if (!zset) {
     return out_err(buffer, ERR_BAD_TYP, "expect zset");
   }
 
-  std::string const &name = cmd[2];
-  ZNode *znode = zset_lookup(zset, name.data(), name.size());
-  return znode ? out_int(buffer, avl_rank(&znode->tree)) : out_nil(buffer);
+  std::string_view name = cmd[2];
+  int64_t rank = zset_rank(zset, name.data(), name.size());
+  return rank >= 0 ? out_int(buffer, rank) : out_nil(buffer);
 }
 
 // zcount zset score1 name1 score2 name2(exclusive)
-void do_zcount(std::vector<std::string> &cmd, Buffer &buffer) {
+void do_zcount(std::vector<std::string_view> &cmd, Buffer &buffer) {
   double score1 = 0, score2 = 0;
   if (!str2dbl(cmd[2], score1) || !str2dbl(cmd[4], score2)) {
     return out_err(buffer, ERR_BAD_ARG, "expect fp number");
@@ -210,15 +662,14 @@ void do_zcount(std::vector<std::string> &cmd, Buffer &buffer) {
   if (!zset) {
     return out_err(buffer, ERR_BAD_TYP, "expect zset");
   }
-  std::string const &name1 = cmd[3];
-  std::string const &name2 = cmd[5];
-  ZNode *znode1 = zset_seekge(zset, score1, name1.data(), name1.size());
-  ZNode *znode2 = zset_seekge(zset, score2, name2.data(), name2.size());
-  if (!znode1 || !znode2) {
+  std::string_view name1 = cmd[3];
+  std::string_view name2 = cmd[5];
+  int64_t len = (int64_t)zset_len(zset);
+  int64_t rank1 = zset_seekge(zset, score1, name1.data(), name1.size());
+  int64_t rank2 = zset_seekge(zset, score2, name2.data(), name2.size());
+  if (rank1 == len || rank2 == len) {
     return out_int(buffer, 0);
   }
-  int64_t rank1 = avl_rank(&znode1->tree);
-  int64_t rank2 = avl_rank(&znode2->tree);
   int64_t count = rank2 - rank1;
   if (count < 0) {
     count = 0;
@@ -226,37 +677,181 @@ void do_zcount(std::vector<std::string> &cmd, Buffer &buffer) {
   return out_int(buffer, count);
 }
 
+// zremrangebyrank zset start stop (inclusive, negative from the end)
+void do_zremrangebyrank(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  int64_t start = 0, stop = 0;
+  if (!str2int(cmd[2], start) || !str2int(cmd[3], stop)) {
+    return out_err(buffer, ERR_BAD_ARG, "expect int");
+  }
+  ZSet *zset = expect_zset(cmd[1]);
+  if (!zset) {
+    return out_err(buffer, ERR_BAD_TYP, "expect zset");
+  }
+  rank_range((int64_t)zset_len(zset), start, stop);
+  ZNode *garbage = NULL;
+  size_t count = zset_remove_range(zset, start, stop, &garbage);
+  zset_garbage_del(garbage, count);
+  return out_int(buffer, (int64_t)count);
+}
+
+// zremrangebyscore zset min max (inclusive)
+void do_zremrangebyscore(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  double min = 0, max = 0;
+  if (!str2dbl(cmd[2], min) || !str2dbl(cmd[3], max)) {
+    return out_err(buffer, ERR_BAD_ARG, "expect fp number");
+  }
+  ZSet *zset = expect_zset(cmd[1]);
+  if (!zset) {
+    return out_err(buffer, ERR_BAD_TYP, "expect zset");
+  }
+  int64_t start = 0, stop = 0;
+  score_range(zset, min, max, start, stop);
+  ZNode *garbage = NULL;
+  size_t count = zset_remove_range(zset, start, stop, &garbage);
+  zset_garbage_del(garbage, count);
+  return out_int(buffer, (int64_t)count);
+}
+
+// zsumrange zset start stop [byscore] [avg]
+// the sum or the average of the scores in an inclusive rank range,
+// negative from the end, or in an inclusive score range with `byscore`
+void do_zsumrange(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  bool byscore = false, avg = false;
+  for (size_t i = 4; i < cmd.size(); i++) {
+    if (cmd[i] == "byscore" && !byscore) {
+      byscore = true;
+    } else if (cmd[i] == "avg" && !avg) {
+      avg = true;
+    } else {
+      return out_err(buffer, ERR_BAD_ARG, "syntax error");
+    }
+  }
+  int64_t start = 0, stop = 0;
+  double min = 0, max = 0;
+  if (byscore) {
+    if (!str2dbl(cmd[2], min) || !str2dbl(cmd[3], max)) {
+      return out_err(buffer, ERR_BAD_ARG, "expect fp number");
+    }
+  } else if (!str2int(cmd[2], start) || !str2int(cmd[3], stop)) {
+    return out_err(buffer, ERR_BAD_ARG, "expect int");
+  }
+  ZSet *zset = expect_zset(cmd[1]);
+  if (!zset) {
+    return out_err(buffer, ERR_BAD_TYP, "expect zset");
+  }
+  if (byscore) {
+    score_range(zset, min, max, start, stop);
+  } else {
+    rank_range((int64_t)zset_len(zset), start, stop);
+  }
+  double sum = zset_range_sum(zset, start, stop);
+  if (!avg) {
+    return out_dbl(buffer, sum);
+  }
+  return start < stop ? out_dbl(buffer, sum / (double)(stop - start)) : out_nil(buffer);
+}
+
+// zquantile zset p
+// the score at the nearest rank of the percentile, 0 <= p <= 1
+void do_zquantile(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  double p = 0;
+  if (!str2dbl(cmd[2], p) || p < 0 || p > 1) {
+    return out_err(buffer, ERR_BAD_ARG, "expect a number in [0, 1]");
+  }
+  ZSet *zset = expect_zset(cmd[1]);
+  if (!zset) {
+    return out_err(buffer, ERR_BAD_TYP, "expect zset");
+  }
+  int64_t len = (int64_t)zset_len(zset);
+  if (len == 0) {
+    return out_nil(buffer);
+  }
+  int64_t rank = std::max((int64_t)ceil(p * (double)len) - 1, (int64_t)0);
+  ZIter it = zset_at(zset, rank);
+  return out_dbl(buffer, it.score);
+}
+
+// zscan zset cursor [match pattern] [count n]
+// returns [next cursor, [name, score, ...]], like SCAN over the names.
+// A listpack encoded set is returned at once.
+void do_zscan(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  int64_t cursor = 0;
+  if (!str2int(cmd[2], cursor) || cursor < 0) {
+    return out_err(buffer, ERR_BAD_ARG, "invalid cursor");
+  }
+  ScanOpts opts;
+  if (!scan_opts(cmd, 3, opts, buffer)) {
+    return;
+  }
+  ZSet *zset = expect_zset(cmd[1]);
+  if (!zset) {
+    return out_err(buffer, ERR_BAD_TYP, "expect zset");
+  }
+  if (zset->lp) {
+    out_arr(buffer, 2);
+    out_int(buffer, 0);
+    out_begin_arr(buffer);
+    uint32_t n = 0;
+    for (ZIter it = zset_at(zset, 0); zit_valid(it); zit_next(it)) {
+      if (!opts.match || glob_match(opts.pattern, std::string_view(it.name, it.len))) {
+        out_str(buffer, it.name, it.len);
+        out_dbl(buffer, it.score);
+        n += 2;
+      }
+    }
+    return out_end_arr(buffer, n);
+  }
+  uint64_t tc = (uint64_t)cursor;
+  std::vector<HNode *> nodes;
+  int64_t steps = 0;
+  do {
+    tc = hm_scan(&zset->hmap, tc, &cb_scan, &nodes);
+  } while (tc != 0 && (int64_t)nodes.size() < opts.count
+           && ++steps < opts.count * k_scan_max_steps);
+  out_arr(buffer, 2);
+  out_int(buffer, (int64_t)tc);
+  out_begin_arr(buffer);
+  uint32_t n = 0;
+  for (HNode *node : nodes) {
+    ZNode *znode = container_of(node, ZNode, hmap);
+    if (!opts.match || glob_match(opts.pattern, std::string_view(znode->name, znode->len))) {
+      out_str(buffer, znode->name, znode->len);
+      out_dbl(buffer, znode->score);
+      n += 2;
+    }
+  }
+  out_end_arr(buffer, n);
+}
+
 // pexpire key ttl_ms(negative to remove e.g. persist)
-void do_expire(std::vector<std::string> &cmd, Buffer &buffer) {
+void do_expire(std::vector<std::string_view> &cmd, Buffer &buffer) {
   int64_t ttl_ms = 0;
   if (!str2int(cmd[2], ttl_ms)) {
     return out_err(buffer, ERR_BAD_ARG, "expect int64");
   }
   LookupKey key;
-  key.key.swap(cmd[1]);
+  key.key = cmd[1];
   key.node.hcode = str_hash((uint8_t const *)key.key.data(), key.key.size());
-  HNode *node = hm_lookup(&g_data.db, &key.node, &entry_eq);
-  if (node) {
-    Entry *ent = container_of(node, Entry, node);
+  Entry *ent = keyspace_lookup(&key.node, &entry_eq);
+  if (ent) {
     entry_set_ttl(ent, ttl_ms);
   }
-  return out_int(buffer, node ? 1 : 0);  // the number of updated keys
+  return out_int(buffer, ent ? 1 : 0);  // the number of updated keys
 }
 
 // pttl key
-void do_ttl(std::vector<std::string> &cmd, Buffer &buffer) {
+void do_ttl(std::vector<std::string_view> &cmd, Buffer &buffer) {
   LookupKey key;
-  key.key.swap(cmd[1]);
+  key.key = cmd[1];
   key.node.hcode = str_hash((uint8_t const *)key.key.data(), key.key.size());
-  HNode *node = hm_lookup(&g_data.db, &key.node, &entry_eq);
-  if (!node) {
+  Entry *ent = keyspace_lookup(&key.node, &entry_eq);
+  if (!ent) {
     return out_int(buffer, -2);  // not found
   }
-  Entry *ent = container_of(node, Entry, node);
-  if (ent->heap_idx == (size_t)-1) {
+  if (!ent->ttl) {
     return out_int(buffer, -1);  // no TTL
   }
-  uint64_t expire_at = g_data.heap[ent->heap_idx].val;
+  uint64_t expire_at = ent->ttl->tw.expire_at;
   uint64_t now_ms = get_monotonic_msec();
   return out_int(buffer, expire_at > now_ms ? (int64_t)(expire_at - now_ms) : 0);
 }
@@ -1,14 +1,19 @@
 #include "byoredis/server/conn.hh"
 #include "byoredis/common/log.hh"
 #include "byoredis/common/net.hh"
+#include "byoredis/common/slab.hh"
 #include "byoredis/proto/tlv.hh"
 #include "byoredis/server/commands.hh"
 #include "byoredis/server/time.hh"
 #include "byoredis/server/db.hh"
+#include "byoredis/server/shard.hh"
+#include "byoredis/server/uring.hh"
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <errno.h>
 
 static inline void epoll_update_interest(Conn *conn) {
@@ -26,10 +31,61 @@ void conn_destroy(Conn *conn) {
   if (g_data.epoll_fd >= 0 && conn->fd >= 0) {
     epoll_ctl(g_data.epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
   }
+  if (conn->io_pending > 0) {
+    // terminate the io_uring operations still holding the socket
+    (void)shutdown(conn->fd, SHUT_RDWR);
+  }
   (void)close(conn->fd);
   g_data.fd2conn[conn->fd] = NULL;
   dlist_detach(&conn->idle_node);
-  delete conn;
+  if (conn->io_pending > 0) {
+    conn->fd = -1;  // freed by the last completion
+    g_data.uring->closing++;
+    return;
+  }
+  conn_free(conn);
+}
+
+void conn_free(Conn *conn) {
+  conn->~Conn();
+  slab_free(conn, sizeof(Conn));
+}
+
+void conn_touch(Conn *conn) {
+  // move conn to the end of the list
+  conn->last_active_ms = get_monotonic_msec();
+  dlist_detach(&conn->idle_node);
+  dlist_insert_before(&g_data.idle_list, &conn->idle_node);
+}
+
+Conn *conn_new(int connfd) {
+  // set the new connection non-blocking
+  fd_set_nb(connfd);
+  // create a new connection object
+  Conn *conn = new (slab_alloc(sizeof(Conn))) Conn();
+  conn->fd = connfd;
+  conn->id = g_data.next_conn_id++;
+  conn->want_read = true;
+  conn->last_active_ms = get_monotonic_msec();
+  dlist_insert_before(&g_data.idle_list, &conn->idle_node);
+  // put it into the map
+  if (g_data.fd2conn.size() <= (size_t)conn->fd) {
+    g_data.fd2conn.resize(conn->fd + 1);
+  }
+  assert(!g_data.fd2conn[conn->fd]);
+  g_data.fd2conn[conn->fd] = conn;
+  // register to epoll
+  if (g_data.epoll_fd >= 0) {
+    struct epoll_event ev = {};
+    ev.data.fd = conn->fd;
+    ev.events = EPOLLIN | EPOLLERR; // initial interest
+    if (epoll_ctl(g_data.epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) < 0) {
+      msg_errno("epoll_ctl(ADD) failed");
+      conn_destroy(conn);
+      return NULL;
+    }
+  }
+  return conn;
 }
 
 // application callback when the listening socket is ready
@@ -55,49 +111,27 @@ int32_t handle_accept(int fd) {
       ip & 255, (ip >> 8) & 255, (ip >> 16) & 255, ip >> 24,
       ntohs(client_addr.sin_port)
     );
-    // set the new connection non-blocking
-    fd_set_nb(connfd);
-    // create a new connection object
-    Conn *conn = new Conn();
-    conn->fd = connfd;
-    conn->want_read = true;
-    conn->last_active_ms = get_monotonic_msec();
-    dlist_insert_before(&g_data.idle_list, &conn->idle_node);
-    // put it into the map
-    if (g_data.fd2conn.size() <= (size_t)conn->fd) {
-      g_data.fd2conn.resize(conn->fd + 1);
-    }
-    assert(!g_data.fd2conn[conn->fd]);
-    g_data.fd2conn[conn->fd] = conn;
-    // register to epoll
-    if (g_data.epoll_fd >= 0) {
-      struct epoll_event ev = {};
-      ev.data.fd = conn->fd;
-      ev.events = EPOLLIN | EPOLLERR; // initial interest
-      if (epoll_ctl(g_data.epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) < 0) {
-        msg_errno("epoll_ctl(ADD) failed");
-        // fallback: close the connection and continue draining
-        conn_destroy(conn);
-        continue;
-      }
+    if (!conn_new(connfd)) {
+      continue;  // fallback: the connection is closed, continue draining
     }
     ++accepted;
   }
   return 0;
 }
 
-void handle_read(Conn *conn) {
-  // read some data
+// read some data, returns false if nothing was read.
+// Doesn't touch the event loop state, may run on an I/O thread.
+bool conn_read(Conn *conn) {
   uint8_t buf[64 * 1024];
   ssize_t rv = read(conn->fd, buf, sizeof(buf));
   if (rv < 0 && errno == EAGAIN) {
-    return;  // actually not ready
+    return false;  // actually not ready
   }
   // handle IO error
   if (rv < 0) {
     msg_errno("read() error");
     conn->want_close = true;
-    return;
+    return false;
   }
   // handle EOF
   if (rv == 0) {
@@ -107,12 +141,20 @@ void handle_read(Conn *conn) {
       msg("unexpected EOF");
     }
     conn->want_close = true;
-    return;  // want close
+    return false;  // want close
   }
   // got some new data
   conn->incoming.append(buf, (size_t)rv);
-  // parse requests and generate responses
-  while (try_process_one_request(conn)) {}
+  return true;
+}
+
+void handle_read(Conn *conn) {
+  if (conn_read(conn)) {
+    conn_process(conn);
+  }
+}
+
+static void conn_shrink_incoming(Conn *conn) {
   size_t unread = conn->incoming.readable_size();
   if (unread == 0) {
     conn->incoming.shrink_if_wasteful();
@@ -121,10 +163,19 @@ void handle_read(Conn *conn) {
              && unread < 4096) {
     conn->incoming.shrink_if_wasteful();
   }
+}
+
+void conn_process(Conn *conn) {
+  // parse requests and generate responses
+  while (try_process_one_request(conn)) {}
+  conn_shrink_incoming(conn);
   // update the readiness intention
-  if (conn->outgoing.readable_size() > 0) {  // has a response
+  if (conn->outgoing.output_size() > 0) {  // has a response
     conn->want_read = false;
     conn->want_write = true;
+    if (g_data.uring) {
+      return uring_send(conn);  // submitted with the next batch
+    }
     // The socket is likely ready to write in a request-response protocol,
     // try to write it without waiting for the next iteration.
     return handle_write(conn);
@@ -132,30 +183,48 @@ void handle_read(Conn *conn) {
   epoll_update_interest(conn);
 }
 
-// application callback when the socket is writable
-void handle_write(Conn *conn) {
-  assert(conn->outgoing.readable_size() > 0);
-  ssize_t rv = write(conn->fd, conn->outgoing.readable_data(), conn->outgoing.readable_size());
+// write as much as the socket takes, the referenced values are gathered
+// with the buffered bytes in a single writev().
+// Doesn't touch the event loop state, may run on an I/O thread.
+void conn_write(Conn *conn) {
+  struct iovec iov[k_max_iov];
+  size_t n = conn->outgoing.fill_iov(iov, k_max_iov);
+  ssize_t rv = writev(conn->fd, iov, (int)n);
   if (rv < 0 && errno == EAGAIN) {
-    epoll_update_interest(conn);
     return;  // actually not ready
   }
   if (rv < 0) {
-    msg_errno("write() error");
+    msg_errno("writev() error");
     conn->want_close = true;  // error handling
     return;
   }
   // remove written data from outgoing
   conn->outgoing.consume((size_t)rv);
-  // update the readiness intention
-  if (conn->outgoing.readable_size() == 0) {  // all data written
+}
+
+void conn_update_io(Conn *conn) {
+  if (conn->outgoing.output_size() == 0) {    // all data written
     conn->want_write = false;
     conn->want_read = true;
     conn->outgoing.shrink_if_wasteful(1u << 20);
-  } // else: want write
+  } else {                                    // want write
+    conn->want_write = true;
+    conn->want_read = false;
+  }
   epoll_update_interest(conn);
 }
 
+// application callback when the socket is writable
+void handle_write(Conn *conn) {
+  assert(conn->outgoing.output_size() > 0);
+  conn_write(conn);
+  if (conn->want_close) {
+    return;
+  }
+  // update the readiness intention
+  conn_update_io(conn);
+}
+
 static void response_begin(Buffer &buf) {
   // buf.message_begin();
   buf.push_placeholder(); // reserve space for message length
@@ -164,7 +233,8 @@ static void response_begin(Buffer &buf) {
 
 static size_t response_size(Buffer &buf) {
   // return buf.message_size();
-  return buf.writable_begin - buf.peek_placeholder() - 4;
+  size_t pos = buf.peek_placeholder();
+  return buf.writable_begin - pos - 4 + buf.ref_bytes_after(pos);
 }
 
 static void response_end(Buffer &buf) {
@@ -172,7 +242,7 @@ static void response_end(Buffer &buf) {
   if (msg_size > k_max_msg) {
     // rollback payload to just after header placeholder
     // buf.writable_begin = buf.inflight_header_pos + 4;
-    buf.writable_begin = buf.peek_placeholder() + 4;
+    buf.truncate(buf.peek_placeholder() + 4);
     out_err(buf, ERR_TOO_BIG, "response too big");
     msg_size = response_size(buf);
   }
@@ -180,45 +250,113 @@ static void response_end(Buffer &buf) {
   memcpy(&buf.buf[buf.pop_placeholder()], &len, 4);
 }
 
-// process 1 request if there is enough data in the incoming buffer
-bool try_process_one_request(Conn *conn) {
+// parse 1 request at `offset` into the incoming buffer if there is enough data.
+// The arguments are appended to `args` and point into the buffer.
+// Returns the size of the request, 0 if more data is needed, -1 on error.
+static int64_t parse_one_request(Conn *conn, size_t offset, std::vector<std::string_view> &args) {
+  uint8_t const *data = conn->incoming.readable_data() + offset;
+  size_t size = conn->incoming.readable_size() - offset;
   // try to parse the protocol: message header
-  if (conn->incoming.readable_size() < 4) {
-    return false;  // want read
+  if (size < 4) {
+    return 0;  // want read
   }
   uint32_t len = 0;
-  memcpy(&len, conn->incoming.readable_data(), 4);
+  memcpy(&len, data, 4);
   if (len > k_max_msg) {
     die("request too large");
     conn->want_close = true;
-    return false;  // want close
+    return -1;  // want close
   }
   // message body
-  if (4 + len > conn->incoming.readable_size()) {
-    return false;  // want read
+  if (4 + len > size) {
+    return 0;  // want read
   }
-  uint8_t const *request = conn->incoming.readable_data() + 4;
-  // got some request, do some application logic
-  std::vector<std::string> cmd;
-  if (parse_req(request, len, cmd) < 0) {
+  if (parse_req(data + 4, len, args) < 0) {
     msg("bad request");
     conn->want_close = true;
-    return false;  // want close
+    return -1;  // want close
   }
+  return 4 + (int64_t)len;
+}
+
+static void execute_one_request(Conn *conn, std::vector<std::string_view> &cmd) {
   response_begin(conn->outgoing);
   do_request_and_make_response(cmd, conn->outgoing);
   response_end(conn->outgoing);
+}
+
+// process 1 request if there is enough data in the incoming buffer
+bool try_process_one_request(Conn *conn) {
+  if (conn->blocked) {
+    return false;  // wait for the forwarded request
+  }
+  std::vector<std::string_view> &cmd = conn->args;
+  cmd.clear();
+  int64_t n = parse_one_request(conn, 0, cmd);
+  if (n <= 0) {
+    return false;
+  }
+  // got some request, do some application logic
+  if (shard_forward(conn, cmd)) {
+    // the key is owned by another shard, resumed by conn_resume()
+    conn->blocked = true;
+    conn->incoming.consume((size_t)n);
+    return false;
+  }
+  execute_one_request(conn, cmd);
   // application logic done, remove the request from the incoming buffer
-  conn->incoming.consume(4 + len);
+  conn->incoming.consume((size_t)n);
   return true;
 }
 
+// The requests are left in `incoming` because the arguments point into it,
+// conn_execute() consumes them.
+void conn_parse(Conn *conn) {
+  conn->parsed_args.clear();
+  conn->parsed_argc.clear();
+  size_t offset = 0;
+  while (true) {
+    size_t nargs = conn->parsed_args.size();
+    int64_t n = parse_one_request(conn, offset, conn->parsed_args);
+    if (n <= 0) {
+      conn->parsed_args.resize(nargs);  // drop a partial request
+      break;
+    }
+    conn->parsed_argc.push_back((uint32_t)(conn->parsed_args.size() - nargs));
+    offset += (size_t)n;
+  }
+  conn->parsed_bytes = offset;
+}
+
+void conn_execute(Conn *conn) {
+  std::string_view const *arg = conn->parsed_args.data();
+  for (uint32_t argc : conn->parsed_argc) {
+    conn->args.assign(arg, arg + argc);
+    execute_one_request(conn, conn->args);
+    arg += argc;
+  }
+  conn->parsed_args.clear();
+  conn->parsed_argc.clear();
+  conn->incoming.consume(conn->parsed_bytes);
+  conn->parsed_bytes = 0;
+  conn_shrink_incoming(conn);
+}
+
+void conn_resume(Conn *conn, ShardCall *call) {
+  response_begin(conn->outgoing);
+  call->merge(call, conn->outgoing);
+  response_end(conn->outgoing);
+  conn->blocked = false;
+  // continue with the pipelined requests
+  conn_process(conn);
+}
+
 // payload
 // +------|-----|------|-----|------|-----|-----|------+
 // | nstr | len | str1 | len | str2 | ... | len | strn |
 // +------|-----|------|-----|------|-----|-----|------+
 
-int32_t parse_req(uint8_t const *data, size_t size, std::vector<std::string> &out) {
+int32_t parse_req(uint8_t const *data, size_t size, std::vector<std::string_view> &out) {
   uint8_t const *end = data + size;
   uint32_t nstr = 0;
   if (!read_u32(data, end, nstr)) {
@@ -227,12 +365,12 @@ int32_t parse_req(uint8_t const *data, size_t size, std::vector<std::string> &ou
   if (nstr > k_max_args) {
     return -1;
   }
-  while (out.size() < nstr) {
+  for (uint32_t i = 0; i < nstr; i++) {
     uint32_t len = 0;
     if (!read_u32(data, end, len)) {
       return -1;
     }
-    out.push_back(std::string());
+    out.push_back(std::string_view());
     if (!read_str(data, end, len, out.back())) {
       return -1;
     }
@@ -243,32 +381,13 @@ int32_t parse_req(uint8_t const *data, size_t size, std::vector<std::string> &ou
   return 0;
 }
 
-void do_request_and_make_response(std::vector<std::string> &cmd, Buffer &buffer) {
-  if (cmd.size() == 2 && cmd[0] == "get") {
-    return do_get(cmd, buffer);
-  } else if (cmd.size() == 3 && cmd[0] == "set") {
-    return do_set(cmd, buffer);
-  } else if (cmd.size() == 2 && cmd[0] == "del") {
-    return do_del(cmd, buffer);
-  } else if (cmd.size() == 1 && cmd[0] == "keys") {
-    return do_keys(cmd, buffer);
-  } else if (cmd.size() == 4 && cmd[0] == "zadd") {
-    return do_zadd(cmd, buffer);
-  } else if (cmd.size() == 3 && cmd[0] == "zrem") {
-    return do_zrem(cmd, buffer);
-  } else if (cmd.size() == 3 && cmd[0] == "zscore") {
-    return do_zscore(cmd, buffer);
-  } else if (cmd.size() == 6 && cmd[0] == "zquery") {
-    return do_zquery(cmd, buffer);
-  } else if (cmd.size() == 3 && cmd[0] == "zrank") {
-    return do_zrank(cmd, buffer);
-  } else if (cmd.size() == 6 && cmd[0] == "zcount") {
-    return do_zcount(cmd, buffer);
-  } else if (cmd.size() == 3 && cmd[0] == "pexpire") {
-    return do_expire(cmd, buffer);
-  } else if (cmd.size() == 2 && cmd[0] == "pttl") {
-    return do_ttl(cmd, buffer);
-  } else {
+void do_request_and_make_response(std::vector<std::string_view> &cmd, Buffer &buffer) {
+  Command const *c = cmd.empty() ? NULL : cmd_lookup(cmd[0]);
+  if (!c) {
     return out_err(buffer, ERR_UNKNOWN, "unknown command");
   }
+  if (!cmd_arity_ok(c, cmd.size())) {
+    return out_err(buffer, ERR_BAD_ARG, "wrong number of arguments");
+  }
+  return c->handler(cmd, buffer);
 }
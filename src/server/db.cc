@@ -1,22 +1,217 @@
 #include "byoredis/server/db.hh"
 #include "byoredis/ds/intrusive.hh"  // for container_of
+#include "byoredis/common/slab.hh"
 #include "byoredis/ds/zset.hh"
 #include "byoredis/server/time.hh"
 #include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
 
-GlobalData g_data{};
+thread_local GlobalData g_data{};
+std::vector<GlobalData *> g_shards;
+bool g_prefix_index = false;
 
-Entry * entry_new(uint32_t type) {
-  Entry *ent = new Entry();
-  ent->type = type;
+void keyspace_insert(Entry *ent) {
+  db_insert(&g_data.db, &ent->node);
+  if (g_prefix_index) {
+    // replaces the old address of a reallocated entry
+    std::string_view key = entry_key(ent);
+    rt_insert(&g_data.prefix_index, (uint8_t const *)key.data(), key.size(), ent);
+  }
+}
+
+Entry * keyspace_lookup(HNode *key, bool (*eq)(HNode *, HNode *)) {
+  HNode *node = db_lookup(&g_data.db, key, eq);
+  if (!node) {
+    return NULL;
+  }
+  Entry *ent = container_of(node, Entry, node);
+  if (entry_expired(ent)) {
+    keyspace_delete(&ent->node, &hnode_same);
+    entry_del_lazy(ent);
+    return NULL;
+  }
+  return ent;
+}
+
+Entry * keyspace_delete(HNode *key, bool (*eq)(HNode *, HNode *)) {
+  HNode *node = db_delete(&g_data.db, key, eq);
+  if (!node) {
+    return NULL;
+  }
+  Entry *ent = container_of(node, Entry, node);
+  if (g_prefix_index) {
+    std::string_view k = entry_key(ent);
+    void *val = rt_delete(&g_data.prefix_index, (uint8_t const *)k.data(), k.size());
+    assert(val == ent);
+    (void)val;
+  }
+  return ent;
+}
+
+// the length class of the key length
+static uint8_t key_len_class(size_t len) {
+  return len < (1u << 8) ? 0 : len < (1u << 16) ? 1 : 2;
+}
+
+static size_t key_len_size(uint8_t enc) {
+  return (size_t)1 << (enc & ENC_KEY_LEN);
+}
+
+static size_t key_len(Entry const *ent) {
+  uint32_t len = 0;  // little-endian
+  memcpy(&len, ent->data, key_len_size(ent->enc));
+  return len;
+}
+
+// where the value starts
+static uint8_t * entry_val(Entry const *ent) {
+  return (uint8_t *)ent->data + key_len_size(ent->enc) + key_len(ent);
+}
+
+static size_t str_val_size(std::string_view val) {
+  return val.size() <= k_max_inline_str ? 1 + val.size() : sizeof(Blob *);
+}
+
+// the allocation size
+static size_t entry_size(Entry const *ent) {
+  size_t val_size = (ent->type == T_ZSET) ? sizeof(ZSet *)
+    : (ent->enc & ENC_STR_INLINE) ? 1 + entry_val(ent)[0] : sizeof(Blob *);
+  return (size_t)(entry_val(ent) - (uint8_t const *)ent) + val_size;
+}
+
+static void str_val_init(Entry *ent, std::string_view val) {
+  uint8_t *p = entry_val(ent);
+  if (val.size() <= k_max_inline_str) {
+    ent->enc |= ENC_STR_INLINE;
+    p[0] = (uint8_t)val.size();
+    memcpy(p + 1, val.data(), val.size());
+  } else {
+    ent->enc &= ~ENC_STR_INLINE;
+    Blob *blob = blob_new(val);
+    memcpy(p, &blob, sizeof(blob));
+  }
+}
+
+static Entry * entry_alloc(uint8_t type, std::string_view key, uint64_t hcode, size_t val_size) {
+  uint8_t cls = key_len_class(key.size());
+  size_t hdr = (size_t)1 << cls;
+  Entry *ent = (Entry *)slab_alloc(offsetof(Entry, data) + hdr + key.size() + val_size);
+  ent->node.next  = NULL;
+  ent->node.hcode = hcode;
+  ent->ttl        = NULL;
+  ent->type       = type;
+  ent->enc        = cls;
+  uint32_t len = (uint32_t)key.size();
+  memcpy(ent->data, &len, hdr);
+  memcpy(ent->data + hdr, key.data(), key.size());
+  return ent;
+}
+
+Entry * entry_new_str(std::string_view key, uint64_t hcode, std::string_view val) {
+  Entry *ent = entry_alloc(T_STR, key, hcode, str_val_size(val));
+  str_val_init(ent, val);
+  return ent;
+}
+
+Entry * entry_new_zset(std::string_view key, uint64_t hcode) {
+  Entry *ent = entry_alloc(T_ZSET, key, hcode, sizeof(ZSet *));
+  ZSet *zset = new ZSet();
+  memcpy(entry_val(ent), &zset, sizeof(zset));
+  return ent;
+}
+
+std::string_view entry_key(Entry const *ent) {
+  return std::string_view((char const *)ent->data + key_len_size(ent->enc), key_len(ent));
+}
+
+Blob * entry_blob(Entry const *ent) {
+  assert(ent->type == T_STR);
+  if (ent->enc & ENC_STR_INLINE) {
+    return NULL;
+  }
+  Blob *blob = NULL;
+  memcpy(&blob, entry_val(ent), sizeof(blob));
+  return blob;
+}
+
+std::string_view entry_str(Entry const *ent) {
+  if (Blob *blob = entry_blob(ent)) {
+    return blob_view(blob);
+  }
+  uint8_t const *p = entry_val(ent);
+  return std::string_view((char const *)p + 1, p[0]);
+}
+
+ZSet * entry_zset(Entry const *ent) {
+  assert(ent->type == T_ZSET);
+  ZSet *zset = NULL;
+  memcpy(&zset, entry_val(ent), sizeof(zset));
+  return zset;
+}
+
+Entry * entry_set_str(Entry *ent, std::string_view val) {
+  assert(ent->type == T_STR);
+  // the old value may still be referenced by pending responses
+  if (Blob *blob = entry_blob(ent)) {
+    blob_unref(blob);
+  }
+  size_t old_size = entry_size(ent);
+  size_t size = (size_t)(entry_val(ent) - (uint8_t *)ent) + str_val_size(val);
+  if (slab_size(old_size) == slab_size(size)) {
+    // fits in place
+    ent = (Entry *)slab_realloc(ent, old_size, size);
+  } else {
+    // unlink, move, relink; the prefix index is updated by the relink
+    HNode *node = db_delete(&g_data.db, &ent->node, &hnode_same);
+    assert(node == &ent->node);
+    (void)node;
+    ent = (Entry *)slab_realloc(ent, old_size, size);
+    keyspace_insert(ent);
+  }
+  if (ent->ttl) {
+    ent->ttl->ent = ent;
+  }
+  str_val_init(ent, val);
   return ent;
 }
 
+Entry * entry_defrag(Entry *ent, uint64_t *released) {
+  size_t size = entry_size(ent);
+  Entry *moved = (Entry *)slab_defrag_move(ent, size);
+  if (!moved) {
+    return ent;
+  }
+  if (EntryTimer *timer = moved->ttl) {
+    // the timer is moved along
+    if (EntryTimer *t = (EntryTimer *)slab_defrag_move(timer, sizeof(EntryTimer))) {
+      tw_moved(&t->tw);
+      *released += slab_defrag_free(timer, sizeof(EntryTimer));
+      moved->ttl = timer = t;
+    }
+    timer->ent = moved;
+  }
+  if (g_prefix_index) {
+    std::string_view key = entry_key(moved);
+    rt_insert(&g_data.prefix_index, (uint8_t const *)key.data(), key.size(), moved);
+  }
+  *released += slab_defrag_free(ent, size);
+  return moved;
+}
+
 static void entry_del_sync(Entry *ent) {
+  // off the wheel already, by entry_set_ttl() or keyspace_flush()
+  if (ent->ttl) {
+    slab_free(ent->ttl, sizeof(EntryTimer));
+  }
   if (ent->type == T_ZSET) {
-    zset_clear(&ent->zset);
+    ZSet *zset = entry_zset(ent);
+    zset_clear(zset);
+    delete zset;
+  } else if (Blob *blob = entry_blob(ent)) {
+    blob_unref(blob);
   }
-  delete ent;
+  slab_free(ent, entry_size(ent));
 }
 
 // a wrapper function for the thread pool
@@ -24,46 +219,153 @@ static void entry_del_func(void *arg) {
   entry_del_sync((Entry *)arg);
 }
 
+static void entry_del_batch_func(void *arg) {
+  std::vector<Entry *> *batch = (std::vector<Entry *> *)arg;
+  for (Entry *ent : *batch) {
+    entry_del_sync(ent);
+  }
+  delete batch;
+}
+
+// freeing zset tree nodes, an allocation each
+static size_t znodes_free_cost(size_t count) {
+  return count;
+}
+
+size_t entry_free_cost(Entry const *ent) {
+  if (ent->type == T_ZSET) {
+    // a tree has a node per member, a listpack is a single buffer
+    ZSet *zset = entry_zset(ent);
+    return 2 + znodes_free_cost(hm_size(&zset->hmap));
+  }
+  Blob *blob = entry_blob(ent);
+  return blob ? 2 + blob_view(blob).size() / 4096 : 1;
+}
+
+// worth a task of its own in the thread pool
+static bool free_deferred(size_t cost) {
+  return cost > k_lazy_free_cost;
+}
+
 void entry_del(Entry *ent) {
   // unlink it from any data structures
-  entry_set_ttl(ent, -1);  // remove from the TTL heap
+  entry_set_ttl(ent, -1);  // remove from the TTL wheel
   // run the destructor in a thread pool for large data structures
-  size_t set_size = (ent->type == T_ZSET) ? hm_size(&ent->zset.hmap) : 0;
-  if (set_size > k_large_container_size) {
-    thread_pool_queue(&g_data.thread_pool, &entry_del_func, ent);
+  if (free_deferred(entry_free_cost(ent))) {
+    thread_pool_queue(&g_data.thread_pool, &entry_del_func, ent, PRIO_LAZY_FREE);
   } else {
     entry_del_sync(ent);  // small; avoid context switches
   }
 }
 
+void entry_del_lazy(Entry *ent) {
+  entry_set_ttl(ent, -1);
+  if (free_deferred(entry_free_cost(ent))) {
+    thread_pool_queue(&g_data.thread_pool, &entry_del_func, ent, PRIO_LAZY_FREE);
+    return;
+  }
+  g_data.lazy_free.push_back(ent);
+  if (g_data.lazy_free.size() >= k_lazy_free_batch) {
+    lazy_free_flush();
+  }
+}
+
+void lazy_free_flush() {
+  if (g_data.lazy_free.empty()) {
+    return;
+  }
+  std::vector<Entry *> *batch = new std::vector<Entry *>();
+  batch->swap(g_data.lazy_free);
+  thread_pool_queue(&g_data.thread_pool, &entry_del_batch_func, batch, PRIO_LAZY_FREE);
+}
+
+// the old keyspace of keyspace_flush()
+struct FlushJob {
+  DbMap db;
+  RTree prefix_index;
+  Entry *prev = NULL;
+};
+
+// the hashtable walk reads the next node after the callback returns,
+// so each entry is freed on the following call
+static bool cb_flush(HNode *node, void *arg) {
+  FlushJob *job = (FlushJob *)arg;
+  if (job->prev) {
+    entry_del_sync(job->prev);
+  }
+  job->prev = container_of(node, Entry, node);
+  return true;
+}
+
+static void flush_func(void *arg) {
+  FlushJob *job = (FlushJob *)arg;
+  rt_clear(&job->prefix_index);  // the values are the entries
+  db_foreach(&job->db, &cb_flush, job);
+  if (job->prev) {
+    entry_del_sync(job->prev);
+  }
+  db_clear(&job->db);
+  delete job;
+}
+
+void keyspace_flush(bool async) {
+  FlushJob *job = new FlushJob();
+  std::swap(job->db, g_data.db);
+  std::swap(job->prefix_index, g_data.prefix_index);
+  // every timer belongs to an entry being freed, along with it
+  tw_init(&g_data.ttl_wheel, get_monotonic_msec());
+  if (async) {
+    thread_pool_queue(&g_data.thread_pool, &flush_func, job, PRIO_FLUSH);
+  } else {
+    flush_func(job);
+  }
+}
+
+static void zset_garbage_func(void *arg) {
+  zset_dispose((ZNode *)arg);
+}
+
+void zset_garbage_del(ZNode *garbage, size_t count) {
+  if (!garbage) {
+    return;
+  }
+  if (free_deferred(znodes_free_cost(count))) {
+    thread_pool_queue(&g_data.thread_pool, &zset_garbage_func, garbage, PRIO_LAZY_FREE);
+  } else {
+    zset_dispose(garbage);
+  }
+}
+
 // set or remove the TTL
 void entry_set_ttl(Entry *ent, int64_t ttl_ms) {
-  if (ttl_ms < 0 && ent->heap_idx != (size_t)-1) {
+  if (ttl_ms < 0) {
     // setting a negative TTL means removing the TTL
-    heap_delete(g_data.heap, ent->heap_idx);
-    ent->heap_idx = -1;
-  } else if (ttl_ms >= 0) {
-    // add or update the TTL
-    uint64_t expire_at = get_monotonic_msec() + (uint64_t)ttl_ms;
-    HeapItem item = {expire_at, &ent->heap_idx};
-    heap_upsert(g_data.heap, ent->heap_idx, item);
+    if (EntryTimer *timer = ent->ttl) {
+      tw_del(&g_data.ttl_wheel, &timer->tw);
+      slab_free(timer, sizeof(EntryTimer));
+      ent->ttl = NULL;
+    }
+    return;
   }
+  // add or update the TTL
+  if (!ent->ttl) {
+    ent->ttl = (EntryTimer *)slab_alloc(sizeof(EntryTimer));
+    ent->ttl->tw.link.prev = ent->ttl->tw.link.next = NULL;
+    ent->ttl->ent = ent;
+  }
+  tw_add(&g_data.ttl_wheel, &ent->ttl->tw, get_monotonic_msec() + (uint64_t)ttl_ms);
+}
+
+bool entry_expired(Entry const *ent) {
+  // only keys with a TTL read the clock
+  return ent->ttl && ent->ttl->tw.expire_at <= get_monotonic_msec();
 }
 
 // equality comparison for top-level hashtable
 bool entry_eq(HNode *lhs, HNode *rhs) {
   struct Entry     *le = container_of(lhs, struct Entry, node);
   struct LookupKey *rk = container_of(rhs, struct LookupKey, node);
-  return le->key == rk->key;
-}
-
-// FNV hash
-uint64_t str_hash(uint8_t const *data, size_t len) {
-  uint32_t h = 0x811C9DC5;
-  for (size_t i = 0; i < len; i++) {
-    h = (h + data[i]) * 0x1000193;
-  }
-  return h;
+  return entry_key(le) == rk->key;
 }
 
 bool hcmp(HNode *node, HNode *key) {
@@ -0,0 +1,113 @@
+#include "byoredis/server/defrag.hh"
+#include "byoredis/server/db.hh"
+#include "byoredis/common/slab.hh"
+#include "byoredis/ds/intrusive.hh"
+#include <algorithm>
+
+bool g_active_defrag = false;
+
+// worth a pass: enough free space in the spans, rounding to the class
+// size aside since moving does not help with it. The spans are shared by
+// the reactors, so this is process-wide: every shard runs its passes while
+// the process is fragmented, and stops once they no longer move anything.
+static bool fragmented() {
+  SlabClassStats stats[k_slab_classes];
+  slab_stats(stats);
+  uint64_t reserved = 0, used = 0;
+  for (SlabClassStats const &s : stats) {
+    reserved += s.reserved;
+    used += s.live * s.size;
+  }
+  uint64_t waste = reserved - std::min(reserved, used);
+  return waste >= k_defrag_min_waste && waste * 100 >= reserved * k_defrag_start_pct;
+}
+
+// the callback of db_defrag(), which repoints the hashtable
+static HNode * cb_defrag(HNode *node, void *arg) {
+  DefragState *st = (DefragState *)arg;
+  Entry *ent = container_of(node, Entry, node);
+  Entry *moved = entry_defrag(ent, &st->reclaimed_bytes);
+  st->moved += moved != ent;
+  if (moved->type == T_ZSET) {
+    ZSet *zset = entry_zset(moved);
+    if (hm_size(&zset->hmap) <= k_defrag_zset_inline) {
+      size_t n = 0;
+      uint64_t *released = &st->reclaimed_bytes;
+      for (uint64_t cursor = zset_defrag(zset, 0, &n, released); cursor != 0; ) {
+        cursor = zset_defrag(zset, cursor, &n, released);
+      }
+      st->moved += n;
+    } else {
+      st->zsets.emplace_back(entry_key(moved));
+    }
+  }
+  return &moved->node;
+}
+
+// a step over the last large zset found, false if there is none
+static bool zset_step(DefragState *st) {
+  if (st->zsets.empty()) {
+    return false;
+  }
+  // looked up again, it may be gone or replaced since
+  LookupKey key;
+  key.key = st->zsets.back();
+  key.node.hcode = str_hash((uint8_t const *)key.key.data(), key.key.size());
+  HNode *node = db_lookup(&g_data.db, &key.node, &entry_eq);
+  Entry *ent = node ? container_of(node, Entry, node) : NULL;
+  uint64_t cursor = 0;
+  if (ent && ent->type == T_ZSET) {
+    size_t n = 0;
+    cursor = zset_defrag(entry_zset(ent), st->zset_cursor, &n, &st->reclaimed_bytes);
+    st->moved += n;
+  }
+  st->zset_cursor = cursor;
+  if (cursor == 0) {
+    st->zsets.pop_back();
+  }
+  return true;
+}
+
+uint64_t defrag_next_ms() {
+  return g_active_defrag ? g_data.defrag.next_ms : (uint64_t)-1;
+}
+
+void defrag_cycle(uint64_t now_ms) {
+  DefragState *st = &g_data.defrag;
+  if (!g_active_defrag || now_ms < st->next_ms) {
+    return;
+  }
+  if (!st->active) {
+    if (!fragmented()) {
+      st->next_ms = now_ms + k_defrag_check_ms;
+      return;
+    }
+    st->active = true;
+    st->keys_done = false;
+    st->cursor = 0;
+    st->pass_moved = st->moved;
+  }
+  uint64_t start_us = get_monotonic_usec();
+  bool done = false;
+  // a step is a bucket of the keyspace or of a large zset;
+  // the clock is read every few steps
+  for (size_t nsteps = 1; !done; nsteps++) {
+    if (!zset_step(st) && !st->keys_done) {
+      st->cursor = db_defrag(&g_data.db, st->cursor, &cb_defrag, st);
+      st->keys_done = st->cursor == 0;
+    }
+    done = st->keys_done && st->zsets.empty();
+    if (nsteps % 16 == 0 && get_monotonic_usec() - start_us >= k_defrag_budget_us) {
+      break;
+    }
+  }
+  if (!done) {
+    st->next_ms = now_ms + k_defrag_interval_ms;
+    return;
+  }
+  // the pass is over, another one if it helped and is still needed
+  st->passes++;
+  st->active = false;
+  bool again = st->moved != st->pass_moved && fragmented();
+  st->next_ms = now_ms + (again ? k_defrag_interval_ms : k_defrag_check_ms);
+}
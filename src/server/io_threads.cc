@@ -0,0 +1,128 @@
+#include "byoredis/server/io_threads.hh"
+#include "byoredis/server/conn.hh"
+#include "byoredis/common/log.hh"
+#include <assert.h>
+#include <algorithm>
+
+// spin before sleeping, fan-outs come once per loop iteration
+size_t const k_io_spins = 1u << 14;
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+static void io_run_jobs(uint32_t op, std::vector<Conn *> const &jobs) {
+  for (Conn *conn : jobs) {
+    if (op == IO_READ) {
+      if (conn_read(conn)) {
+        conn_parse(conn);
+      }
+    } else {
+      conn_write(conn);
+    }
+  }
+}
+
+// wait until `a` differs from `old`
+static uint32_t wait_change(std::atomic<uint32_t> &a, uint32_t old) {
+  uint32_t v = old;
+  for (size_t i = 0; i < k_io_spins && (v = a.load(std::memory_order_acquire)) == old; i++) {
+    cpu_relax();
+  }
+  while (v == old) {
+    a.wait(old, std::memory_order_acquire);
+    v = a.load(std::memory_order_acquire);
+  }
+  return v;
+}
+
+static void *io_worker(void *arg) {
+  IoThread *t = (IoThread *)arg;
+  while (true) {
+    wait_change(t->pending, 0);
+    io_run_jobs(t->op, t->jobs);
+    // fan-in: hand the connections back to the event loop thread
+    t->pending.store(0, std::memory_order_release);
+    t->pending.notify_one();
+  }
+  return NULL;
+}
+
+void io_threads_init(IoThreads *io, size_t num_threads) {
+  for (size_t i = 0; i < num_threads; i++) {
+    IoThread *t = new IoThread();
+    if (pthread_create(&t->tid, NULL, &io_worker, t)) {
+      die("pthread_create()");
+    }
+    io->threads.push_back(t);
+  }
+}
+
+// run `op` on the connections with all threads, returns when all are done
+static void io_threads_run(IoThreads *io, uint32_t op, std::vector<Conn *> const &conns) {
+  size_t nthreads = io->threads.size() + 1;  // the calling thread takes a share
+  if (conns.size() < nthreads * 2) {
+    return io_run_jobs(op, conns);  // not worth the handoff
+  }
+  for (IoThread *t : io->threads) {
+    assert(t->pending.load(std::memory_order_relaxed) == 0);
+    t->jobs.clear();
+    t->op = op;
+  }
+  std::vector<Conn *> mine;
+  for (size_t i = 0; i < conns.size(); i++) {
+    size_t idx = i % nthreads;
+    if (idx == 0) {
+      mine.push_back(conns[i]);
+    } else {
+      io->threads[idx - 1]->jobs.push_back(conns[i]);
+    }
+  }
+  // fan-out
+  for (IoThread *t : io->threads) {
+    t->pending.store(1, std::memory_order_release);
+    t->pending.notify_one();
+  }
+  io_run_jobs(op, mine);
+  // fan-in barrier
+  for (IoThread *t : io->threads) {
+    uint32_t v = t->pending.load(std::memory_order_acquire);
+    while (v != 0) {
+      v = wait_change(t->pending, v);
+    }
+  }
+}
+
+void io_threads_serve(IoThreads *io, std::vector<Conn *> const &readable,
+                      std::vector<Conn *> const &writable) {
+  // 1. read and parse in parallel
+  io_threads_run(io, IO_READ, readable);
+  // 2. execute on this thread, the sole owner of the keyspace
+  for (Conn *conn : readable) {
+    if (!conn->want_close) {
+      conn_execute(conn);
+    }
+  }
+  // 3. write in parallel
+  io->conns.assign(readable.begin(), readable.end());
+  io->conns.insert(io->conns.end(), writable.begin(), writable.end());
+  std::sort(io->conns.begin(), io->conns.end());
+  io->conns.erase(std::unique(io->conns.begin(), io->conns.end()), io->conns.end());
+  io->writes.clear();
+  for (Conn *conn : io->conns) {
+    if (!conn->want_close && conn->outgoing.output_size() > 0) {
+      io->writes.push_back(conn);
+    }
+  }
+  io_threads_run(io, IO_WRITE, io->writes);
+  // 4. update the readiness intention or close
+  for (Conn *conn : io->conns) {
+    if (conn->want_close) {
+      conn_destroy(conn);
+    } else {
+      conn_update_io(conn);
+    }
+  }
+}
@@ -9,19 +9,31 @@
 #include <unistd.h>
 #include <assert.h>
 #include <sys/epoll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <atomic>
 
+#include "byoredis/common/hash.hh"
 #include "byoredis/common/log.hh"
 #include "byoredis/common/net.hh"
 #include "byoredis/server/conn.hh"
 #include "byoredis/server/db.hh"
 #include "byoredis/server/time.hh"
+#include "byoredis/server/uring.hh"
+#include "byoredis/server/io_threads.hh"
 
-int main() {
-  // initialization
-  dlist_init(&g_data.idle_list);
-  thread_pool_init(&g_data.thread_pool, 4);
+// the reactors wait here until every shard is registered in `g_shards`
+static pthread_barrier_t g_start_barrier;
+// and twice here when shutting down, see reactor_stop()
+static pthread_barrier_t g_stop_barrier;
+// set once the signal handler no longer reads `g_shards`
+static std::atomic<bool> g_woken{false};
+// use the io_uring backend instead of epoll
+static bool g_use_io_uring = false;
+// number of I/O threads for the epoll backend
+static long g_num_io_threads = 0;
 
-  // the listening socket
+static int listen_socket(bool reuseport) {
   int fd = socket(AF_INET, SOCK_STREAM, 0);
   if (fd < 0) {
     die("socket()");
@@ -29,6 +41,11 @@ int main() {
   // set reuse
   int val = 1;
   setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+  // every reactor has its own listening socket on the same port,
+  // the kernel balances new connections across them
+  if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val))) {
+    die("setsockopt(SO_REUSEPORT)");
+  }
 
   // bind
   struct sockaddr_in addr = {};
@@ -48,23 +65,25 @@ int main() {
   if (rv) {
     die("listen()");
   }
+  return fd;
+}
 
-  // create epoll instance
-  g_data.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
-  if (g_data.epoll_fd < 0) {
-    die("epoll_create1()");
-  }
+static void epoll_add(int fd) {
   struct epoll_event ev = {};
   ev.data.fd = fd;
-  ev.events = EPOLLIN | EPOLLERR; // monitor listen socket for new connections
+  ev.events = EPOLLIN | EPOLLERR;
   if (epoll_ctl(g_data.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
-    die("epoll_ctl(ADD listen)");
+    die("epoll_ctl(ADD)");
   }
+}
 
+static void epoll_loop(int fd) {
   std::vector<struct epoll_event> events(1024);
+  // ready connections handed to the I/O threads
+  std::vector<Conn *> readable, writable;
 
   // the event loop
-  while (true) {
+  while (!g_shutdown.load(std::memory_order_relaxed)) {
     int32_t timeout_ms = next_timer_ms();
     int n = epoll_wait(g_data.epoll_fd, events.data(), (int)events.size(), timeout_ms);
     if (n < 0 && errno == EINTR) {
@@ -73,6 +92,8 @@ int main() {
     if (n < 0) {
       die("epoll_wait()");
     }
+    readable.clear();
+    writable.clear();
     for (int i = 0; i < n; i++) {
       int evfd = events[i].data.fd;
       uint32_t ready_mask = events[i].events;
@@ -82,15 +103,30 @@ int main() {
         }
         continue;
       }
+      if (evfd == g_data.inbox.efd) {
+        shard_drain();
+        continue;
+      }
       Conn *conn = (evfd >= 0 && (size_t)evfd < g_data.fd2conn.size()) ? g_data.fd2conn[evfd] : NULL;
       if (!conn) {
         continue;
       }
 
-      // update the idle timer by moving conn to the end of the list
-      conn->last_active_ms = get_monotonic_msec();
-      dlist_detach(&conn->idle_node);
-      dlist_insert_before(&g_data.idle_list, &conn->idle_node);
+      // update the idle timer
+      conn_touch(conn);
+
+      if (g_data.io_threads) {
+        if (ready_mask & (EPOLLERR | EPOLLHUP)) {
+          conn_destroy(conn);
+          continue;
+        }
+        if (ready_mask & EPOLLIN) {
+          readable.push_back(conn);
+        } else if (ready_mask & EPOLLOUT) {
+          writable.push_back(conn);
+        }
+        continue;
+      }
 
       // handle IO
       if (ready_mask & EPOLLIN) {
@@ -106,8 +142,169 @@ int main() {
         conn_destroy(conn);
       }
     }
+    if (!readable.empty() || !writable.empty()) {
+      io_threads_serve(g_data.io_threads, readable, writable);
+    }
     // handle timers
     process_timers();
   } // the event loop
+}
+
+// Shutting down. The inbox of a shard is in the thread-local `g_data` of
+// its reactor, which must not return while another one can still send to it:
+//  1. close the connections, the requests forwarded from them are all sent
+//  2. once every reactor did, run the requests queued here, their replies
+//     are the last messages sent
+//  3. once every reactor did, take those replies
+// The calls left are dropped, their connections are gone.
+static void reactor_stop() {
+  // the signal handler is done with `g_shards`
+  while (!g_woken.load()) {
+    usleep(1000);
+  }
+  for (Conn *conn : g_data.fd2conn) {
+    if (conn) {
+      conn_destroy(conn);
+    }
+  }
+  if (g_data.uring) {
+    uring_close(g_data.uring);
+    delete g_data.uring;
+    g_data.uring = NULL;
+  }
+  pthread_barrier_wait(&g_stop_barrier);
+  shard_drain();
+  pthread_barrier_wait(&g_stop_barrier);
+  shard_drain();
+  g_shards[g_data.shard_id] = NULL;
+  // the keyspace is torn down along with the queued frees before the
+  // workers are joined
+  keyspace_flush(true);
+  lazy_free_flush();
+  thread_pool_stop(&g_data.thread_pool);
+}
+
+static void *reactor_main(void *arg) {
+  uint32_t shard_id = (uint32_t)(uintptr_t)arg;
+  // initialization of the shard owned by this thread
+  g_data.shard_id = shard_id;
+  dlist_init(&g_data.idle_list);
+  tw_init(&g_data.ttl_wheel, get_monotonic_msec());
+  thread_pool_init(&g_data.thread_pool, 4);
+  shard_init(&g_data.inbox);
+  g_shards[shard_id] = &g_data;
+
+  // the listening socket
+  int fd = listen_socket(g_shards.size() > 1);
+
+  IoUring *ring = NULL;
+  if (g_use_io_uring) {
+    ring = new IoUring();
+    if (!uring_init(ring, fd, g_data.inbox.efd)) {
+      msg("io_uring is not available, falling back to epoll");
+      delete ring;
+      ring = NULL;
+    }
+  }
+  g_data.uring = ring;
+  if (!ring) {
+    // create epoll instance
+    g_data.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (g_data.epoll_fd < 0) {
+      die("epoll_create1()");
+    }
+    epoll_add(fd);                // monitor listen socket for new connections
+    epoll_add(g_data.inbox.efd);  // messages from other shards
+    if (g_num_io_threads > 0) {
+      g_data.io_threads = new IoThreads();
+      io_threads_init(g_data.io_threads, (size_t)g_num_io_threads);
+    }
+  }
+
+  pthread_barrier_wait(&g_start_barrier);
+
+  if (ring) {
+    uring_loop(ring);
+  } else {
+    epoll_loop(fd);
+  }
+  reactor_stop();
+  return NULL;
+}
+
+static void on_shutdown(int) {
+  if (g_shutdown.exchange(true)) {
+    return;  // already shutting down, `g_shards` may be going away
+  }
+  shard_wake_all();
+  g_woken.store(true);
+}
+
+// usage: server [--reactors N] [--io-uring] [--io-threads N]
+int main(int argc, char **argv) {
+  long nreactors = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--reactors") == 0 && i + 1 < argc) {
+      nreactors = strtol(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--io-uring") == 0) {
+      g_use_io_uring = true;
+    } else if (strcmp(argv[i], "--io-threads") == 0 && i + 1 < argc) {
+      g_num_io_threads = strtol(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--zset-max-listpack-entries") == 0 && i + 1 < argc) {
+      g_zset_max_listpack_entries = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--zset-max-listpack-value") == 0 && i + 1 < argc) {
+      g_zset_max_listpack_value = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--zset-index") == 0 && i + 1 < argc
+               && (strcmp(argv[i + 1], "avl") == 0 || strcmp(argv[i + 1], "btree") == 0)) {
+      g_zset_index = (strcmp(argv[++i], "btree") == 0) ? ZSET_INDEX_BTREE : ZSET_INDEX_AVL;
+    } else if (strcmp(argv[i], "--prefix-index") == 0) {
+      g_prefix_index = true;
+    } else if (strcmp(argv[i], "--active-defrag") == 0) {
+      g_active_defrag = true;
+    } else {
+      fprintf(stderr, "usage: %s [--reactors N] [--io-uring] [--io-threads N]"
+                      " [--zset-max-listpack-entries N] [--zset-max-listpack-value N]"
+                      " [--zset-index avl|btree] [--prefix-index]"
+                      " [--active-defrag]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (g_num_io_threads < 0 || g_num_io_threads > 128) {
+    fprintf(stderr, "bad number of I/O threads: %ld\n", g_num_io_threads);
+    return 1;
+  }
+  if (g_num_io_threads > 0 && (nreactors > 1 || g_use_io_uring)) {
+    fprintf(stderr, "--io-threads requires a single epoll reactor\n");
+    return 1;
+  }
+  if (g_zset_max_listpack_value > k_zset_max_listpack_value) {
+    fprintf(stderr, "bad zset listpack value size: %zu\n", g_zset_max_listpack_value);
+    return 1;
+  }
+  if (nreactors < 1 || nreactors > 1024) {
+    fprintf(stderr, "bad number of reactors: %ld\n", nreactors);
+    return 1;
+  }
+  hash_seed_init();  // before any key is hashed, shared by all shards
+  g_shards.resize((size_t)nreactors);
+  pthread_barrier_init(&g_start_barrier, NULL, (unsigned)nreactors);
+  pthread_barrier_init(&g_stop_barrier, NULL, (unsigned)nreactors);
+  // before the threads start, which inherit the handler
+  struct sigaction sa = {};
+  sa.sa_handler = &on_shutdown;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  // the main thread runs shard 0
+  std::vector<pthread_t> reactors((size_t)nreactors - 1);
+  for (long i = 1; i < nreactors; i++) {
+    if (pthread_create(&reactors[(size_t)i - 1], NULL, &reactor_main, (void *)(uintptr_t)i)) {
+      die("pthread_create()");
+    }
+  }
+  reactor_main((void *)(uintptr_t)0);
+  for (pthread_t tid : reactors) {
+    pthread_join(tid, NULL);
+  }
   return 0;
 }
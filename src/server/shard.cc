@@ -0,0 +1,301 @@
+#include "byoredis/server/shard.hh"
+#include "byoredis/server/conn.hh"
+#include "byoredis/server/db.hh"
+#include "byoredis/server/commands.hh"
+#include "byoredis/common/log.hh"
+#include "byoredis/proto/tlv.hh"
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+
+std::atomic<bool> g_shutdown{false};
+
+void shard_init(ShardInbox *inbox) {
+  int rv = pthread_mutex_init(&inbox->mu, NULL);
+  assert(rv == 0);
+  inbox->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (inbox->efd < 0) {
+    die("eventfd()");
+  }
+}
+
+void shard_wake_all() {
+  // the shards not registered yet check `g_shutdown` before their loop
+  for (GlobalData *shard : g_shards) {
+    if (shard) {
+      uint64_t one = 1;
+      ssize_t rv = write(shard->inbox.efd, &one, sizeof(one));
+      (void)rv;
+    }
+  }
+}
+
+// The shard index must not be correlated with the low bits used by the
+// per-shard hashtables, otherwise each shard only ever fills 1/N of its slots.
+uint32_t shard_of(uint64_t hcode) {
+  uint64_t mixed = (hcode * 0x9E3779B97F4A7C15ull) >> 32;
+  return (uint32_t)((mixed * g_shards.size()) >> 32);
+}
+
+static void shard_send(uint32_t target, ShardMsg *m) {
+  ShardInbox *inbox = &g_shards[target]->inbox;
+  pthread_mutex_lock(&inbox->mu);
+  bool was_empty = inbox->msgs.empty();
+  inbox->msgs.push_back(m);
+  pthread_mutex_unlock(&inbox->mu);
+  // one wakeup per batch, the receiver drains everything at once
+  if (was_empty) {
+    uint64_t one = 1;
+    ssize_t rv = write(inbox->efd, &one, sizeof(one));
+    (void)rv;
+  }
+}
+
+// single-key command: the response of the owner as-is
+static void merge_single(ShardCall *call, Buffer &out) {
+  out.append_buffer(call->parts[0]);
+}
+
+// keyspace-wide command: add up the counts from every shard
+static void merge_ints(ShardCall *call, Buffer &out) {
+  int64_t total = 0;
+  for (Buffer &part : call->parts) {
+    int64_t n = 0;
+    if (part.readable_size() < 9 || part.readable_data()[0] != TAG_INT) {
+      return out.append_buffer(part);
+    }
+    memcpy(&n, part.readable_data() + 1, 8);
+    total += n;
+  }
+  out_int(out, total);
+}
+
+// keyspace-wide command: concatenate the arrays from every shard
+static void merge_arrays(ShardCall *call, Buffer &out) {
+  uint32_t total = 0;
+  for (Buffer &part : call->parts) {
+    uint32_t n = 0;
+    if (part.readable_size() < 5 || part.readable_data()[0] != TAG_ARR) {
+      // not an array, e.g. an error; report it instead
+      return out.append_buffer(part);
+    }
+    memcpy(&n, part.readable_data() + 1, 4);
+    total += n;
+  }
+  out_arr(out, total);
+  for (Buffer &part : call->parts) {
+    out.append_buffer(part, 5);
+  }
+}
+
+// multi-key write: the first error, if any
+static void merge_status(ShardCall *call, Buffer &out) {
+  for (Buffer &part : call->parts) {
+    if (part.readable_size() > 0 && part.readable_data()[0] == TAG_ERR) {
+      return out.append_buffer(part);
+    }
+  }
+  out.append_buffer(call->parts[0]);
+}
+
+// multi-key read: the values of each part in the order of the keys.
+// The values are nil or strings, a large string is a ref spliced right
+// after its header.
+static void merge_values(ShardCall *call, Buffer &out) {
+  size_t nparts = call->parts.size();
+  std::vector<size_t> pos(nparts);  // the next value of each part
+  std::vector<size_t> ref(nparts);  // the next ref of each part
+  for (size_t i = 0; i < nparts; i++) {
+    Buffer &part = call->parts[i];
+    if (part.readable_size() < 5 || part.readable_data()[0] != TAG_ARR) {
+      return out.append_buffer(part);
+    }
+    pos[i] = part.readable_begin + 5;
+  }
+  out_arr(out, (uint32_t)call->key_parts.size());
+  for (uint32_t i : call->key_parts) {
+    Buffer &part = call->parts[i];
+    size_t begin = pos[i];
+    size_t end = begin + 1;
+    if (part.buf[begin] == TAG_STR) {
+      uint32_t len = 0;
+      memcpy(&len, &part.buf[begin + 1], 4);
+      end = begin + 5;
+      if (ref[i] < part.refs.size() && part.refs[ref[i]].pos == end) {
+        ref[i]++;
+      } else {
+        end += len;
+      }
+    }
+    out.append_range(part, begin, end);
+    pos[i] = end;
+  }
+}
+
+static ShardCall * call_new(Conn *conn, size_t nparts, void (*merge)(ShardCall *, Buffer &)) {
+  ShardCall *call = new ShardCall();
+  call->origin  = g_data.shard_id;
+  call->fd      = conn->fd;
+  call->conn_id = conn->id;
+  call->parts.resize(nparts);
+  call->merge   = merge;
+  return call;
+}
+
+static void call_send(ShardCall *call, uint32_t part, uint32_t target,
+                      std::vector<std::string_view> const &cmd) {
+  ShardMsg *m = new ShardMsg();
+  m->call = call;
+  m->part = part;
+  // the arguments point into the connection buffer, the message owns a copy
+  m->cmd.assign(cmd.begin(), cmd.end());
+  call->remaining++;
+  shard_send(target, m);
+}
+
+// A multi-key command is split by the owners of its keys: each shard runs
+// the command with its own keys (and their arguments) in their order, the
+// replies are merged back. It is not atomic across shards.
+static bool forward_keys(Conn *conn, Command const *c, std::vector<std::string_view> &cmd) {
+  size_t first = (size_t)c->first_key;
+  size_t last = cmd_last_key(c, cmd.size());
+  size_t step = (size_t)c->key_step;
+  if ((cmd.size() - first) % step != 0) {
+    return false;  // the error is reported locally
+  }
+  std::vector<int32_t> part_of(g_shards.size(), -1);
+  std::vector<uint32_t> owners;  // of each part
+  std::vector<std::vector<std::string_view>> subs;
+  std::vector<uint32_t> key_parts;
+  for (size_t k = first; k <= last; k += step) {
+    uint32_t owner = shard_of(str_hash((uint8_t const *)cmd[k].data(), cmd[k].size()));
+    if (part_of[owner] < 0) {
+      part_of[owner] = (int32_t)subs.size();
+      owners.push_back(owner);
+      subs.push_back({cmd[0]});
+    }
+    std::vector<std::string_view> &sub = subs[part_of[owner]];
+    sub.insert(sub.end(), cmd.begin() + k, cmd.begin() + k + step);
+    key_parts.push_back((uint32_t)part_of[owner]);
+  }
+  uint32_t self = g_data.shard_id;
+  if (subs.size() == 1) {
+    if (owners[0] == self) {
+      return false;
+    }
+    ShardCall *call = call_new(conn, 1, &merge_single);
+    call_send(call, 0, owners[0], cmd);
+    return true;
+  }
+  void (*merge)(ShardCall *, Buffer &) = (c->flags & CMD_COUNT) ? &merge_ints
+    : (c->flags & CMD_WRITE) ? &merge_status : &merge_values;
+  ShardCall *call = call_new(conn, subs.size(), merge);
+  call->key_parts.swap(key_parts);
+  for (uint32_t i = 0; i < subs.size(); i++) {
+    if (owners[i] != self) {
+      call_send(call, i, owners[i], subs[i]);
+    }
+  }
+  if (part_of[self] >= 0) {
+    do_request_and_make_response(subs[part_of[self]], call->parts[part_of[self]]);
+  }
+  return true;
+}
+
+bool shard_forward(Conn *conn, std::vector<std::string_view> &cmd) {
+  uint32_t nshards = (uint32_t)g_shards.size();
+  if (nshards <= 1) {
+    return false;
+  }
+  Command const *c = cmd.empty() ? NULL : cmd_lookup(cmd[0]);
+  if (!c || !cmd_arity_ok(c, cmd.size())) {
+    return false;  // the error is reported locally
+  }
+  uint32_t self = g_data.shard_id;
+  if (c->flags & CMD_KEYSPACE) {
+    void (*merge)(ShardCall *, Buffer &) = (c->flags & CMD_COUNT) ? &merge_ints
+      : (c->flags & CMD_WRITE) ? &merge_status : &merge_arrays;
+    ShardCall *call = call_new(conn, nshards, merge);
+    for (uint32_t i = 0; i < nshards; i++) {
+      if (i != self) {
+        call_send(call, i, i, cmd);
+      }
+    }
+    // the local part is executed inline
+    do_request_and_make_response(cmd, call->parts[self]);
+    return true;
+  }
+  if (c->flags & CMD_CURSOR) {
+    // the shard id is in the low bits of the cursor, or before the ':' of a
+    // prefix walk; a bad one is reported locally
+    uint64_t cursor = strtoull(std::string(cmd[1]).c_str(), NULL, 10);
+    uint32_t owner = (uint32_t)(cursor & ((1u << k_scan_shard_bits) - 1));
+    if (owner == self || owner >= nshards) {
+      return false;
+    }
+    ShardCall *call = call_new(conn, 1, &merge_single);
+    call_send(call, 0, owner, cmd);
+    return true;
+  }
+  if (c->first_key == 0) {
+    return false;  // no key
+  }
+  if (cmd_last_key(c, cmd.size()) > (size_t)c->first_key) {
+    return forward_keys(conn, c, cmd);
+  }
+  std::string_view key = cmd[c->first_key];
+  uint32_t owner = shard_of(str_hash((uint8_t const *)key.data(), key.size()));
+  if (owner == self) {
+    return false;
+  }
+  ShardCall *call = call_new(conn, 1, &merge_single);
+  call_send(call, 0, owner, cmd);
+  return true;
+}
+
+// all parts answered, respond to the client if it's still there
+static void call_finish(ShardCall *call) {
+  Conn *conn = NULL;
+  if ((size_t)call->fd < g_data.fd2conn.size()) {
+    conn = g_data.fd2conn[call->fd];
+  }
+  if (conn && conn->id == call->conn_id) {
+    conn_resume(conn, call);
+    if (conn->want_close) {
+      conn_destroy(conn);
+    }
+  }
+  delete call;
+}
+
+void shard_drain() {
+  ShardInbox *inbox = &g_data.inbox;
+  uint64_t cnt = 0;
+  ssize_t rv = read(inbox->efd, &cnt, sizeof(cnt));
+  if (rv < 0 && errno != EAGAIN) {
+    msg_errno("read(eventfd) error");
+  }
+  std::vector<ShardMsg *> msgs;
+  pthread_mutex_lock(&inbox->mu);
+  msgs.swap(inbox->msgs);
+  pthread_mutex_unlock(&inbox->mu);
+
+  for (ShardMsg *m : msgs) {
+    ShardCall *call = m->call;
+    if (!m->is_reply) {
+      // we own the key, execute and send the result back
+      std::vector<std::string_view> args(m->cmd.begin(), m->cmd.end());
+      do_request_and_make_response(args, m->out);
+      m->is_reply = true;
+      shard_send(call->origin, m);
+      continue;
+    }
+    call->parts[m->part] = std::move(m->out);
+    delete m;
+    if (--call->remaining == 0) {
+      call_finish(call);
+    }
+  }
+}
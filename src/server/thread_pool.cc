@@ -1,43 +1,162 @@
 #include "byoredis/server/thread_pool.hh"
 
 #include <assert.h>
+#include <algorithm>
 
-void * worker(void *arg) {
-  ThreadPool *tp = (ThreadPool *)arg;
+size_t const k_deque_init_cap = 256;
+
+// the worker running on this thread, NULL on the other threads
+static thread_local PoolWorker *t_worker = NULL;
+
+static bool find_work(PoolWorker *self, Work *w, size_t *prio) {
+  ThreadPool *tp = self->tp;
+  size_t n = tp->workers.size();
+  for (size_t p = 0; p < k_task_prios; p++) {
+    *prio = p;
+    if (wsd_take(&self->local[p], w) || wsd_steal(&tp->injected[p], w)) {
+      return true;
+    }
+    for (size_t i = 1; i < n; i++) {
+      PoolWorker *victim = tp->workers[(self->id + i) % n];
+      if (wsd_steal(&victim->local[p], w)) {
+        self->steals.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static bool has_work(ThreadPool *tp) {
+  for (size_t p = 0; p < k_task_prios; p++) {
+    if (wsd_size(&tp->injected[p])) {
+      return true;
+    }
+    for (PoolWorker *w : tp->workers) {
+      if (wsd_size(&w->local[p])) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static void *worker(void *arg) {
+  PoolWorker *self = (PoolWorker *)arg;
+  ThreadPool *tp = self->tp;
+  t_worker = self;
   while (true) {
+    Work w;
+    size_t prio = 0;
+    if (find_work(self, &w, &prio)) {
+      // do the work
+      w.task(w.arg);
+      self->done[prio].fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    // go to sleep; pairs with the fence in thread_pool_queue(): either the
+    // queuing thread sees this sleeper, or this sees the queued task
     pthread_mutex_lock(&tp->mu);
-    // wait for the condition: a non-empty queue
-    while (tp->queue.empty()) {
-      pthread_cond_wait(&tp->not_empty, &tp->mu);
+    tp->sleepers.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool idle = !has_work(tp);
+    if (idle && tp->stopping.load(std::memory_order_relaxed)) {
+      tp->sleepers.fetch_sub(1, std::memory_order_relaxed);
+      pthread_mutex_unlock(&tp->mu);
+      break;  // drained
     }
-
-    // get the job
-    Work w = tp->queue.front();
-    tp->queue.pop_front();
+    if (idle) {
+      pthread_cond_wait(&tp->wake, &tp->mu);
+    }
+    tp->sleepers.fetch_sub(1, std::memory_order_relaxed);
     pthread_mutex_unlock(&tp->mu);
-
-    // do the work
-    w.task(w.arg);
   }
+  return NULL;
 }
 
 void thread_pool_init(ThreadPool *tp, size_t num_threads) {
   num_threads = std::max(num_threads, (size_t)4);
   int rv = pthread_mutex_init(&tp->mu, NULL);
   assert(rv == 0);
-  rv = pthread_cond_init(&tp->not_empty, NULL);
+  rv = pthread_cond_init(&tp->wake, NULL);
   assert(rv == 0);
-
-  tp->threads.resize(num_threads);
+  tp->owner = pthread_self();
+  for (size_t p = 0; p < k_task_prios; p++) {
+    wsd_init(&tp->injected[p], k_deque_init_cap);
+  }
+  // all the deques exist before any worker starts stealing
+  tp->workers.resize(num_threads);
   for (size_t i = 0; i < num_threads; i++) {
-    int rv = pthread_create(&tp->threads[i], NULL, &worker, tp);
+    PoolWorker *w = new PoolWorker();
+    w->tp = tp;
+    w->id = i;
+    for (size_t p = 0; p < k_task_prios; p++) {
+      wsd_init(&w->local[p], k_deque_init_cap);
+    }
+    tp->workers[i] = w;
+  }
+  for (PoolWorker *w : tp->workers) {
+    int rv = pthread_create(&w->thread, NULL, &worker, w);
     assert(rv == 0);
   }
 }
 
-void thread_pool_queue(ThreadPool *tp, void (*task)(void *), void *arg) {
+void thread_pool_queue(ThreadPool *tp, void (*task)(void *), void *arg, TASK_PRIO prio) {
+  assert(!tp->stopping.load(std::memory_order_relaxed));
+  PoolWorker *self = t_worker;
+  if (self && self->tp == tp) {
+    wsd_push(&self->local[prio], Work{task, arg});
+  } else {
+    // the injection deques have a single producer
+    assert(pthread_equal(pthread_self(), tp->owner));
+    wsd_push(&tp->injected[prio], Work{task, arg});
+  }
+  tp->queued[prio].fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (tp->sleepers.load(std::memory_order_relaxed) > 0) {
+    pthread_mutex_lock(&tp->mu);
+    pthread_cond_signal(&tp->wake);
+    pthread_mutex_unlock(&tp->mu);
+  }
+}
+
+void thread_pool_stop(ThreadPool *tp) {
   pthread_mutex_lock(&tp->mu);
-  tp->queue.push_back(Work{task, arg});
-  pthread_cond_signal(&tp->not_empty);
+  tp->stopping.store(true, std::memory_order_relaxed);
+  pthread_cond_broadcast(&tp->wake);
   pthread_mutex_unlock(&tp->mu);
+  for (PoolWorker *w : tp->workers) {
+    int rv = pthread_join(w->thread, NULL);
+    assert(rv == 0);
+    (void)rv;
+  }
+  for (PoolWorker *w : tp->workers) {
+    for (size_t p = 0; p < k_task_prios; p++) {
+      wsd_free(&w->local[p]);
+    }
+    delete w;
+  }
+  tp->workers.clear();
+  for (size_t p = 0; p < k_task_prios; p++) {
+    wsd_free(&tp->injected[p]);
+  }
+  pthread_cond_destroy(&tp->wake);
+  pthread_mutex_destroy(&tp->mu);
+}
+
+ThreadPoolStats thread_pool_stats(ThreadPool *tp) {
+  ThreadPoolStats st;
+  st.workers = tp->workers.size();
+  for (size_t p = 0; p < k_task_prios; p++) {
+    st.queued[p] = tp->queued[p].load(std::memory_order_relaxed);
+    st.depth[p] = wsd_size(&tp->injected[p]);
+  }
+  for (PoolWorker *w : tp->workers) {
+    for (size_t p = 0; p < k_task_prios; p++) {
+      st.done[p] += w->done[p].load(std::memory_order_relaxed);
+      st.depth[p] += wsd_size(&w->local[p]);
+    }
+    st.steals += w->steals.load(std::memory_order_relaxed);
+  }
+  return st;
 }
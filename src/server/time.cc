@@ -1,6 +1,7 @@
 #include "byoredis/server/time.hh"
 #include "byoredis/server/db.hh"
 #include "byoredis/ds/intrusive.hh"
+#include <algorithm>
 
 uint64_t get_monotonic_msec() {
   struct timespec tv = {0, 0};
@@ -8,6 +9,12 @@ uint64_t get_monotonic_msec() {
   return uint64_t(tv.tv_sec) * 1000 + tv.tv_nsec / 1000 / 1000;
 }
 
+uint64_t get_monotonic_usec() {
+  struct timespec tv = {0, 0};
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return uint64_t(tv.tv_sec) * 1000 * 1000 + tv.tv_nsec / 1000;
+}
+
 int32_t next_timer_ms() {
   uint64_t now_ms  = get_monotonic_msec();
   uint64_t next_ms = (uint64_t)-1;
@@ -16,10 +23,10 @@ int32_t next_timer_ms() {
     Conn *conn = container_of(g_data.idle_list.next, Conn, idle_node);
     next_ms = conn->last_active_ms + k_idle_timeout_ms;
   }
-  // TTL timers using a heap
-  if (!g_data.heap.empty() && g_data.heap[0].val < next_ms) {
-    next_ms = g_data.heap[0].val;
-  }
+  // TTL timers using a timing wheel, may wake up early to cascade
+  next_ms = std::min(next_ms, tw_next(&g_data.ttl_wheel));
+  // the next defragmentation slice
+  next_ms = std::min(next_ms, defrag_next_ms());
   // timeout value
   if (next_ms == (uint64_t)-1) {
     return -1;  // no timers, no timeouts
@@ -42,19 +49,27 @@ void process_timers() {
     fprintf(stderr, "removing idle connection: %d\n", conn->fd);
     conn_destroy(conn);
   }
-  // TTL timers using a heap
+  // TTL timers using a timing wheel, within the time budget
+  uint64_t start_us = get_monotonic_usec();
   size_t nworks = 0;
-  std::vector<HeapItem> const &heap = g_data.heap;
-  while (!heap.empty() && heap[0].val < now_ms) {
-    Entry *ent = container_of(heap[0].ref, Entry, heap_idx);
-    HNode *node = hm_delete(&g_data.db, &ent->node, &hnode_same);
-    assert(node == &ent->node);
-    // fprintf(stderr, "removing expired key: %s\n", ent->key.c_str());
-    // delete the entry
-    entry_del(ent);
-    if (nworks++ >= k_max_works) {
-      // dont stall the server if too many keys are expiring at once
+  TimerWheel *wheel = &g_data.ttl_wheel;
+  while (TWNode *node = tw_pop(wheel, now_ms)) {
+    Entry *ent = container_of(node, EntryTimer, tw)->ent;
+    Entry *found = keyspace_delete(&ent->node, &hnode_same);
+    assert(found == ent);
+    (void)found;
+    entry_del_lazy(ent);
+    // the clock is read every few keys
+    if (++nworks % 16 == 0 && get_monotonic_usec() - start_us >= g_data.expire_budget_us) {
       break;
     }
   }
+  // a backlog is left: the next loop iteration doesn't wait (see
+  // next_timer_ms()) and gets more time, without stalling the clients
+  bool backlog = tw_next(wheel) <= now_ms;
+  g_data.expire_budget_us = backlog
+    ? std::min(g_data.expire_budget_us * 2, k_expire_budget_max_us) : k_expire_budget_us;
+  // the entries freed lazily in this iteration, expired or not
+  lazy_free_flush();
+  defrag_cycle(now_ms);
 }
@@ -0,0 +1,374 @@
+#include "byoredis/server/uring.hh"
+#include "byoredis/server/conn.hh"
+#include "byoredis/server/db.hh"
+#include "byoredis/server/shard.hh"
+#include "byoredis/server/time.hh"
+#include "byoredis/common/log.hh"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <utility>
+
+unsigned const k_sq_entries    = 256;
+unsigned const k_cq_entries    = 4096;
+unsigned const k_nbufs         = 128;        // provided buffers, power of 2
+size_t   const k_buf_size      = 32 * 1024;  // bytes per provided buffer
+uint16_t const k_buf_group     = 0;
+
+// operation tags in the low bits of `user_data`, the rest is the `Conn *`
+enum URING_OP {
+  OP_ACCEPT = 1,
+  OP_RECV   = 2,
+  OP_SEND   = 3,
+  OP_INBOX  = 4,
+};
+uint64_t const k_op_mask = 7;
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params *p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags, void *arg, size_t argsz) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// submit the queued SQEs, optionally wait for at least 1 completion
+static int uring_enter(IoUring *ring, bool wait, int32_t timeout_ms) {
+  unsigned to_submit = ring->sqe_tail - *ring->sq_tail;
+  __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+  unsigned flags = 0;
+  io_uring_getevents_arg arg = {};
+  struct __kernel_timespec ts = {};
+  void *argp = NULL;
+  size_t argsz = 0;
+  if (wait) {
+    flags |= IORING_ENTER_GETEVENTS;
+    if (timeout_ms >= 0) {
+      ts.tv_sec  = timeout_ms / 1000;
+      ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000 * 1000;
+      arg.sigmask_sz = _NSIG / 8;
+      arg.ts = (uint64_t)&ts;
+      flags |= IORING_ENTER_EXT_ARG;
+      argp = &arg;
+      argsz = sizeof(arg);
+    }
+  }
+  return sys_io_uring_enter(ring->ring_fd, to_submit, wait ? 1 : 0, flags, argp, argsz);
+}
+
+static io_uring_sqe * get_sqe(IoUring *ring) {
+  unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  while (ring->sqe_tail - head >= ring->sq_entries) {
+    // the SQ is full, submit what we have
+    if (uring_enter(ring, false, -1) < 0 && errno != EINTR && errno != EBUSY) {
+      die("io_uring_enter()");
+    }
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  }
+  io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+  ring->sqe_tail++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+// give a provided buffer back to the kernel
+static void buf_recycle(IoUring *ring, uint16_t bid) {
+  // not `br->bufs`, the empty struct in __DECLARE_FLEX_ARRAY shifts it in C++
+  io_uring_buf *b = (io_uring_buf *)ring->br + (ring->br_tail & ring->br_mask);
+  b->addr = (uint64_t)(ring->bufs + (size_t)bid * k_buf_size);
+  b->len  = (uint32_t)k_buf_size;
+  b->bid  = bid;
+  ring->br_tail++;
+  __atomic_store_n(&ring->br->tail, ring->br_tail, __ATOMIC_RELEASE);
+}
+
+static void arm_accept(IoUring *ring) {
+  io_uring_sqe *sqe = get_sqe(ring);
+  sqe->opcode    = IORING_OP_ACCEPT;
+  sqe->fd        = ring->listen_fd;
+  sqe->ioprio    = IORING_ACCEPT_MULTISHOT;
+  sqe->user_data = OP_ACCEPT;
+}
+
+static void arm_inbox(IoUring *ring) {
+  io_uring_sqe *sqe = get_sqe(ring);
+  sqe->opcode       = IORING_OP_POLL_ADD;
+  sqe->fd           = ring->inbox_fd;
+  sqe->poll32_events = POLLIN;
+  sqe->len          = IORING_POLL_ADD_MULTI;
+  sqe->user_data    = OP_INBOX;
+}
+
+static void arm_recv(IoUring *ring, Conn *conn) {
+  io_uring_sqe *sqe = get_sqe(ring);
+  sqe->opcode    = IORING_OP_RECV;
+  sqe->fd        = conn->fd;
+  sqe->ioprio    = IORING_RECV_MULTISHOT;
+  sqe->flags     = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = k_buf_group;
+  sqe->user_data = (uint64_t)conn | OP_RECV;
+  conn->io_pending++;
+}
+
+void uring_send(Conn *conn) {
+  if (conn->send_inflight) {
+    return;  // continued by on_send()
+  }
+  if (conn->sending.output_size() == 0) {
+    if (conn->outgoing.output_size() == 0) {
+      return;
+    }
+    // hand the responses over to the kernel, new ones go to the other buffer
+    std::swap(conn->sending, conn->outgoing);
+  }
+  // the referenced values are gathered with the buffered bytes
+  conn->send_msg = {};
+  conn->send_msg.msg_iov    = conn->send_iov;
+  conn->send_msg.msg_iovlen = conn->sending.fill_iov(conn->send_iov, k_max_iov);
+  io_uring_sqe *sqe = get_sqe(g_data.uring);
+  sqe->opcode    = IORING_OP_SENDMSG;
+  sqe->fd        = conn->fd;
+  sqe->addr      = (uint64_t)&conn->send_msg;
+  sqe->len       = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = (uint64_t)conn | OP_SEND;
+  conn->send_inflight = true;
+  conn->io_pending++;
+}
+
+// drop a reference held by an operation, the last one frees a closed connection
+static void conn_put(Conn *conn) {
+  assert(conn->io_pending > 0);
+  if (--conn->io_pending == 0 && conn->fd < 0) {
+    g_data.uring->closing--;
+    conn_free(conn);
+  }
+}
+
+static void on_accept(IoUring *ring, io_uring_cqe const &cqe) {
+  if (g_shutdown.load(std::memory_order_relaxed)) {
+    if (cqe.res >= 0) {
+      (void)close(cqe.res);
+    }
+    return;  // not rearmed
+  }
+  if (cqe.res >= 0) {
+    if (Conn *conn = conn_new(cqe.res)) {
+      fprintf(stderr, "new client fd %d\n", conn->fd);
+      arm_recv(ring, conn);
+    }
+  } else if (cqe.res != -EAGAIN && cqe.res != -EINTR) {
+    errno = -cqe.res;
+    msg_errno("accept() error");
+  }
+  if (!(cqe.flags & IORING_CQE_F_MORE)) {
+    arm_accept(ring);
+  }
+}
+
+static void on_recv(IoUring *ring, Conn *conn, io_uring_cqe const &cqe) {
+  bool more = cqe.flags & IORING_CQE_F_MORE;
+  if (cqe.flags & IORING_CQE_F_BUFFER) {
+    uint16_t bid = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    if (conn->fd >= 0 && cqe.res > 0) {
+      conn->incoming.append(ring->bufs + (size_t)bid * k_buf_size, (size_t)cqe.res);
+    }
+    buf_recycle(ring, bid);
+  }
+  if (conn->fd >= 0) {
+    if (cqe.res == 0) {
+      msg(conn->incoming.readable_size() == 0 ? "client closed" : "unexpected EOF");
+      conn_destroy(conn);
+    } else if (cqe.res < 0 && cqe.res != -ENOBUFS) {
+      errno = -cqe.res;
+      msg_errno("read() error");
+      conn_destroy(conn);
+    } else if (cqe.res > 0) {
+      conn_touch(conn);
+      conn_process(conn);  // parse, execute, and queue the responses
+      if (conn->want_close) {
+        conn_destroy(conn);
+      }
+    }
+  }
+  if (!more) {
+    // multishot terminated, e.g. ran out of provided buffers
+    if (conn->fd >= 0) {
+      arm_recv(ring, conn);
+    }
+    conn_put(conn);
+  }
+}
+
+static void on_send(Conn *conn, io_uring_cqe const &cqe) {
+  conn->send_inflight = false;
+  if (conn->fd >= 0) {
+    if (cqe.res < 0) {
+      errno = -cqe.res;
+      msg_errno("write() error");
+      conn_destroy(conn);
+    } else {
+      conn->sending.consume((size_t)cqe.res);
+      if (conn->sending.output_size() == 0) {
+        conn->sending.shrink_if_wasteful(1u << 20);
+      }
+      conn_touch(conn);
+      uring_send(conn);  // the remaining data, or responses generated meanwhile
+    }
+  }
+  conn_put(conn);
+}
+
+static void uring_reap(IoUring *ring) {
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    io_uring_cqe cqe = ring->cqes[head & ring->cq_mask];
+    Conn *conn = (Conn *)(cqe.user_data & ~k_op_mask);
+    switch (cqe.user_data & k_op_mask) {
+    case OP_ACCEPT:
+      on_accept(ring, cqe);
+      break;
+    case OP_RECV:
+      on_recv(ring, conn, cqe);
+      break;
+    case OP_SEND:
+      on_send(conn, cqe);
+      break;
+    case OP_INBOX:
+      shard_drain();
+      if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        arm_inbox(ring);
+      }
+      break;
+    }
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+bool uring_init(IoUring *ring, int listen_fd, int inbox_fd) {
+  io_uring_params p = {};
+  p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+  p.cq_entries = k_cq_entries;
+  int fd = sys_io_uring_setup(k_sq_entries, &p);
+  if (fd < 0 && errno == EINVAL) {
+    // older kernels, retry without the optional flags
+    p = io_uring_params{};
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = k_cq_entries;
+    fd = sys_io_uring_setup(k_sq_entries, &p);
+  }
+  if (fd < 0) {
+    msg_errno("io_uring_setup()");
+    return false;
+  }
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+    msg("io_uring: kernel too old");
+    close(fd);
+    return false;
+  }
+  // the SQ and CQ rings share a single mapping
+  size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  size_t ring_size = sq_size > cq_size ? sq_size : cq_size;
+  uint8_t *rings = (uint8_t *)mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  size_t sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+  void *sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  // provided buffers, registered as buffer group `k_buf_group`
+  size_t br_size = k_nbufs * sizeof(io_uring_buf);
+  void *br = mmap(NULL, br_size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (rings == MAP_FAILED || sqes == MAP_FAILED || br == MAP_FAILED) {
+    msg_errno("io_uring: mmap()");
+    close(fd);
+    return false;
+  }
+  io_uring_buf_reg reg = {};
+  reg.ring_addr    = (uint64_t)br;
+  reg.ring_entries = k_nbufs;
+  reg.bgid         = k_buf_group;
+  if (sys_io_uring_register(fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    msg_errno("io_uring: register provided buffers");
+    munmap(br, br_size);
+    munmap(sqes, sqes_size);
+    munmap(rings, ring_size);
+    close(fd);
+    return false;
+  }
+
+  ring->ring_fd    = fd;
+  ring->sq_head    = (unsigned *)(rings + p.sq_off.head);
+  ring->sq_tail    = (unsigned *)(rings + p.sq_off.tail);
+  ring->sq_array   = (unsigned *)(rings + p.sq_off.array);
+  ring->sq_mask    = *(unsigned *)(rings + p.sq_off.ring_mask);
+  ring->sq_entries = p.sq_entries;
+  ring->sqe_tail   = *ring->sq_tail;
+  ring->sqes       = (io_uring_sqe *)sqes;
+  ring->cq_head    = (unsigned *)(rings + p.cq_off.head);
+  ring->cq_tail    = (unsigned *)(rings + p.cq_off.tail);
+  ring->cq_mask    = *(unsigned *)(rings + p.cq_off.ring_mask);
+  ring->cqes       = (io_uring_cqe *)(rings + p.cq_off.cqes);
+  // SQE slot i is always published as SQ entry i
+  for (unsigned i = 0; i < p.sq_entries; i++) {
+    ring->sq_array[i] = i;
+  }
+  ring->br      = (io_uring_buf_ring *)br;
+  ring->br_mask = k_nbufs - 1;
+  ring->br_tail = 0;
+  ring->bufs    = new uint8_t[k_nbufs * k_buf_size];
+  for (uint16_t i = 0; i < k_nbufs; i++) {
+    buf_recycle(ring, i);
+  }
+  ring->listen_fd = listen_fd;
+  ring->inbox_fd  = inbox_fd;
+  ring->rings      = rings;
+  ring->rings_size = ring_size;
+  ring->sqes_size  = sqes_size;
+  ring->br_size    = br_size;
+  arm_accept(ring);
+  arm_inbox(ring);
+  return true;
+}
+
+void uring_loop(IoUring *ring) {
+  while (!g_shutdown.load(std::memory_order_relaxed)) {
+    int32_t timeout_ms = next_timer_ms();
+    // a single syscall submits the queued sends and waits for completions
+    int rv = uring_enter(ring, true, timeout_ms);
+    if (rv < 0 && errno != EINTR && errno != ETIME && errno != EBUSY) {
+      die("io_uring_enter()");
+    }
+    uring_reap(ring);
+    // handle timers
+    process_timers();
+  }
+}
+
+void uring_close(IoUring *ring) {
+  // the sockets are shut down, their operations complete with an error
+  while (ring->closing > 0) {
+    int rv = uring_enter(ring, true, -1);
+    if (rv < 0 && errno != EINTR && errno != EBUSY) {
+      die("io_uring_enter()");
+    }
+    uring_reap(ring);
+  }
+  // the accept and the inbox poll are cancelled with the ring
+  (void)close(ring->ring_fd);
+  munmap(ring->br, ring->br_size);
+  munmap(ring->sqes, ring->sqes_size);
+  munmap(ring->rings, ring->rings_size);
+  delete[] ring->bufs;
+}
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <set>
+#include <vector>
 #include "byoredis/ds/avl.hh"
 
 #define container_of(ptr, T, member) \
@@ -18,6 +19,7 @@ struct Container {
 
 static void add(Container &c, uint32_t val) {
   Data *data = new Data();      // allocate the data
+  data->node.val = val;         // summed up
   avl_init(&data->node);
   data->val = val;
 
@@ -59,6 +61,8 @@ static void avl_verify(AVLNode *parent, AVLNode *node) {
   avl_verify(node, node->right);
 
   assert(node->size == 1 + avl_size(node->left) + avl_size(node->right));
+  assert(node->sum == node->val + avl_sum(node->left) + avl_sum(node->right));
+  assert(node->val == container_of(node, Data, node)->val);
 
   uint32_t lh = avl_height(node->left);
   uint32_t rh = avl_height(node->right);
@@ -91,6 +95,18 @@ static void container_verify(Container &c, std::multiset<uint32_t> const &ref) {
   std::multiset<uint32_t> extracted;
   extract(c.root, extracted);
   assert(extracted == ref);
+  // range sums
+  std::vector<uint32_t> vals(ref.begin(), ref.end());
+  int64_t n = (int64_t)vals.size();
+  for (int64_t start = -1; start <= n + 1; start += 1 + n / 8) {
+    for (int64_t stop = start; stop <= n + 1; stop += 1 + n / 8) {
+      double expect = 0;
+      for (int64_t i = std::max(start, (int64_t)0); i < std::min(stop, n); i++) {
+        expect += vals[(size_t)i];
+      }
+      assert(avl_range_sum(c.root, std::max(start, (int64_t)0), std::min(stop, n)) == expect);
+    }
+  }
 }
 
 static void dispose(Container &c) {
@@ -152,6 +168,60 @@ static void test_remove(uint32_t sz) {
   }
 }
 
+// cut [start, stop) out by rank, then put it back
+static void test_split_join(uint32_t sz) {
+  for (uint32_t start = 0; start <= sz; start++) {
+    for (uint32_t stop = start; stop <= sz; stop++) {
+      Container c;
+      std::multiset<uint32_t> ref, left, mid, right;
+      for (uint32_t i = 0; i < sz; i++) {
+        add(c, i);
+        ref.insert(i);
+        (i < start ? left : i < stop ? mid : right).insert(i);
+      }
+      Container l, m, r;
+      avl_split(c.root, stop, &l.root, &r.root);
+      avl_split(l.root, start, &l.root, &m.root);
+      container_verify(l, left);
+      container_verify(m, mid);
+      container_verify(r, right);
+      c.root = avl_concat(l.root, r.root);
+      std::multiset<uint32_t> rest = left;
+      rest.insert(right.begin(), right.end());
+      container_verify(c, rest);
+      for (uint32_t val : right) {
+        assert(del(c, val));
+      }
+      container_verify(c, left);
+      // join the middle back with a node from the left
+      if (c.root) {
+        AVLNode *last = avl_offset(c.root, (int64_t)avl_size(c.root) - 1 - avl_rank(c.root));
+        l.root = avl_del(last);
+        c.root = avl_join(l.root, last, m.root);
+        container_verify(c, std::multiset<uint32_t>(ref.begin(), ref.find(stop)));
+      } else {
+        c.root = m.root;
+      }
+      dispose(c);
+    }
+  }
+}
+
+static void test_build(uint32_t sz) {
+  std::vector<Data> data(sz);
+  std::vector<AVLNode *> nodes(sz);
+  std::multiset<uint32_t> ref;
+  for (uint32_t i = 0; i < sz; i++) {
+    data[i].val = i;
+    data[i].node.val = i;
+    nodes[i] = &data[i].node;
+    ref.insert(i);
+  }
+  Container c;
+  c.root = avl_build(nodes.data(), sz);
+  container_verify(c, ref);
+}
+
 int main() {
   Container c;
   
@@ -198,6 +268,12 @@ int main() {
     test_insert_dup(i);
     test_remove(i);
   }
+  for (uint32_t i = 0; i < 30; i++) {
+    test_split_join(i);
+  }
+  for (uint32_t i = 0; i < 1000; i++) {
+    test_build(i);
+  }
 
   dispose(c);
   return 0;
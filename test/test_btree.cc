@@ -0,0 +1,202 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <set>
+#include <utility>
+#include <vector>
+#include "byoredis/ds/btree.hh"
+
+// items are ids, ordered by (score, id)
+struct Item {
+  double score = 0;
+  uint32_t id = 0;
+};
+
+typedef std::pair<double, uint32_t> Tuple;
+
+static bool item_less(void const *item, void const *key) {
+  return ((Item const *)item)->id < ((Item const *)key)->id;
+}
+
+struct Container {
+  BTree tree;
+  std::set<Tuple> ref;
+  std::vector<Item *> items;  // by id, NULL if absent
+};
+
+static void add(Container &c, uint32_t id, double score) {
+  if (c.items[id]) {
+    return;
+  }
+  Item *item = new Item();
+  item->score = score;
+  item->id = id;
+  c.items[id] = item;
+  bt_insert(&c.tree, score, item, item, &item_less);
+  c.ref.insert(Tuple(score, id));
+}
+
+static void del(Container &c, uint32_t id) {
+  Item *item = c.items[id];
+  if (!item) {
+    return;
+  }
+  bt_delete(&c.tree, item->score, item, item, &item_less);
+  c.ref.erase(Tuple(item->score, id));
+  c.items[id] = NULL;
+  delete item;
+}
+
+// check the counts and the min keys of the inner nodes
+static size_t node_verify(BNode *node, bool root) {
+  assert(node->n <= k_bt_order);
+  assert(root || node->n >= k_bt_order / 2);
+  if (node->leaf) {
+    return node->n;
+  }
+  BInner *in = (BInner *)node;
+  assert(in->n >= 2);
+  size_t total = 0;
+  for (uint32_t i = 0; i < in->n; i++) {
+    BNode *kid = in->kids[i];
+    assert(in->scores[i] == kid->scores[0] && in->items[i] == kid->items[0]);
+    size_t size = node_verify(kid, false);
+    assert(size == in->counts[i]);
+    total += size;
+  }
+  return total;
+}
+
+static void verify(Container &c) {
+  assert(c.tree.size == c.ref.size());
+  if (c.tree.root) {
+    assert(node_verify(c.tree.root, true) == c.ref.size());
+  }
+  // forward
+  BPos pos = bt_at(&c.tree, 0);
+  for (Tuple const &t : c.ref) {
+    assert(bt_valid(pos));
+    assert(bt_score(pos) == t.first && ((Item *)bt_item(pos))->id == t.second);
+    bt_next(pos);
+  }
+  assert(!bt_valid(pos));
+  // backward
+  pos = bt_at(&c.tree, (int64_t)c.ref.size() - 1);
+  for (auto it = c.ref.rbegin(); it != c.ref.rend(); ++it) {
+    assert(bt_valid(pos));
+    assert(((Item *)bt_item(pos))->id == it->second);
+    bt_prev(pos);
+  }
+  assert(!bt_valid(pos));
+  // rank and offset
+  int64_t rank = 0;
+  for (Tuple const &t : c.ref) {
+    Item key;
+    key.id = t.second;
+    int64_t found = -1;
+    pos = bt_seekge(&c.tree, t.first, &key, &item_less, &found);
+    assert(found == rank && bt_item(pos) == c.items[t.second]);
+    assert(bt_item(bt_at(&c.tree, rank)) == c.items[t.second]);
+    rank++;
+  }
+  assert(!bt_valid(bt_at(&c.tree, rank)));
+  assert(!bt_valid(bt_at(&c.tree, -1)));
+  // seek between the keys
+  for (double score = -1; score <= 11; score += 0.5) {
+    Item key;
+    key.id = 0;
+    int64_t found = -1;
+    pos = bt_seekge(&c.tree, score, &key, &item_less, &found);
+    auto lb = c.ref.lower_bound(Tuple(score, 0));
+    assert(found == (int64_t)std::distance(c.ref.begin(), lb));
+    assert(bt_valid(pos) == (lb != c.ref.end()));
+    if (lb != c.ref.end()) {
+      assert(((Item *)bt_item(pos))->id == lb->second);
+    }
+  }
+}
+
+static void free_item(void *item) {
+  delete (Item *)item;
+}
+
+static void test_random(uint32_t nids, size_t nops) {
+  Container c;
+  c.items.resize(nids);
+  for (size_t i = 0; i < nops; i++) {
+    uint32_t id = (uint32_t)(rand() % nids);
+    if (rand() % 3 == 0) {
+      del(c, id);
+    } else {
+      // many duplicate scores
+      add(c, id, (double)(rand() % 21) / 2);
+    }
+    if (i % 64 == 0) {
+      verify(c);
+    }
+  }
+  verify(c);
+  bt_clear(&c.tree, &free_item);
+}
+
+static void test_sequential(uint32_t n) {
+  Container c;
+  c.items.resize(n);
+  for (uint32_t i = 0; i < n; i++) {
+    add(c, i, (double)i);
+  }
+  verify(c);
+  // drain from both ends
+  for (uint32_t i = 0; i < n / 2; i++) {
+    del(c, i);
+    del(c, n - 1 - i);
+  }
+  verify(c);
+  bt_clear(&c.tree, &free_item);
+  assert(!c.tree.root && c.tree.size == 0);
+}
+
+// remove a random rank range, the tree stays balanced and linked
+static void test_remove_range(uint32_t n, size_t nops) {
+  Container c;
+  c.items.resize(n);
+  for (size_t op = 0; op < nops; op++) {
+    while (c.ref.size() < n / 2) {
+      uint32_t id = (uint32_t)(rand() % n);
+      add(c, id, (double)(rand() % 21) / 2);
+    }
+    size_t size = c.ref.size();
+    size_t start = (size_t)rand() % size;
+    size_t stop = start + 1 + (size_t)rand() % (rand() % 4 ? size / 8 + 1 : size - start);
+    stop = std::min(stop, size);
+    std::vector<uint32_t> ids;
+    BPos pos = bt_at(&c.tree, (int64_t)start);
+    for (size_t i = start; i < stop; i++, bt_next(pos)) {
+      ids.push_back(((Item *)bt_item(pos))->id);
+    }
+    bt_remove_range(&c.tree, (int64_t)start, (int64_t)stop);
+    for (uint32_t id : ids) {
+      Item *item = c.items[id];
+      c.ref.erase(Tuple(item->score, id));
+      c.items[id] = NULL;
+      delete item;
+    }
+    verify(c);
+  }
+  bt_clear(&c.tree, &free_item);
+}
+
+int main() {
+  srand(1);
+  for (uint32_t n = 1; n < 200; n++) {
+    test_sequential(n);
+  }
+  test_sequential(5000);
+  for (size_t i = 0; i < 50; i++) {
+    test_random(10 + (uint32_t)i * 40, 4000);
+  }
+  for (uint32_t n : {2, 40, 100, 3000, 40000}) {
+    test_remove_range(n, 200);
+  }
+  return 0;
+}
@@ -0,0 +1,108 @@
+#include "byoredis/proto/buffer.hh"
+#include <sys/uio.h>
+#include <string>
+#include <assert.h>
+#include <string.h>
+
+// the readable stream as seen by writev()
+static std::string gather(Buffer const &buf) {
+  struct iovec iov[64];
+  size_t n = buf.fill_iov(iov, 64);
+  std::string out;
+  for (size_t i = 0; i < n; i++) {
+    out.append((char const *)iov[i].iov_base, iov[i].iov_len);
+  }
+  assert(out.size() == buf.output_size());
+  return out;
+}
+
+static void append(Buffer &buf, char const *s) {
+  buf.append((uint8_t const *)s, strlen(s));
+}
+
+static void test_refs() {
+  Blob *a = blob_new("AAAA", 4);
+  Blob *b = blob_new("BB", 2);
+  Buffer buf(8);
+  append(buf, "1");
+  buf.append_ref(a);
+  buf.append_ref(b);
+  append(buf, "23");
+  buf.append_ref(a);
+  assert(a->refs == 3 && b->refs == 2);
+  assert(gather(buf) == "1AAAABB23AAAA");
+
+  // grow and compact the buffer with refs in flight
+  append(buf, "456789abcdef");
+  assert(gather(buf) == "1AAAABB23AAAA456789abcdef");
+  for (size_t i = 0; i < 5; i++) {
+    buf.consume(1);
+  }
+  assert(gather(buf) == "BB23AAAA456789abcdef");
+  assert(a->refs == 2);
+  buf.consume(3);
+  assert(b->refs == 1);
+  append(buf, "ghijklmnopqrstuvwxyz");
+  assert(gather(buf) == "3AAAA456789abcdefghijklmnopqrstuvwxyz");
+  buf.consume(buf.output_size());
+  assert(buf.output_size() == 0 && !buf.has_refs());
+  assert(a->refs == 1);
+
+  blob_unref(a);
+  blob_unref(b);
+}
+
+static void test_truncate_and_share() {
+  Blob *a = blob_new("AAAA", 4);
+  Buffer src;
+  append(src, "hdr");
+  size_t mark = src.writable_begin;
+  src.append_ref(a);
+  append(src, "x");
+  src.append_ref(a);
+  assert(src.ref_bytes_after(mark - 1) == 8);
+  src.truncate(mark + 1);
+  assert(gather(src) == "hdrAAAAx");
+  assert(a->refs == 2);
+
+  // share the refs, copy the partially consumed ones
+  Buffer dst;
+  dst.append_buffer(src, 1);
+  assert(gather(dst) == "drAAAAx");
+  assert(a->refs == 3);
+  Buffer dst2;
+  dst2.append_buffer(src, 5);
+  assert(gather(dst2) == "AAx");
+  assert(a->refs == 3);
+
+  // moves keep a single owner of each ref
+  Buffer moved(std::move(dst));
+  assert(gather(moved) == "drAAAAx");
+  assert(a->refs == 3);
+  blob_unref(a);
+}
+
+// slices in any order, a ref goes with the range it ends
+static void test_range() {
+  Blob *a = blob_new("AAAA", 4);
+  Buffer src;
+  append(src, "h1");
+  src.append_ref(a);
+  append(src, "h2xy");
+  src.append_ref(a);
+  // h1|AAAA at 2, h2xy, AAAA at 6
+  Buffer dst;
+  dst.append_range(src, 2, 6);
+  dst.append_range(src, 0, 2);
+  dst.append_range(src, 0, 0);
+  assert(gather(dst) == "h2xyAAAAh1AAAA");
+  assert(a->refs == 5);
+  blob_unref(a);
+}
+
+int main() {
+  test_refs();
+  test_truncate_and_share();
+  test_range();
+  return 0;
+}
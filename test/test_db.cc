@@ -0,0 +1,237 @@
+#include <assert.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "byoredis/server/db.hh"
+#include "byoredis/server/commands.hh"
+#include "byoredis/common/slab.hh"
+#include "byoredis/proto/buffer.hh"
+
+static uint64_t slab_live() {
+  SlabClassStats stats[k_slab_classes];
+  slab_stats(stats);
+  uint64_t live = 0;
+  for (SlabClassStats const &s : stats) {
+    live += s.live;
+  }
+  return live;
+}
+
+static uint64_t queued(TASK_PRIO prio) {
+  return thread_pool_stats(&g_data.thread_pool).queued[prio];
+}
+
+// the queued tasks have run
+static void wait_idle() {
+  while (true) {
+    ThreadPoolStats st = thread_pool_stats(&g_data.thread_pool);
+    bool idle = true;
+    for (size_t p = 0; p < k_task_prios; p++) {
+      idle = idle && st.done[p] == st.queued[p];
+    }
+    if (idle) {
+      return;
+    }
+    usleep(100);
+  }
+}
+
+// a task holding its worker until released
+struct Blocker {
+  std::atomic<bool> release{false};
+};
+
+static std::atomic<size_t> g_blocked{0};
+
+static void block_func(void *arg) {
+  Blocker *b = (Blocker *)arg;
+  g_blocked.fetch_add(1);
+  while (!b->release.load()) {
+    usleep(100);
+  }
+  g_blocked.fetch_sub(1);
+}
+
+// every worker runs a blocker, the tasks queued after wait
+static std::vector<Blocker> * block_all() {
+  size_t n = thread_pool_stats(&g_data.thread_pool).workers;
+  std::vector<Blocker> *blockers = new std::vector<Blocker>(n);
+  g_blocked.store(0);
+  for (Blocker &b : *blockers) {
+    thread_pool_queue(&g_data.thread_pool, &block_func, &b, PRIO_LAZY_FREE);
+  }
+  while (g_blocked.load() < n) {
+    usleep(100);
+  }
+  return blockers;
+}
+
+static void release_all(std::vector<Blocker> *blockers) {
+  for (Blocker &b : *blockers) {
+    b.release.store(true);
+  }
+  while (g_blocked.load() > 0) {
+    usleep(100);
+  }
+  delete blockers;
+  wait_idle();
+}
+
+static Entry * new_str(std::string const &key, size_t val_size) {
+  return entry_new_str(key, str_hash((uint8_t const *)key.data(), key.size()), std::string(val_size, 'x'));
+}
+
+static Entry * new_zset(std::string const &key, size_t n) {
+  Entry *ent = entry_new_zset(key, str_hash((uint8_t const *)key.data(), key.size()));
+  for (size_t i = 0; i < n; i++) {
+    std::string name = "m" + std::to_string(i);
+    zset_insert(entry_zset(ent), name.data(), name.size(), (double)i);
+  }
+  return ent;
+}
+
+static Entry * lookup(std::string const &key) {
+  LookupKey k;
+  k.key = key;
+  k.node.hcode = str_hash((uint8_t const *)key.data(), key.size());
+  return keyspace_lookup(&k.node, &entry_eq);
+}
+
+// an entry costing up to k_lazy_free_cost is freed on the loop thread
+static void test_cutoff() {
+  uint64_t live0 = slab_live();
+  uint64_t q = queued(PRIO_LAZY_FREE);
+  // a large string costs 2 + a unit per 4 KB page
+  size_t page = 4096, at_cost = (k_lazy_free_cost - 2) * page;
+  Entry *ent = new_str("s", at_cost);
+  assert(entry_free_cost(ent) == k_lazy_free_cost);
+  entry_del(ent);
+  assert(queued(PRIO_LAZY_FREE) == q && slab_live() == live0);
+  ent = new_str("s", at_cost + page);
+  assert(entry_free_cost(ent) == k_lazy_free_cost + 1);
+  entry_del(ent);
+  assert(queued(PRIO_LAZY_FREE) == ++q);
+  wait_idle();
+  // a zset costs 2 + a unit per tree node
+  ent = new_zset("z", k_lazy_free_cost - 2);
+  assert(entry_free_cost(ent) == k_lazy_free_cost);
+  entry_del(ent);
+  assert(queued(PRIO_LAZY_FREE) == q && slab_live() == live0);
+  ent = new_zset("z", k_lazy_free_cost - 1);
+  entry_del(ent);
+  assert(queued(PRIO_LAZY_FREE) == ++q);
+  wait_idle();
+  // lazily: batched below the cutoff, a task of its own above
+  ent = new_zset("z", k_lazy_free_cost - 2);
+  entry_del_lazy(ent);
+  assert(queued(PRIO_LAZY_FREE) == q && g_data.lazy_free.size() == 1);
+  ent = new_zset("z", k_lazy_free_cost - 1);
+  entry_del_lazy(ent);
+  assert(queued(PRIO_LAZY_FREE) == ++q && g_data.lazy_free.size() == 1);
+  lazy_free_flush();
+  assert(queued(PRIO_LAZY_FREE) == ++q && g_data.lazy_free.empty());
+  wait_idle();
+  // the nodes removed from a zset, by the same cost
+  ent = new_zset("z", 4 * k_lazy_free_cost);
+  ZSet *zset = entry_zset(ent);
+  ZNode *garbage = NULL;
+  size_t count = zset_remove_range(zset, 0, (int64_t)k_lazy_free_cost, &garbage);
+  uint64_t live = slab_live();
+  zset_garbage_del(garbage, count);
+  assert(queued(PRIO_LAZY_FREE) == q && slab_live() == live - count);
+  count = zset_remove_range(zset, 0, (int64_t)k_lazy_free_cost + 1, &garbage);
+  zset_garbage_del(garbage, count);
+  assert(queued(PRIO_LAZY_FREE) == ++q);
+  entry_del(ent);
+  wait_idle();
+  assert(slab_live() == live0);
+}
+
+// the small entries deleted lazily go to the pool in batches
+static void test_batch() {
+  uint64_t live0 = slab_live();
+  uint64_t q = queued(PRIO_LAZY_FREE);
+  for (size_t i = 0; i + 1 < k_lazy_free_batch; i++) {
+    entry_del_lazy(new_str("k", 1));
+  }
+  assert(g_data.lazy_free.size() == k_lazy_free_batch - 1);
+  assert(queued(PRIO_LAZY_FREE) == q);
+  entry_del_lazy(new_str("k", 1));  // full
+  assert(g_data.lazy_free.empty() && queued(PRIO_LAZY_FREE) == ++q);
+  lazy_free_flush();  // nothing left
+  assert(queued(PRIO_LAZY_FREE) == q);
+  entry_del_lazy(new_str("k", 1));
+  lazy_free_flush();
+  assert(g_data.lazy_free.empty() && queued(PRIO_LAZY_FREE) == ++q);
+  wait_idle();
+  assert(slab_live() == live0);
+}
+
+static void flushall(char const *mode) {
+  std::vector<std::string_view> cmd = {"flushall"};
+  if (mode) {
+    cmd.push_back(mode);
+  }
+  Buffer out;
+  do_flushall(cmd, out);
+}
+
+// FLUSHALL leaves an empty keyspace at once, the old one is freed inline
+// or in the pool
+static void test_flush(char const *mode) {
+  bool async = mode && std::string_view(mode) == "async";
+  uint64_t live0 = slab_live();
+  size_t const n = 1000;
+  for (size_t i = 0; i < n; i++) {
+    Entry *ent = new_str("key" + std::to_string(i), i % 100);
+    keyspace_insert(ent);
+    if (i % 2) {
+      entry_set_ttl(ent, 100 * 1000);
+    }
+  }
+  keyspace_insert(new_zset("zset", 4 * k_lazy_free_cost));
+  assert(db_size(&g_data.db) == n + 1);
+  assert(tw_size(&g_data.ttl_wheel) == n / 2);
+  assert(g_data.prefix_index.size == n + 1);
+  uint64_t live = slab_live();
+  uint64_t q = queued(PRIO_FLUSH);
+  std::vector<Blocker> *blockers = block_all();
+  flushall(mode);
+  assert(db_size(&g_data.db) == 0);
+  assert(tw_size(&g_data.ttl_wheel) == 0 && tw_next(&g_data.ttl_wheel) == (uint64_t)-1);
+  assert(g_data.prefix_index.size == 0 && g_data.prefix_index.root == NULL);
+  assert(!lookup("key1") && !lookup("zset"));
+  if (async) {
+    // not freed yet, the workers are busy
+    assert(queued(PRIO_FLUSH) == q + 1);
+    assert(slab_live() == live);
+  } else {
+    assert(queued(PRIO_FLUSH) == q);
+    assert(slab_live() == live0);
+  }
+  release_all(blockers);
+  assert(slab_live() == live0);
+  // usable again
+  keyspace_insert(new_str("key1", 1));
+  entry_set_ttl(lookup("key1"), 1000);
+  assert(lookup("key1") && tw_size(&g_data.ttl_wheel) == 1);
+  flushall(NULL);
+  assert(db_size(&g_data.db) == 0 && tw_size(&g_data.ttl_wheel) == 0);
+  assert(slab_live() == live0);
+}
+
+int main() {
+  g_prefix_index = true;
+  g_zset_max_listpack_entries = 0;  // the tree encoding
+  tw_init(&g_data.ttl_wheel, get_monotonic_msec());
+  thread_pool_init(&g_data.thread_pool, 4);
+  test_cutoff();
+  test_batch();
+  test_flush(NULL);
+  test_flush("sync");
+  test_flush("async");
+  thread_pool_stop(&g_data.thread_pool);
+  return 0;
+}
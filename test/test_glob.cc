@@ -0,0 +1,39 @@
+#include <assert.h>
+#include <string>
+#include "byoredis/common/glob.hh"
+
+int main() {
+  assert(glob_match("", ""));
+  assert(!glob_match("", "a"));
+  assert(glob_match("*", ""));
+  assert(glob_match("*", "abc"));
+  assert(glob_match("a*", "abc"));
+  assert(!glob_match("a*", "bac"));
+  assert(glob_match("*c", "abc"));
+  assert(glob_match("a*b*c", "aXbYbZc"));
+  assert(!glob_match("a*b*c", "aXbYbZ"));
+  assert(glob_match("user:*:name", "user:42:name"));
+  assert(glob_match("h?llo", "hello"));
+  assert(!glob_match("h?llo", "hllo"));
+  assert(glob_match("h[ae]llo", "hallo"));
+  assert(!glob_match("h[ae]llo", "hillo"));
+  assert(glob_match("h[^e]llo", "hallo"));
+  assert(!glob_match("h[^e]llo", "hello"));
+  assert(glob_match("h[a-c]llo", "hbllo"));
+  assert(!glob_match("h[a-c]llo", "hdllo"));
+  assert(glob_match("h[c-a]llo", "hbllo"));
+  assert(glob_match("[]]", "]"));
+  assert(glob_match("[a\\]]", "]"));
+  assert(glob_match("a\\*", "a*"));
+  assert(!glob_match("a\\*", "ab"));
+  assert(glob_match("a\\?", "a?"));
+  assert(!glob_match("a[", "a"));
+  assert(glob_match("a[b", "ab"));
+  assert(glob_prefix_len("tenant:1:*") == 9);
+  assert(glob_prefix_len("abc") == 3);
+  assert(glob_prefix_len("a?c") == 1);
+  assert(glob_prefix_len("\\*") == 0);
+  // pathological backtracking stays fast
+  assert(!glob_match("a*a*a*a*a*a*a*a*a*a*b", std::string(1000, 'a')));
+  return 0;
+}
@@ -0,0 +1,196 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "byoredis/ds/radix.hh"
+
+// values are the keys themselves
+struct Container {
+  RTree tree;
+  std::map<std::string, std::string *> ref;
+};
+
+static uint8_t const *bytes(std::string const &s) {
+  return (uint8_t const *)s.data();
+}
+
+static void add(Container &c, std::string const &key) {
+  std::string *val = new std::string(key);
+  std::string *old = (std::string *)rt_insert(&c.tree, bytes(key), key.size(), val);
+  auto it = c.ref.find(key);
+  assert(old == (it == c.ref.end() ? NULL : it->second));
+  delete old;
+  c.ref[key] = val;
+}
+
+static void del(Container &c, std::string const &key) {
+  std::string *val = (std::string *)rt_delete(&c.tree, bytes(key), key.size());
+  auto it = c.ref.find(key);
+  if (it == c.ref.end()) {
+    assert(!val);
+    return;
+  }
+  assert(val == it->second);
+  delete val;
+  c.ref.erase(it);
+}
+
+// a node has a value or 2+ kids, the kids are sorted by their first byte
+static size_t node_verify(RNode *node, bool root) {
+  assert(root || node->val || node->nkids >= 2);
+  RNode **kids = (RNode **)node->data;
+  uint8_t *first = node->data + sizeof(RNode *) * node->nkids;
+  size_t n = 1;
+  for (uint32_t i = 0; i < node->nkids; i++) {
+    RNode *kid = kids[i];
+    assert(kid->len > 0);
+    uint8_t *label = kid->data + (sizeof(RNode *) + 1) * kid->nkids;
+    assert(label[0] == first[i]);
+    assert(i == 0 || first[i - 1] < first[i]);
+    n += node_verify(kid, false);
+  }
+  return n;
+}
+
+static std::string random_key() {
+  // a small alphabet for many shared prefixes
+  std::string key;
+  size_t len = (size_t)(rand() % 8);
+  for (size_t i = 0; i < len; i++) {
+    key.push_back("abc:"[rand() % 4]);
+  }
+  return key;
+}
+
+static bool cb_collect(void *val, void *arg) {
+  ((std::vector<std::string> *)arg)->push_back(*(std::string *)val);
+  return true;
+}
+
+static void verify_prefix(Container &c, std::string const &prefix) {
+  std::vector<std::string> got;
+  rt_prefix(&c.tree, bytes(prefix), prefix.size(), &cb_collect, &got);
+  std::vector<std::string> expect;
+  for (auto it = c.ref.lower_bound(prefix); it != c.ref.end(); ++it) {
+    if (it->first.compare(0, prefix.size(), prefix) != 0) {
+      break;
+    }
+    expect.push_back(it->first);
+  }
+  assert(got == expect);
+}
+
+// the keys under the prefix and greater than `after`
+static void verify_prefix_after(Container &c, std::string const &prefix, std::string const &after) {
+  std::vector<std::string> got;
+  rt_prefix_after(&c.tree, bytes(prefix), prefix.size(), bytes(after), after.size(), &cb_collect, &got);
+  std::vector<std::string> expect;
+  for (auto it = c.ref.upper_bound(after); it != c.ref.end(); ++it) {
+    if (it->first.compare(0, prefix.size(), prefix) == 0) {
+      expect.push_back(it->first);
+    }
+  }
+  assert(got == expect);
+}
+
+struct Page {
+  std::vector<std::string> keys;
+  size_t limit = 0;
+};
+
+static bool cb_page(void *val, void *arg) {
+  Page *page = (Page *)arg;
+  page->keys.push_back(*(std::string *)val);
+  return page->keys.size() < page->limit;
+}
+
+// a walk resumed after the last key of each page sees every key once
+static void verify_pages(Container &c, std::string const &prefix, size_t limit) {
+  std::vector<std::string> all, got;
+  rt_prefix(&c.tree, bytes(prefix), prefix.size(), &cb_collect, &all);
+  Page page;
+  page.limit = limit;
+  rt_prefix(&c.tree, bytes(prefix), prefix.size(), &cb_page, &page);
+  while (!page.keys.empty()) {
+    got.insert(got.end(), page.keys.begin(), page.keys.end());
+    std::string last = page.keys.back();
+    page.keys.clear();
+    rt_prefix_after(&c.tree, bytes(prefix), prefix.size(), bytes(last), last.size(), &cb_page, &page);
+  }
+  assert(got == all);
+}
+
+static void verify(Container &c) {
+  assert(c.tree.size == c.ref.size());
+  assert(!c.tree.root || node_verify(c.tree.root, true) == c.tree.nodes);
+  assert(c.tree.root || (c.tree.nodes == 0 && c.tree.bytes == 0));
+  for (auto const &p : c.ref) {
+    assert(rt_lookup(&c.tree, bytes(p.first), p.first.size()) == p.second);
+  }
+  verify_prefix(c, "");
+  for (char a = 'a'; a <= 'c'; a++) {
+    verify_prefix(c, std::string(1, a));
+    for (char b = 'a'; b <= 'c'; b++) {
+      verify_prefix(c, std::string(1, a) + b);
+      verify_prefix(c, std::string(1, a) + b + "a:b");
+    }
+  }
+  for (std::string prefix : {"", "a", "ab", "c:a"}) {
+    verify_pages(c, prefix, 1);
+    verify_pages(c, prefix, 7);
+    for (size_t i = 0; i < 10; i++) {
+      verify_prefix_after(c, prefix, prefix + random_key());
+      verify_prefix_after(c, prefix, random_key());
+    }
+  }
+}
+
+static void dispose(Container &c) {
+  for (auto const &p : c.ref) {
+    delete p.second;
+  }
+  rt_clear(&c.tree);
+  assert(c.tree.nodes == 0 && c.tree.bytes == 0);
+}
+
+int main() {
+  srand(1);
+  for (size_t round = 0; round < 50; round++) {
+    Container c;
+    for (size_t i = 0; i < 400; i++) {
+      std::string key = random_key();
+      if (rand() % 3 == 0) {
+        del(c, key);
+      } else {
+        add(c, key);
+      }
+      if (i % 20 == 0) {
+        verify(c);
+      }
+    }
+    verify(c);
+    // delete everything
+    while (!c.ref.empty()) {
+      del(c, c.ref.begin()->first);
+    }
+    verify(c);
+    assert(!c.tree.root);
+    dispose(c);
+  }
+  // the callback stops the walk
+  Container c;
+  for (int i = 0; i < 100; i++) {
+    add(c, "tenant:" + std::to_string(i));
+  }
+  std::vector<std::string> got;
+  rt_prefix(&c.tree, bytes("tenant:1"), 8, [](void *val, void *arg) {
+    auto *out = (std::vector<std::string> *)arg;
+    out->push_back(*(std::string *)val);
+    return out->size() < 3;
+  }, &got);
+  assert((got == std::vector<std::string>{"tenant:1", "tenant:10", "tenant:11"}));
+  verify(c);
+  dispose(c);
+  return 0;
+}
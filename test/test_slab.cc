@@ -0,0 +1,191 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <algorithm>
+#include <vector>
+#include "byoredis/common/slab.hh"
+
+struct Obj {
+  uint8_t *ptr = NULL;
+  size_t size = 0;
+};
+
+static uint64_t live_total() {
+  SlabClassStats st[k_slab_classes];
+  slab_stats(st);
+  uint64_t live = 0;
+  for (SlabClassStats const &s : st) {
+    live += s.live;
+  }
+  return live;
+}
+
+static uint64_t reserved_total() {
+  SlabClassStats st[k_slab_classes];
+  slab_stats(st);
+  uint64_t reserved = 0;
+  for (SlabClassStats const &s : st) {
+    reserved += s.reserved;
+  }
+  return reserved;
+}
+
+static void test_classes() {
+  size_t prev = 0;
+  for (size_t size = 1; size <= k_slab_max_size; size++) {
+    size_t got = slab_size(size);
+    assert(got >= size && got % 8 == 0 && got >= prev);
+    assert(got - size < size / 4 + 8);  // at most ~25% internal waste
+    prev = got;
+  }
+  assert(slab_size(k_slab_max_size + 1) == k_slab_max_size + 1);
+}
+
+// no overlap: each object is filled with its own byte
+static void test_random() {
+  std::vector<Obj> objs;
+  srand(1);
+  for (size_t i = 0; i < 200000; i++) {
+    if (objs.empty() || rand() % 3) {
+      Obj o;
+      o.size = 1 + rand() % (k_slab_max_size + 200);
+      o.ptr = (uint8_t *)slab_alloc(o.size);
+      assert((uintptr_t)o.ptr % 8 == 0);
+      memset(o.ptr, (int)(o.size & 0xff), o.size);
+      objs.push_back(o);
+    } else {
+      size_t k = rand() % objs.size();
+      Obj o = objs[k];
+      for (size_t j = 0; j < o.size; j++) {
+        assert(o.ptr[j] == (uint8_t)(o.size & 0xff));
+      }
+      if (rand() % 2) {
+        slab_free(o.ptr, o.size);
+        objs[k] = objs.back();
+        objs.pop_back();
+      } else {
+        // grow or shrink, the prefix is kept
+        size_t size = 1 + rand() % (k_slab_max_size + 200);
+        uint8_t *p = (uint8_t *)slab_realloc(o.ptr, o.size, size);
+        bool same = size <= k_slab_max_size && o.size <= k_slab_max_size
+          && slab_size(size) == slab_size(o.size);
+        assert(!same || p == o.ptr);
+        for (size_t j = 0; j < std::min(size, o.size); j++) {
+          assert(p[j] == (uint8_t)(o.size & 0xff));
+        }
+        memset(p, (int)(size & 0xff), size);
+        objs[k] = Obj{p, size};
+      }
+    }
+  }
+  for (Obj const &o : objs) {
+    slab_free(o.ptr, o.size);
+  }
+  assert(live_total() == 0);
+}
+
+size_t const k_objs = 100000;
+
+static void *free_all(void *arg) {
+  std::vector<void *> *ptrs = (std::vector<void *> *)arg;
+  for (void *p : *ptrs) {
+    slab_free(p, 100);
+  }
+  return NULL;
+}
+
+// freed by another thread, returned to the class at its exit, then reused
+static void test_threads() {
+  uint64_t reserved = 0;
+  for (int round = 0; round < 3; round++) {
+    std::vector<void *> ptrs;
+    for (size_t i = 0; i < k_objs; i++) {
+      ptrs.push_back(slab_alloc(100));
+    }
+    SlabClassStats st[k_slab_classes];
+    slab_stats(st);
+    SlabClassStats const *s = NULL;
+    for (SlabClassStats const &x : st) {
+      if (x.size == slab_size(100)) {
+        s = &x;
+      }
+    }
+    assert(s && s->live == k_objs && s->requested == k_objs * 100);
+    assert(s->reserved >= k_objs * s->size);
+    pthread_t t;
+    int rv = pthread_create(&t, NULL, &free_all, &ptrs);
+    assert(rv == 0);
+    pthread_join(t, NULL);
+    assert(live_total() == 0);
+    if (round == 0) {
+      reserved = reserved_total();
+    }
+    assert(reserved_total() == reserved);
+  }
+}
+
+static uint64_t reserved_of(size_t size) {
+  SlabClassStats st[k_slab_classes];
+  slab_stats(st);
+  for (SlabClassStats const &s : st) {
+    if (s.size == slab_size(size)) {
+      return s.reserved;
+    }
+  }
+  return 0;
+}
+
+// moving the survivors of random frees out of the sparse spans returns
+// the spans to the OS, the contents are kept
+static void test_defrag() {
+  size_t const size = 72;
+  std::vector<uint64_t *> ptrs;
+  for (uint64_t i = 0; i < 4 * k_objs; i++) {
+    uint64_t *p = (uint64_t *)slab_alloc(size);
+    p[0] = p[8] = i;
+    ptrs.push_back(p);
+  }
+  std::vector<uint64_t *> kept;
+  srand(2);
+  for (uint64_t *p : ptrs) {
+    if (rand() % 10 == 0) {
+      kept.push_back(p);
+    } else {
+      slab_free(p, size);
+    }
+  }
+  uint64_t fragmented = reserved_of(size);
+  uint64_t released = slab_released_bytes();
+  uint64_t live = kept.size() * slab_size(size);
+  assert(fragmented > 5 * live);
+  uint64_t freed = 0;  // by the moves
+  for (int pass = 0; pass < 20; pass++) {
+    for (uint64_t *&p : kept) {
+      uint64_t *q = (uint64_t *)slab_defrag_move(p, size);
+      if (q) {
+        assert(q[0] == p[0] && q[8] == p[8]);
+        freed += slab_defrag_free(p, size);
+        p = q;
+      }
+    }
+  }
+  uint64_t reserved = reserved_of(size);
+  assert(reserved < live + live / 8 + (64 << 10));
+  assert(slab_released_bytes() - released >= fragmented - reserved);
+  // the spans emptied by the frees, as reported to the caller
+  assert(freed >= fragmented - reserved && freed <= slab_released_bytes() - released);
+  for (uint64_t *p : kept) {
+    assert(p[0] == p[8]);
+    slab_free(p, size);
+  }
+}
+
+int main() {
+  test_classes();
+  test_random();
+  test_threads();
+  test_defrag();
+  return 0;
+}
@@ -0,0 +1,187 @@
+#include "byoredis/ds/swisstable.hh"
+#include "byoredis/ds/intrusive.hh"  // for container_of
+#include <unordered_map>
+#include <unordered_set>
+#include <assert.h>
+#include <stdlib.h>
+
+struct Data {
+  HNode node;
+  uint64_t key = 0;
+  uint32_t moves = 0;
+};
+
+struct Container {
+  SMap smap;
+  std::unordered_map<uint64_t, Data *> ref;
+};
+
+static bool data_eq(HNode *lhs, HNode *rhs) {
+  return container_of(lhs, Data, node)->key == container_of(rhs, Data, node)->key;
+}
+
+// a weak hash on purpose, to get tag and group collisions
+static uint64_t weak_hash(uint64_t key) {
+  return key % 1000;
+}
+
+static Data * lookup(Container &c, uint64_t key) {
+  Data probe;
+  probe.key = key;
+  probe.node.hcode = weak_hash(key);
+  HNode *node = sm_lookup(&c.smap, &probe.node, &data_eq);
+  return node ? container_of(node, Data, node) : NULL;
+}
+
+static void add(Container &c, uint64_t key) {
+  assert(!lookup(c, key));
+  Data *d = new Data();
+  d->key = key;
+  d->node.hcode = weak_hash(key);
+  sm_insert(&c.smap, &d->node);
+  c.ref[key] = d;
+}
+
+static void del(Container &c, uint64_t key) {
+  Data probe;
+  probe.key = key;
+  probe.node.hcode = weak_hash(key);
+  HNode *node = sm_delete(&c.smap, &probe.node, &data_eq);
+  auto it = c.ref.find(key);
+  if (it == c.ref.end()) {
+    assert(!node);
+    return;
+  }
+  assert(node == &it->second->node);
+  delete it->second;
+  c.ref.erase(it);
+}
+
+static bool cb_count(HNode *node, void *arg) {
+  (void)node;
+  (*(size_t *)arg)++;
+  return true;
+}
+
+static void verify(Container &c) {
+  assert(sm_size(&c.smap) == c.ref.size());
+  size_t n = 0;
+  sm_foreach(&c.smap, &cb_count, &n);
+  assert(n == c.ref.size());
+  for (auto const &p : c.ref) {
+    assert(lookup(c, p.first) == p.second);
+  }
+}
+
+static void dispose(Container &c) {
+  for (auto const &p : c.ref) {
+    delete p.second;
+  }
+  sm_clear(&c.smap);
+}
+
+static void cb_scan(HNode *node, void *arg) {
+  ((std::unordered_set<uint64_t> *)arg)->insert(container_of(node, Data, node)->key);
+}
+
+// keys present for the whole scan are seen, while the table resizes
+static void test_scan(uint64_t nkeys, uint64_t nadd) {
+  Container c;
+  for (uint64_t i = 0; i < nkeys; i++) {
+    add(c, i);
+  }
+  std::unordered_set<uint64_t> seen;
+  uint64_t next = 1000000;
+  uint64_t cursor = 0;
+  do {
+    cursor = sm_scan(&c.smap, cursor, &cb_scan, &seen);
+    // grow, and delete some of the keys added during the scan;
+    // bounded, or the table could outgrow the cursor forever
+    for (uint64_t i = 0; i < nadd && next < 1000000 + 4 * nkeys + 1000; i++) {
+      add(c, next++);
+    }
+    if (next > 1000000 && rand() % 2 == 0) {
+      del(c, 1000000 + (uint64_t)rand() % (next - 1000000));
+    }
+  } while (cursor != 0);
+  for (uint64_t i = 0; i < nkeys; i++) {
+    assert(seen.count(i));
+  }
+  for (uint64_t key : seen) {
+    assert(key < nkeys || (key >= 1000000 && key < next));
+  }
+  dispose(c);
+}
+
+// a copy of the node takes its place
+static HNode * cb_move(HNode *node, void *arg) {
+  Container *c = (Container *)arg;
+  Data *old = container_of(node, Data, node);
+  Data *d = new Data(*old);
+  d->moves++;
+  c->ref[d->key] = d;
+  delete old;
+  return &d->node;
+}
+
+// every node is moved and found at its new address, also while rehashing
+static void test_defrag(uint64_t nkeys) {
+  Container c;
+  for (uint64_t i = 0; i < nkeys; i++) {
+    add(c, i);
+  }
+  uint64_t cursor = 0;
+  do {
+    cursor = sm_defrag(&c.smap, cursor, &cb_move, &c);
+  } while (cursor != 0);
+  assert(sm_size(&c.smap) == nkeys);
+  for (auto const &p : c.ref) {
+    assert(p.second->moves >= 1);
+    Data probe;
+    probe.key = p.first;
+    probe.node.hcode = weak_hash(p.first);
+    assert(sm_lookup(&c.smap, &probe.node, &data_eq) == &p.second->node);
+  }
+  dispose(c);
+}
+
+int main() {
+  srand(1);
+  for (uint64_t n : {0, 1, 100, 5000}) {
+    test_scan(n, 0);
+    test_scan(n, 3);
+    test_scan(n, 50);
+    test_defrag(n);
+  }
+  Container c;
+  // grow through several progressive resizes
+  for (uint64_t i = 0; i < 20000; i++) {
+    add(c, i);
+    if (i % 997 == 0) {
+      verify(c);
+    }
+  }
+  verify(c);
+  assert(!lookup(c, 20000));
+  // churn: tombstones and in-place rehashes
+  srand(1);
+  for (size_t i = 0; i < 200000; i++) {
+    uint64_t key = (uint64_t)rand() % 40000;
+    if (c.ref.count(key)) {
+      del(c, key);
+    } else {
+      add(c, key);
+    }
+    if (i % 9973 == 0) {
+      verify(c);
+    }
+  }
+  verify(c);
+  // drain
+  while (!c.ref.empty()) {
+    del(c, c.ref.begin()->first);
+  }
+  verify(c);
+  dispose(c);
+  return 0;
+}
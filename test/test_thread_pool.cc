@@ -0,0 +1,186 @@
+#include <assert.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <atomic>
+#include <set>
+#include <vector>
+#include "byoredis/server/thread_pool.hh"
+
+// a task holding its worker until released
+struct Blocker {
+  std::atomic<bool> release{false};
+};
+
+static std::atomic<size_t> g_blocked{0};
+
+static void block_func(void *arg) {
+  Blocker *b = (Blocker *)arg;
+  g_blocked.fetch_add(1);
+  while (!b->release.load()) {
+    usleep(100);
+  }
+}
+
+// every worker runs a blocker, so nothing queued after starts until released
+static std::vector<Blocker> * block_all(ThreadPool *tp) {
+  size_t n = thread_pool_stats(tp).workers;
+  std::vector<Blocker> *blockers = new std::vector<Blocker>(n);
+  g_blocked.store(0);
+  for (Blocker &b : *blockers) {
+    thread_pool_queue(tp, &block_func, &b, PRIO_LAZY_FREE);
+  }
+  while (g_blocked.load() < n) {
+    usleep(100);
+  }
+  return blockers;
+}
+
+struct Ran {
+  std::vector<uintptr_t> order;  // the single worker left appends
+  std::atomic<size_t> count{0};
+};
+
+static Ran g_ran;
+
+static void record_func(void *arg) {
+  g_ran.order.push_back((uintptr_t)arg);
+  g_ran.count.fetch_add(1);
+}
+
+// a worker runs the lower priority values first, each class in FIFO order
+static void test_priority() {
+  ThreadPool tp;
+  thread_pool_init(&tp, 4);
+  std::vector<Blocker> *blockers = block_all(&tp);
+  size_t const n = 100;
+  for (uintptr_t i = 0; i < n; i++) {
+    thread_pool_queue(&tp, &record_func, (void *)i, i % 3 ? PRIO_FLUSH : PRIO_LAZY_FREE);
+  }
+  // one worker runs them all, one at a time
+  (*blockers)[0].release.store(true);
+  while (g_ran.count.load() < n) {
+    usleep(100);
+  }
+  std::vector<uintptr_t> expect;
+  for (uintptr_t i = 0; i < n; i += 3) {
+    expect.push_back(i);
+  }
+  for (uintptr_t i = 0; i < n; i++) {
+    if (i % 3) {
+      expect.push_back(i);
+    }
+  }
+  assert(g_ran.order == expect);
+  ThreadPoolStats st = thread_pool_stats(&tp);
+  assert(st.queued[PRIO_LAZY_FREE] == blockers->size() + (n + 2) / 3);
+  assert(st.queued[PRIO_FLUSH] == n - (n + 2) / 3);
+  assert(st.done[PRIO_FLUSH] == st.queued[PRIO_FLUSH]);
+  assert(st.depth[PRIO_LAZY_FREE] == 0 && st.depth[PRIO_FLUSH] == 0);
+  for (Blocker &b : *blockers) {
+    b.release.store(true);
+  }
+  thread_pool_stop(&tp);
+  delete blockers;
+}
+
+size_t const k_subtasks = 64;
+
+struct Fanout {
+  ThreadPool *tp = NULL;
+  std::atomic<size_t> done{0};
+  pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+  std::set<pthread_t> threads;  // where the subtasks ran
+  pthread_t parent;
+};
+
+static void sub_func(void *arg) {
+  Fanout *f = (Fanout *)arg;
+  usleep(200);
+  pthread_mutex_lock(&f->mu);
+  f->threads.insert(pthread_self());
+  pthread_mutex_unlock(&f->mu);
+  f->done.fetch_add(1);
+}
+
+// queues into its worker's deque, then waits: the others must steal
+static void parent_func(void *arg) {
+  Fanout *f = (Fanout *)arg;
+  f->parent = pthread_self();
+  for (size_t i = 0; i < k_subtasks; i++) {
+    thread_pool_queue(f->tp, &sub_func, f, PRIO_LAZY_FREE);
+  }
+  while (f->done.load() < k_subtasks) {
+    usleep(100);
+  }
+}
+
+static void test_steal() {
+  ThreadPool tp;
+  thread_pool_init(&tp, 4);
+  Fanout f;
+  f.tp = &tp;
+  thread_pool_queue(&tp, &parent_func, &f, PRIO_LAZY_FREE);
+  while (f.done.load() < k_subtasks) {
+    usleep(100);
+  }
+  ThreadPoolStats st = thread_pool_stats(&tp);
+  assert(st.steals == k_subtasks);
+  assert(!f.threads.empty() && f.threads.count(f.parent) == 0);
+  thread_pool_stop(&tp);
+}
+
+size_t const k_stop_tasks = 100000;
+
+static std::vector<std::atomic<uint8_t>> g_runs(k_stop_tasks);
+
+static void count_func(void *arg) {
+  g_runs[(uintptr_t)arg].fetch_add(1);
+}
+
+struct Releaser {
+  ThreadPool *tp;
+  std::vector<Blocker> *blockers;
+};
+
+// lets the workers go once the stop has begun
+static void *release_main(void *arg) {
+  Releaser *r = (Releaser *)arg;
+  while (!r->tp->stopping.load()) {
+    usleep(100);
+  }
+  for (Blocker &b : *r->blockers) {
+    b.release.store(true);
+  }
+  return NULL;
+}
+
+// the stop runs every queued task exactly once, then joins the workers
+static void test_stop() {
+  ThreadPool tp;
+  thread_pool_init(&tp, 4);
+  std::vector<Blocker> *blockers = block_all(&tp);
+  for (uintptr_t i = 0; i < k_stop_tasks; i++) {
+    thread_pool_queue(&tp, &count_func, (void *)i, i % 2 ? PRIO_FLUSH : PRIO_LAZY_FREE);
+  }
+  ThreadPoolStats st = thread_pool_stats(&tp);
+  assert(st.depth[PRIO_LAZY_FREE] + st.depth[PRIO_FLUSH] == k_stop_tasks);
+  Releaser r{&tp, blockers};
+  pthread_t releaser;
+  int rv = pthread_create(&releaser, NULL, &release_main, &r);
+  assert(rv == 0);
+  thread_pool_stop(&tp);
+  for (uintptr_t i = 0; i < k_stop_tasks; i++) {
+    assert(g_runs[i].load() == 1);
+  }
+  pthread_join(releaser, NULL);
+  delete blockers;
+  (void)rv;
+}
+
+int main() {
+  test_priority();
+  test_steal();
+  test_stop();
+  return 0;
+}
@@ -0,0 +1,139 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "byoredis/ds/timerwheel.hh"
+#include "byoredis/ds/intrusive.hh"  // for container_of
+
+struct Data {
+  TWNode timer;
+  uint32_t id = 0;
+};
+
+struct Container {
+  TimerWheel tw;
+  std::vector<Data *> nodes;
+  std::multimap<uint64_t, uint32_t> ref;  // expire_at -> id
+};
+
+static void ref_erase(Container &c, Data *d) {
+  auto range = c.ref.equal_range(d->timer.expire_at);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second == d->id) {
+      c.ref.erase(it);
+      return;
+    }
+  }
+  assert(!"not found");
+}
+
+static void add(Container &c, Data *d, uint64_t expire_at) {
+  if (tw_active(&d->timer)) {
+    ref_erase(c, d);
+  }
+  tw_add(&c.tw, &d->timer, expire_at);
+  c.ref.insert(std::make_pair(expire_at, d->id));
+  assert(tw_size(&c.tw) == c.ref.size());
+}
+
+static void del(Container &c, Data *d) {
+  if (tw_active(&d->timer)) {
+    ref_erase(c, d);
+  }
+  tw_del(&c.tw, &d->timer);
+  assert(!tw_active(&d->timer));
+  assert(tw_size(&c.tw) == c.ref.size());
+}
+
+// pop everything due, nothing else
+static void expire(Container &c, uint64_t now) {
+  // never wakes up after the earliest timer, or the current tick if overdue
+  assert(c.ref.empty() || tw_next(&c.tw) <= std::max(c.ref.begin()->first, c.tw.cur));
+  assert(!c.ref.empty() || tw_next(&c.tw) == (uint64_t)-1);
+  while (TWNode *node = tw_pop(&c.tw, now)) {
+    Data *d = container_of(node, Data, timer);
+    assert(d->timer.expire_at <= now);
+    assert(!tw_active(&d->timer));
+    ref_erase(c, d);
+  }
+  assert(c.ref.empty() || c.ref.begin()->first > now);
+  assert(tw_size(&c.tw) == c.ref.size());
+}
+
+static uint64_t random_delay() {
+  // mostly short, some spanning every level and the overflow
+  switch (rand() % 4) {
+  case 0:  return rand() % 100;
+  case 1:  return rand() % 10000;
+  case 2:  return (uint64_t)rand() * 1000;
+  default: return (uint64_t)1 << (rand() % 40);
+  }
+}
+
+static void test_random(uint64_t start) {
+  Container *c = new Container();
+  tw_init(&c->tw, start);
+  for (uint32_t i = 0; i < 2000; i++) {
+    Data *d = new Data();
+    d->id = i;
+    c->nodes.push_back(d);
+  }
+  uint64_t now = start;
+  for (size_t round = 0; round < 5000; round++) {
+    for (int k = 0; k < 5; k++) {
+      Data *d = c->nodes[rand() % c->nodes.size()];
+      if (rand() % 4 == 0) {
+        del(*c, d);
+      } else {
+        // the past is allowed, like a TTL of 0 set late
+        uint64_t late = rand() % 3;
+        add(*c, d, now >= late && rand() % 8 == 0 ? now - late : now + random_delay());
+      }
+    }
+    // small steps and large jumps
+    now += (rand() % 8 == 0) ? random_delay() : (uint64_t)(rand() % 70);
+    expire(*c, now);
+  }
+  // drain by jumping far ahead
+  expire(*c, now + ((uint64_t)1 << 41));
+  assert(c->ref.empty());
+  for (Data *d : c->nodes) {
+    delete d;
+  }
+  delete c;
+}
+
+// the timer is moved in memory while scheduled
+static void test_moved() {
+  Container *c = new Container();
+  tw_init(&c->tw, 1000);
+  Data *a = new Data(), *b = new Data(), *m = new Data();
+  a->id = 1, b->id = 2, m->id = 3;
+  add(*c, a, 1005);
+  add(*c, m, 1005);
+  add(*c, b, 1005);
+  Data *moved = new Data();
+  memcpy((void *)moved, (void *)m, sizeof(Data));
+  tw_moved(&moved->timer);
+  delete m;
+  std::vector<uint32_t> ids;
+  expire(*c, 1004);
+  while (TWNode *node = tw_pop(&c->tw, 1005)) {
+    ids.push_back(container_of(node, Data, timer)->id);
+  }
+  assert((ids == std::vector<uint32_t>{1, 3, 2}));
+  assert(tw_size(&c->tw) == 0);
+  delete a, delete b, delete moved;
+  delete c;
+}
+
+int main() {
+  srand(1);
+  test_random(0);
+  test_random(123456789);
+  test_random(((uint64_t)1 << 36) - 5000);  // crosses the overflow boundary
+  test_moved();
+  return 0;
+}
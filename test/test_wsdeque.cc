@@ -0,0 +1,102 @@
+#include <assert.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include "byoredis/ds/wsdeque.hh"
+
+static Work item(uintptr_t id) {
+  return Work{NULL, (void *)id};
+}
+
+static uintptr_t id_of(Work const &w) {
+  return (uintptr_t)w.arg;
+}
+
+// LIFO for the owner, FIFO for the thieves, growing past the capacity
+static void test_order() {
+  WSDeque dq;
+  wsd_init(&dq, 4);
+  for (uintptr_t i = 1; i <= 100; i++) {
+    wsd_push(&dq, item(i));
+  }
+  assert(wsd_size(&dq) == 100);
+  Work w;
+  assert(wsd_steal(&dq, &w) && id_of(w) == 1);
+  assert(wsd_take(&dq, &w) && id_of(w) == 100);
+  assert(wsd_steal(&dq, &w) && id_of(w) == 2);
+  for (uintptr_t i = 99; i >= 3; i--) {
+    assert(wsd_take(&dq, &w) && id_of(w) == i);
+  }
+  assert(!wsd_take(&dq, &w));
+  assert(!wsd_steal(&dq, &w));
+  assert(wsd_size(&dq) == 0);
+  wsd_free(&dq);
+}
+
+size_t const k_items   = 1000000;
+size_t const k_thieves = 3;
+
+struct Shared {
+  WSDeque dq;
+  std::vector<std::atomic<uint8_t>> seen;
+  std::atomic<bool> done{false};
+  Shared() : seen(k_items + 1) {}
+};
+
+static void *thief(void *arg) {
+  Shared *sh = (Shared *)arg;
+  while (true) {
+    // read the flag first, then drain
+    bool last = sh->done.load();
+    Work w;
+    while (wsd_steal(&sh->dq, &w)) {
+      sh->seen[id_of(w)].fetch_add(1);
+    }
+    if (last) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+// every item is taken or stolen exactly once
+static void test_concurrent() {
+  Shared *sh = new Shared();
+  wsd_init(&sh->dq, 16);
+  pthread_t threads[k_thieves];
+  for (pthread_t &t : threads) {
+    int rv = pthread_create(&t, NULL, &thief, sh);
+    assert(rv == 0);
+  }
+  uint32_t rnd = 1;
+  for (uintptr_t i = 1; i <= k_items; i++) {
+    wsd_push(&sh->dq, item(i));
+    rnd = rnd * 1103515245 + 12345;
+    if ((rnd >> 16) % 3 == 0) {
+      Work w;
+      if (wsd_take(&sh->dq, &w)) {
+        sh->seen[id_of(w)].fetch_add(1);
+      }
+    }
+  }
+  Work w;
+  while (wsd_take(&sh->dq, &w)) {
+    sh->seen[id_of(w)].fetch_add(1);
+  }
+  sh->done.store(true);
+  for (pthread_t &t : threads) {
+    pthread_join(t, NULL);
+  }
+  for (uintptr_t i = 1; i <= k_items; i++) {
+    assert(sh->seen[i].load() == 1);
+  }
+  wsd_free(&sh->dq);
+  delete sh;
+}
+
+int main() {
+  test_order();
+  test_concurrent();
+  return 0;
+}
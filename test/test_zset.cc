@@ -0,0 +1,261 @@
+#include "byoredis/ds/zset.hh"
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+typedef std::pair<double, std::string> Tuple;
+
+struct Container {
+  ZSet zset;
+  std::set<Tuple> ordered;
+  std::map<std::string, double> scores;
+};
+
+static void add(Container &c, std::string const &name, double score) {
+  auto it = c.scores.find(name);
+  bool added = zset_insert(&c.zset, name.data(), name.size(), score);
+  assert(added == (it == c.scores.end()));
+  if (it != c.scores.end()) {
+    c.ordered.erase(Tuple(it->second, name));
+  }
+  c.scores[name] = score;
+  c.ordered.insert(Tuple(score, name));
+}
+
+static void incr(Container &c, std::string const &name, double delta) {
+  double score = 0;
+  bool ok = zset_incrby(&c.zset, name.data(), name.size(), delta, score);
+  auto it = c.scores.find(name);
+  double expect = (it == c.scores.end()) ? delta : it->second + delta;
+  if (isnan(expect)) {
+    assert(!ok);
+    return;
+  }
+  assert(ok && score == expect);
+  if (it != c.scores.end()) {
+    c.ordered.erase(Tuple(it->second, name));
+  }
+  c.scores[name] = score;
+  c.ordered.insert(Tuple(score, name));
+}
+
+static void del(Container &c, std::string const &name) {
+  bool removed = zset_remove(&c.zset, name.data(), name.size());
+  auto it = c.scores.find(name);
+  assert(removed == (it != c.scores.end()));
+  if (removed) {
+    c.ordered.erase(Tuple(it->second, name));
+    c.scores.erase(it);
+  }
+}
+
+static void del_range(Container &c, int64_t start, int64_t stop) {
+  ZNode *garbage = NULL;
+  size_t count = zset_remove_range(&c.zset, start, stop, &garbage);
+  size_t expect = 0;
+  auto it = c.ordered.begin();
+  for (int64_t rank = 0; it != c.ordered.end(); rank++) {
+    if (start <= rank && rank < stop) {
+      c.scores.erase(it->second);
+      it = c.ordered.erase(it);
+      expect++;
+    } else {
+      ++it;
+    }
+  }
+  assert(count == expect);
+  assert((garbage != NULL) == (count > 0 && !c.zset.lp));
+  zset_dispose(garbage);
+}
+
+static void verify(Container &c) {
+  assert(zset_len(&c.zset) == c.ordered.size());
+  // iteration order and ranks
+  ZIter it = zset_at(&c.zset, 0);
+  int64_t rank = 0;
+  for (Tuple const &t : c.ordered) {
+    assert(zit_valid(it));
+    assert(it.rank == rank);
+    assert(it.score == t.first && std::string(it.name, it.len) == t.second);
+    assert(zset_rank(&c.zset, t.second.data(), t.second.size()) == rank);
+    double score = 0;
+    assert(zset_score(&c.zset, t.second.data(), t.second.size(), score));
+    assert(score == t.first);
+    zit_next(it);
+    rank++;
+  }
+  assert(!zit_valid(it));
+  // backward
+  it = zset_at(&c.zset, rank - 1);
+  for (auto r = c.ordered.rbegin(); r != c.ordered.rend(); ++r) {
+    assert(zit_valid(it));
+    assert(it.rank == --rank);
+    assert(it.score == r->first && std::string(it.name, it.len) == r->second);
+    zit_prev(it);
+  }
+  assert(!zit_valid(it));
+  rank = (int64_t)c.ordered.size();
+  assert(!zit_valid(zset_at(&c.zset, -1)));
+  assert(!zit_valid(zset_at(&c.zset, rank)));
+  // sums
+  std::vector<double> scores;
+  for (Tuple const &t : c.ordered) {
+    scores.push_back(t.first);
+  }
+  int64_t n = (int64_t)scores.size();
+  for (int64_t start = -1; start <= n; start += 1 + n / 5) {
+    for (int64_t stop = start; stop <= n + 1; stop += 1 + n / 5) {
+      double expect = 0;
+      for (int64_t i = std::max(start, (int64_t)0); i < std::min(stop, n); i++) {
+        expect += scores[(size_t)i];
+      }
+      assert(zset_range_sum(&c.zset, start, stop) == expect);
+    }
+  }
+  // seek
+  for (double score = -1; score <= 11; score += 0.5) {
+    auto lb = c.ordered.lower_bound(Tuple(score, ""));
+    int64_t expect = (int64_t)std::distance(c.ordered.begin(), lb);
+    assert(zset_seekge(&c.zset, score, "", 0) == expect);
+  }
+}
+
+static std::string rand_name() {
+  // mostly short names, some too long for the listpack
+  size_t len = (rand() % 16 == 0) ? 20 + rand() % 40 : 1 + rand() % 4;
+  std::string name;
+  for (size_t i = 0; i < len; i++) {
+    name.push_back((char)('a' + rand() % 3));
+  }
+  return name;
+}
+
+static void test_case(size_t nops) {
+  Container c;
+  for (size_t i = 0; i < nops; i++) {
+    std::string name = rand_name();
+    if (rand() % 32 == 0) {
+      int64_t start = rand() % 20 - 2;
+      del_range(c, start, start + rand() % 20);
+    } else if (rand() % 4 == 0) {
+      // mostly small steps that keep the order
+      incr(c, name, (double)(rand() % 5 - 2) / 8);
+    } else if (rand() % 3 == 0) {
+      del(c, name);
+    } else {
+      add(c, name, (double)(rand() % 21) / 2);
+    }
+    verify(c);
+  }
+  // NaN is rejected
+  incr(c, "inf", INFINITY);
+  incr(c, "inf", -INFINITY);
+  verify(c);
+  // drain, then start over as a listpack
+  while (!c.scores.empty()) {
+    del(c, c.scores.begin()->first);
+  }
+  verify(c);
+  add(c, "x", 1);
+  assert((c.zset.lp != NULL) == (g_zset_max_listpack_entries > 0));
+  verify(c);
+  zset_clear(&c.zset);
+}
+
+// load a batch with duplicates, sorted or not
+static void test_bulk(size_t n, bool sorted) {
+  Container c;
+  std::vector<std::string> names;
+  std::vector<ZMember> members(n);
+  for (size_t i = 0; i < n; i++) {
+    names.push_back(rand_name());
+  }
+  for (size_t i = 0; i < n; i++) {
+    members[i].name = names[i].data();
+    members[i].len = names[i].size();
+    members[i].score = sorted ? (double)i : (double)(rand() % 21) / 2;
+  }
+  if (sorted) {
+    std::sort(members.begin(), members.end(), [](ZMember const &a, ZMember const &b) {
+      return Tuple(a.score, std::string(a.name, a.len)) < Tuple(b.score, std::string(b.name, b.len));
+    });
+  }
+  size_t added = zset_insert_bulk(&c.zset, members.data(), members.size());
+  std::map<std::string, double> last;
+  for (ZMember const &m : members) {
+    last[std::string(m.name, m.len)] = m.score;
+  }
+  assert(added == last.size());
+  for (auto const &kv : last) {
+    c.scores[kv.first] = kv.second;
+    c.ordered.insert(Tuple(kv.second, kv.first));
+  }
+  verify(c);
+  // then modify it incrementally
+  add(c, "x", 3);
+  verify(c);
+  zset_clear(&c.zset);
+}
+
+// nodes moved out of the spans left sparse by deletes keep both indexes
+static void test_defrag(size_t n) {
+  Container c;
+  for (size_t i = 0; i < n; i++) {
+    add(c, "m" + std::to_string(i), (double)(rand() % 21) / 2);
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (rand() % 5 != 0) {
+      del(c, "m" + std::to_string(i));
+    }
+  }
+  size_t moved = 0;
+  uint64_t released = 0;
+  for (int pass = 0; pass < 3; pass++) {
+    uint64_t cursor = 0;
+    do {
+      cursor = zset_defrag(&c.zset, cursor, &moved, &released);
+    } while (cursor != 0);
+    verify(c);
+  }
+  assert(moved > 0);
+  // still usable
+  for (size_t i = 0; i < n; i += 3) {
+    if (rand() % 2) {
+      add(c, "m" + std::to_string(i), (double)(rand() % 21) / 2);
+    } else {
+      del(c, "m" + std::to_string(i));
+    }
+  }
+  verify(c);
+  zset_clear(&c.zset);
+}
+
+int main() {
+  for (int index : {ZSET_INDEX_AVL, ZSET_INDEX_BTREE}) {
+    g_zset_index = index;
+    g_zset_max_listpack_entries = 8;
+    g_zset_max_listpack_value = 16;
+    srand(1);
+    for (size_t i = 0; i < 300; i++) {
+      test_case(i);
+    }
+    // the tree encoding only
+    g_zset_max_listpack_entries = 0;
+    for (size_t i = 0; i < 100; i++) {
+      test_case(i);
+    }
+    g_zset_max_listpack_entries = 8;
+    for (size_t n = 0; n < 300; n += 7) {
+      test_bulk(n, false);
+      test_bulk(n, true);
+    }
+    test_defrag(5000);
+  }
+  return 0;
+}